@@ -0,0 +1,180 @@
+
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <sys/socket.h>
+#include <xdrpp/arena.h>
+#include <xdrpp/srpc.h>
+#include "tests/arenatest.hh"
+
+using namespace std;
+using namespace xdr;
+
+static_assert(is_same<decltype(arena_node::name),
+	      arena_xstring<>>::value, "xdrc -arena string");
+static_assert(is_same<decltype(arena_node::next),
+	      arena_pointer<arena_node>>::value, "xdrc -arena pointer");
+
+static bool
+in_arena(const arena_allocator<char> &a, const arena &ar)
+{
+  return a.arena_ == &ar;
+}
+
+arena_tree
+make_tree()
+{
+  arena_tree t;
+  t.tags[0] = "zero";
+  t.tags[1] = "one";
+  for (int i = 0; i < 50; i++) {
+    t.nodes.emplace_back();
+    arena_node &n = t.nodes.back();
+    n.name = "node " + to_string(i);
+    n.data.assign(i, uint8_t(i));
+    n.values.assign(i, i);
+    if (i % 3 == 0)
+      n.next.activate().name = "child";
+  }
+  return t;
+}
+
+void
+test_decode()
+{
+  arena_tree t = make_tree();
+  // Built outside of any scope, so everything is on the heap.
+  assert(!t.nodes.get_allocator().arena_);
+  assert(!t.nodes[0].next.get_deleter().arena_);
+
+  msg_ptr m = xdr_to_msg(t);
+  arena ar(0x1000);
+  arena_tree t2;
+  xdr_from_msg(m, ar, t2);
+  assert(t2 == t);
+  assert(t2.nodes.get_allocator().arena_ == &ar);
+  assert(in_arena(t2.nodes[7].name.get_allocator(), ar));
+  assert(t2.nodes[3].next.get_deleter().arena_ == &ar);
+  assert(in_arena(t2.tags[1].get_allocator(), ar));
+
+  // Copies made outside the scope are independent of the arena.
+  arena_tree t3 = t2;
+  assert(t3 == t);
+  assert(!t3.nodes.get_allocator().arena_);
+  assert(!t3.nodes[3].next.get_deleter().arena_);
+
+  // Decoding into an object also works when done repeatedly with
+  // resets in between.
+  t2 = arena_tree();
+  for (int i = 0; i < 3; i++) {
+    ar.reset();
+    arena_tree t4;
+    xdr_from_msg(m, ar, t4);
+    assert(t4 == t);
+  }
+}
+
+void
+test_arena()
+{
+  arena ar(64);
+  arena_scope s(ar);
+  void *p1 = ar.allocate(8, 8);
+  void *p2 = ar.allocate(1, 1);
+  void *p3 = ar.allocate(8, 8);
+  assert(static_cast<char *>(p2) == static_cast<char *>(p1) + 8);
+  assert(!(reinterpret_cast<uintptr_t>(p3) & 7));
+  void *big = ar.allocate(1000, 8);
+  void *p4 = ar.allocate(4, 4);
+  // The oversized allocation does not displace the current block.
+  assert(static_cast<char *>(p4) < static_cast<char *>(p1) + 64);
+  assert(big);
+
+  arena_xvector<int> v;
+  assert(v.get_allocator().arena_ == &ar);
+  for (int i = 0; i < 100; i++)
+    v.push_back(i);
+  assert(v[99] == 99);
+  {
+    arena_scope none(nullptr);
+    arena_xstring<> s2("heap");
+    assert(!s2.get_allocator().arena_);
+  }
+}
+
+// Keeps copies of its arguments, and fields moved out of them, none
+// of which may be in the request's arena.
+struct keep_server {
+  using rpc_interface_type = ARENA_V1;
+  std::vector<std::unique_ptr<arena_node>> kept_;
+  std::vector<arena_xstring<>> names_;
+  std::vector<arena_opaque_vec<>> data_;
+
+  void keep(std::unique_ptr<arena_node> arg) {
+    assert(arg->name.get_allocator().arena_);
+    kept_.emplace_back(new arena_node(*arg));
+    assert(!kept_.back()->name.get_allocator().arena_);
+    assert(!kept_.back()->next.get_deleter().arena_);
+    names_.emplace_back();
+    names_.back() = std::move(arg->name);
+    assert(!names_.back().get_allocator().arena_);
+    data_.emplace_back();
+    data_.back() = std::move(arg->data);
+    assert(!data_.back().get_allocator().arena_);
+    arena_xstring<> s("made here");
+    assert(!s.get_allocator().arena_);
+  }
+};
+
+void
+test_server()
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+  keep_server ks;
+  thread t([&ks](sock_t s) {
+      srpc_server srv(s);
+      srv.register_service(ks);
+      try { srv.run(); }
+      catch (const std::exception &) {}
+    }, sock_t(fds[1]));
+
+  {
+    srpc_client<ARENA_V1> c{sock_t(fds[0])};
+    arena_node n;
+    for (int i = 0; i < 3; i++) {
+      n.name = "node " + to_string(i) + " with a name too long for SSO";
+      n.data.assign(64, uint8_t(i));
+      n.next.activate().name = "child";
+      c.keep(n);
+    }
+  }
+  close(fds[0]);
+  t.join();
+
+  // The arena has been reset after every call, and its blocks reused.
+  // Fields moved out of earlier requests were copied to the heap and
+  // are still intact.
+  assert(ks.kept_.size() == 3);
+  for (int i = 0; i < 3; i++) {
+    string name = "node " + to_string(i) + " with a name too long for SSO";
+    assert(ks.kept_[i]->name == name.c_str());
+    assert(ks.kept_[i]->next->name == "child");
+    assert(ks.names_[i] == name.c_str());
+    assert(ks.data_[i].size() == 64);
+    for (uint8_t b : ks.data_[i])
+      assert(b == i);
+  }
+}
+
+int
+main()
+{
+  test_arena();
+  test_decode();
+  test_server();
+  return 0;
+}
@@ -0,0 +1,21 @@
+%using xdr::operator==;
+
+typedef string short_str<16>;
+
+struct arena_node {
+  string name<>;
+  opaque data<>;
+  arena_node *next;
+  int values<>;
+};
+
+struct arena_tree {
+  arena_node nodes<>;
+  short_str tags[2];
+};
+
+program ARENA_PROG {
+  version ARENA_V1 {
+    void keep(arena_node) = 1;
+  } = 1;
+} = 0x40000001;
@@ -1,5 +1,10 @@
 
+#include <cerrno>
+#include <mutex>
+#include <set>
+#include <netinet/in.h>
 #include <xdrpp/arpc.h>
+#include <xdrpp/srpc.h>
 #include "tests/xdrtest.hh"
 
 using namespace std;
@@ -32,6 +37,406 @@ public:
   }
 };
 
+// Ignores the first n transmissions of each call to three, so the
+// client must retransmit.
+class udp_server {
+public:
+  using rpc_interface_type = xdrtest2;
+  int ncalls_ = 0;
+  int nthree_ = 0;
+  std::vector<xdr::reply_cb<bigstr>> lost_;
+
+  void null2(xdr::reply_cb<void> cb) { ++ncalls_; cb(); }
+  void nonnull2(const u_4_12 &arg, xdr::reply_cb<ContainsEnum> cb) {
+    ++ncalls_;
+    ContainsEnum c(::REDDER);
+    c.num() = ContainsEnum::TWO;
+    cb(c);
+  }
+  void ut(const uniontest &arg, xdr::reply_cb<void> cb) { cb(); }
+  void three(const bool &arg1, const int &n,
+	     const bigstr &arg3, xdr::reply_cb<bigstr> cb) {
+    if (++nthree_ <= n)
+      lost_.push_back(cb);
+    else
+      cb(arg3);
+  }
+};
+
+void
+check_udp()
+{
+  unique_sock ls = udp_listen(nullptr, AF_INET);
+  sockaddr_in sin;
+  socklen_t sinlen = sizeof sin;
+  assert(getsockname(ls.get().fd_, reinterpret_cast<sockaddr *>(&sin),
+		     &sinlen) == 0);
+  udp_server s;
+  arpc_udp_listener rl(ps, std::move(ls));
+  rl.register_service(s);
+
+  rpc_udp_sock rs(ps, udp_connect("127.0.0.1",
+				  to_string(ntohs(sin.sin_port)).c_str(),
+				  AF_INET).release());
+  rs.set_retransmit(20, 3);
+  arpc_udp_client<xdrtest2> c{rs};
+
+  // Calls made together go out (and are answered) in one batch.
+  int nreplies = 0;
+  for (int i = 0; i < 40; i++)
+    c.null2([&nreplies](call_result<void> r) {
+	assert(r);
+	++nreplies;
+      });
+  c.nonnull2(u_4_12(12), [&nreplies](call_result<ContainsEnum> r) {
+      assert(r && r->num() == ContainsEnum::TWO);
+      ++nreplies;
+    });
+  while (nreplies < 41)
+    ps.poll();
+  assert(s.ncalls_ == 41);
+
+  bool done = false;
+  c.three(true, 2, "third time lucky", [&done](call_result<bigstr> r) {
+      assert(r && *r == "third time lucky");
+      done = true;
+    });
+  while (!done)
+    ps.poll();
+  assert(s.nthree_ == 3);
+
+  done = false;
+  s.nthree_ = 0;
+  c.three(true, 100, "never", [&done](call_result<bigstr> r) {
+      assert(!r && errno == ETIMEDOUT);
+      done = true;
+    });
+  while (!done)
+    ps.poll();
+  assert(s.nthree_ == 3);
+  s.lost_.clear();
+
+  // Reusing an outstanding xid fails the earlier call.
+  rpc_msg hdr { rs.get_xid(), CALL };
+  hdr.body.cbody().rpcvers = 2;
+  hdr.body.cbody().prog = xdrtest2::program;
+  hdr.body.cbody().vers = xdrtest2::version;
+  hdr.body.cbody().proc = xdrtest2::null2_t::proc;
+  int first = 0, second = 0;
+  rs.send_call(xdr_to_msg(hdr), [&first](msg_ptr m) {
+      assert(!m && errno == EEXIST);
+      ++first;
+    });
+  rs.send_call(xdr_to_msg(hdr), [&second](msg_ptr m) {
+      assert(m);
+      ++second;
+    });
+  assert(first == 1);
+  while (!second)
+    ps.poll();
+  assert(first == 1 && second == 1);
+}
+
+// Counts the connections a listener has open.
+struct counting_allocator {
+  int *nconn_;
+  void *allocate(rpc_sock *) { ++*nconn_; return nullptr; }
+  void deallocate(void *) { --*nconn_; }
+};
+using counting_listener = arpc_tcp_listener<void, counting_allocator>;
+
+// Make pipelined calls on each connection, then hang up and wait for
+// the server (with nconn connections open) to close its end.
+void
+call_and_hang_up(pollset &ps, udp_server &s, const int &nconn,
+		 std::vector<std::unique_ptr<rpc_sock>> &socks)
+{
+  constexpr int ncalls = 100;
+  int nreplies = 0;
+  for (auto &rs : socks) {
+    arpc_client<xdrtest2> c{*rs};
+    for (int j = 0; j < ncalls; j++)
+      c.three(true, 0, string(j * 100, 'x'),
+	      [&nreplies,j](call_result<bigstr> r) {
+		assert(r && *r == string(j * 100, 'x'));
+		++nreplies;
+	      });
+  }
+  int total = socks.size() * ncalls;
+  while (nreplies < total)
+    ps.poll();
+  assert(s.nthree_ == total);
+  assert(nconn == int(socks.size()));
+
+  int open = socks.size();
+  for (auto &rs : socks) {
+    rpc_sock *p = rs.release();
+    p->set_servcb([p,&open](msg_ptr m) {
+	assert(!m);
+	--open;
+	delete p;
+      });
+    shutdown(p->ms_->get_sock().fd_, SHUT_WR);
+  }
+  socks.clear();
+  while (open || nconn)
+    ps.poll();
+}
+
+void
+check_uring()
+{
+  pollset ps;
+  std::unique_ptr<io_ring> ring = io_ring::create(ps);
+  if (!ring) {
+    cerr << "io_uring not supported; skipping" << endl;
+    return;
+  }
+  unique_sock ls = tcp_listen(nullptr, AF_INET);
+  sockaddr_in sin;
+  socklen_t sinlen = sizeof sin;
+  assert(getsockname(ls.get().fd_, reinterpret_cast<sockaddr *>(&sin),
+		     &sinlen) == 0);
+  udp_server s;
+  int nconn = 0;
+  counting_listener rl(ps, std::move(ls), false, {&nconn});
+  rl.register_service(s);
+  assert(rl.set_uring(ring.get()));
+
+  std::vector<std::unique_ptr<rpc_sock>> socks;
+  for (int i = 0; i < 3; i++)
+    socks.emplace_back(new rpc_sock(ps, tcp_connect(
+      "127.0.0.1", to_string(ntohs(sin.sin_port)).c_str(),
+      AF_INET).release()));
+  call_and_hang_up(ps, s, nconn, socks);
+}
+
+void
+check_shm()
+{
+  pollset ps;
+  string path = "/tmp/xdrpp-test-arpc." + to_string(getpid());
+  udp_server s;
+  int nconn = 0;
+  counting_listener rl(ps, unix_listen(path.c_str()), false, {&nconn});
+  rl.register_service(s);
+  rl.set_shm(true);
+
+  std::vector<std::unique_ptr<rpc_sock>> socks;
+  for (int i = 0; i < 3; i++) {
+    unique_sock fd = unix_connect(path.c_str());
+    std::unique_ptr<shm_link> l = shm_link::connect(fd.get());
+    socks.emplace_back(new rpc_sock(ps, fd.release()));
+    assert(socks.back()->ms_->set_shm(std::move(l)));
+  }
+  unlink(path.c_str());
+  call_and_hang_up(ps, s, nconn, socks);
+}
+
+void
+check_loopback()
+{
+  pollset ps;
+  udp_server s;
+  arpc_server srv;
+  srv.register_service(s);
+  std::unique_ptr<rpc_loopback> lb(new rpc_loopback(ps, srv));
+  arpc_loopback_client<xdrtest2> c{*lb};
+
+  int nreplies = 0;
+  c.null2([&nreplies](call_result<void> r) {
+      assert(r);
+      ++nreplies;
+    });
+  c.nonnull2(u_4_12(12), [&nreplies](call_result<ContainsEnum> r) {
+      assert(r && r->num() == ContainsEnum::TWO);
+      ++nreplies;
+    });
+  c.three(true, 0, "loopback", [&nreplies](call_result<bigstr> r) {
+      assert(r && *r == "loopback");
+      ++nreplies;
+    });
+  // Calls go to the server at the end of the poll iteration.
+  assert(s.ncalls_ == 0);
+  while (nreplies < 3)
+    ps.poll();
+  assert(s.ncalls_ == 2 && s.nthree_ == 1);
+
+  // Calls never answered fail when the loopback goes away.
+  bool done = false;
+  c.three(true, 100, "never", [&done](call_result<bigstr> r) {
+      assert(!r && r.stat_.type_ == rpc_call_stat::NETWORK_ERROR);
+      done = true;
+    });
+  while (s.lost_.empty())
+    ps.poll();
+  lb.reset();
+  assert(done);
+  s.lost_.clear();
+}
+
+// Replies at once to calls named "early", but keeps other calls'
+// arguments, which borrow from the call message, until flush.
+class view_server {
+public:
+  using rpc_interface_type = view_v1;
+  view_rec kept_;
+  xdr::reply_cb<bigstr> cb_;
+
+  void echo_name(const view_rec &arg, xdr::reply_cb<bigstr> cb) {
+    if (arg.name.str() == "early")
+      return cb(arg.name.str());
+    kept_ = arg;
+    cb_ = cb;
+  }
+  void flush() {
+    string s = kept_.name.str();
+    for (uint8_t b : kept_.blob)
+      s += char('0' + b);
+    cb_(s);
+    cb_ = xdr::reply_cb<bigstr>();
+  }
+};
+
+void
+check_views()
+{
+  pollset ps;
+  view_server s;
+  arpc_server srv;
+  srv.register_service(s);
+  rpc_loopback lb(ps, srv);
+  arpc_loopback_client<view_v1> c{lb};
+
+  string later = "later", early = "early", res1, res2;
+  opaque_vec<> blob1 {1, 2, 3}, blob2 {7, 7, 7};
+  view_rec v;
+  v.name = later;
+  v.blob = blob1;
+  c.echo_name(v, [&res1](call_result<bigstr> r) { res1 = *r; });
+  while (!s.cb_.impl_)
+    ps.poll();
+
+  // A second call of the same size, which may reuse the first call's
+  // buffer if that were released before the reply.
+  v.name = early;
+  v.blob = blob2;
+  c.echo_name(v, [&res2](call_result<bigstr> r) { res2 = *r; });
+  while (res2.empty())
+    ps.poll();
+  assert(res2 == "early");
+
+  s.flush();
+  while (res1.empty())
+    ps.poll();
+  assert(res1 == "later123");
+}
+
+void
+check_direct()
+{
+  pollset ps;
+  udp_server s;
+  arpc_direct_client<udp_server> c{ps, s};
+
+  int nreplies = 0;
+  c.null2([&nreplies](call_result<void> r) {
+      assert(r);
+      ++nreplies;
+    });
+  c.nonnull2(u_4_12(12), [&nreplies](call_result<ContainsEnum> r) {
+      assert(r && r->num() == ContainsEnum::TWO);
+      ++nreplies;
+    });
+  bigstr arg = "direct";
+  c.three(true, 0, arg, [&nreplies](call_result<bigstr> r) {
+      assert(r && *r == "direct");
+      ++nreplies;
+    });
+  // The arguments were copied.
+  arg = "changed";
+  assert(s.ncalls_ == 0);
+  while (nreplies < 3)
+    ps.poll();
+  assert(s.ncalls_ == 2 && s.nthree_ == 1);
+
+  // Dropping the reply_cb without replying is an error.
+  bool done = false;
+  c.three(true, 100, "never", [&done](call_result<bigstr> r) {
+      assert(!r && r.stat_.type_ == rpc_call_stat::ACCEPT_STAT
+	     && r.stat_.accept_ == PROC_UNAVAIL);
+      done = true;
+    });
+  while (s.lost_.empty())
+    ps.poll();
+  assert(!done);
+  s.lost_.clear();
+  assert(done);
+}
+
+// Thread-safe, and notes which threads it is called on.
+class mt_server {
+  std::mutex mu_;
+  void called() {
+    ++ncalls_;
+    std::lock_guard<std::mutex> lk(mu_);
+    threads_.insert(this_thread::get_id());
+  }
+public:
+  using rpc_interface_type = xdrtest2;
+  std::atomic<int> ncalls_ {0};
+  std::set<std::thread::id> threads_;
+
+  void null2(xdr::reply_cb<void> cb) { called(); cb(); }
+  void nonnull2(const u_4_12 &arg, xdr::reply_cb<ContainsEnum> cb) {
+    called();
+    ContainsEnum c(::REDDER);
+    c.num() = ContainsEnum::TWO;
+    cb(c);
+  }
+  void ut(const uniontest &arg, xdr::reply_cb<void> cb) { cb(); }
+  void three(const bool &arg1, const int &n,
+	     const bigstr &arg3, xdr::reply_cb<bigstr> cb) {
+    called();
+    cb(arg3);
+  }
+};
+
+struct atomic_counting_allocator {
+  std::atomic<int> *nconn_;
+  void *allocate(rpc_sock *) { ++*nconn_; return nullptr; }
+  void deallocate(void *) { --*nconn_; }
+};
+
+void
+check_multi()
+{
+  mt_server s;
+  std::atomic<int> nconn {0};
+  arpc_tcp_multi_listener<void, atomic_counting_allocator>
+    ml(4, nullptr, AF_INET, pollset::Epoll, {&nconn});
+  assert(ml.size() == 4);
+  ml.register_service(s);
+  ml.start(true);
+
+  {
+    std::vector<unique_sock> fds;
+    for (int i = 0; i < 32; i++) {
+      fds.push_back(tcp_connect("127.0.0.1", ml.port().c_str(), AF_INET));
+      srpc_client<xdrtest2> c{fds.back().get()};
+      c.null2();
+      assert(c.nonnull2(u_4_12(12))->num() == ContainsEnum::TWO);
+      assert(*c.three(true, 0, "multi") == "multi");
+    }
+  }
+  while (nconn)
+    this_thread::yield();
+  ml.stop();
+  assert(s.ncalls_ == 96);
+  // The kernel spread the connections over more than one thread.
+  assert(s.threads_.size() > 1);
+}
+
 void
 check_rpc_success_header()
 {
@@ -46,6 +451,13 @@ int
 main(int argc, char **argv)
 {
   check_rpc_success_header();
+  check_udp();
+  check_uring();
+  check_shm();
+  check_loopback();
+  check_views();
+  check_direct();
+  check_multi();
 
   if (argc > 1 && !strcmp(argv[1], "-s")) {
     arpc_tcp_listener<> rl(ps);
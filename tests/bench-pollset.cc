@@ -0,0 +1,95 @@
+// Measure the cost of a poll round as the number of idle file
+// descriptors grows.  One socket pair ping-pongs a byte while the
+// others are registered for reading but never become ready.
+//
+//   usage: bench-pollset [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <xdrpp/pollset.h>
+
+using namespace std;
+using namespace xdr;
+
+static size_t
+fd_budget()
+{
+  rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+    return 1024;
+  if (rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+  }
+  return rl.rlim_cur;
+}
+
+static double
+bench(pollset::backend_t b, size_t nidle, int iterations)
+{
+  pollset ps(b);
+  vector<int> fds;
+  auto pair = [&fds](int out[2]) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, out) == -1) {
+      perror("socketpair");
+      exit(1);
+    }
+    fds.push_back(out[0]);
+    fds.push_back(out[1]);
+  };
+
+  for (size_t i = 0; i < nidle; i++) {
+    int p[2];
+    pair(p);
+    ps.fd_cb(sock_t(p[0]), pollset::Read, []() { abort(); });
+  }
+
+  int active[2];
+  pair(active);
+  int count = 0;
+  ps.fd_cb(sock_t(active[0]), pollset::Read, [&]() {
+      char c;
+      if (read(active[0], &c, 1) == 1)
+	++count;
+      if (count < iterations)
+	write(active[1], &c, 1);
+    });
+
+  write(active[1], "x", 1);
+  ps.poll();			// Warm up and apply registrations
+  auto start = chrono::steady_clock::now();
+  while (count < iterations)
+    ps.poll();
+  auto end = chrono::steady_clock::now();
+
+  for (size_t i = 0; i < fds.size(); i += 2)
+    ps.fd_cb(sock_t(fds[i]), pollset::Read);
+  for (int fd : fds)
+    close(fd);
+  return chrono::duration<double, micro>(end - start).count() / iterations;
+}
+
+int
+main(int argc, char **argv)
+{
+  int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+  size_t budget = fd_budget();
+
+  printf("%10s %14s %14s\n", "idle fds", "poll (us)", "epoll (us)");
+  for (size_t nidle : {0, 10, 100, 1000, 10000, 50000}) {
+    if (2 * nidle + 64 > budget) {
+      printf("%10zu   (exceeds RLIMIT_NOFILE of %zu)\n", nidle, budget);
+      break;
+    }
+    double p = bench(pollset::Poll, nidle, iterations);
+    double e = bench(pollset::Epoll, nidle, iterations);
+    printf("%10zu %14.3f %14.3f\n", nidle, p, e);
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <xdrpp/marshal.h>
+#include "tests/xdrtest.hh"
+
+using namespace std;
+using namespace xdr;
+
+// Containers of numeric types are marshaled as a single run, while
+// containers of single-field structs go through the per-element path
+// but produce identical bytes.  Compare the two.
+
+template<typename Run, typename Elem, typename Field> void
+check_same(const Run &run, Elem Field::*field)
+{
+  xvector<Field> boxed;
+  for (auto v : run) {
+    boxed.emplace_back();
+    boxed.back().*field = v;
+  }
+  msg_ptr m1 = xdr_to_msg(run);
+  msg_ptr m2 = xdr_to_msg(boxed);
+  assert(m1->size() == m2->size());
+  assert(!memcmp(m1->data(), m2->data(), m1->size()));
+
+  Run run2;
+  xdr_from_msg(m2, run2);
+  assert(run == run2);
+}
+
+void
+test_bulk()
+{
+  for (uint32_t n : {0, 1, 3, 4, 7, 8, 9, 17, 64, 1001}) {
+    xvector<int32_t> vi;
+    xvector<double> vd;
+    for (uint32_t i = 0; i < n; i++) {
+      vi.push_back(int32_t(0x01020304 * (i + 1)));
+      vd.push_back(3.141592654 * i - 17);
+    }
+    check_same(vi, &fix_4::i);
+    check_same(vd, &fix_8::d);
+  }
+
+  {
+    xarray<int64_t, 5> a, b;
+    for (int i = 0; i < 5; i++)
+      a[i] = INT64_C(0x0102030405060708) * i;
+    msg_ptr m = xdr_to_msg(a);
+    assert(m->size() == 40);
+    assert(m->data()[15] == 0x08);
+    xdr_from_msg(m, b);
+    assert(a == b);
+  }
+
+  {
+    xvector<color> c1 { RED, REDDEST, REDDER }, c2;
+    xdr_from_msg(xdr_to_msg(c1), c2);
+    assert(c1 == c2);
+  }
+
+  {
+    // Truncated message
+    xvector<uint32_t> v { 1, 2, 3, 4 }, v2;
+    msg_ptr m = xdr_to_msg(v);
+    m->shrink(m->size() - 4);
+    bool ok = false;
+    try { xdr_from_msg(m, v2); }
+    catch (const xdr_overflow &) { ok = true; }
+    assert(ok);
+
+    // Count bigger than the maximum size of the vector
+    xvector<uint32_t, 3> v3;
+    m = xdr_to_msg(v);
+    ok = false;
+    try { xdr_from_msg(m, v3); }
+    catch (const xdr_overflow &) { ok = true; }
+    assert(ok);
+  }
+}
+
+template<typename T> double
+time_roundtrip(const T &t, int iterations)
+{
+  using namespace std::chrono;
+  T t2;
+  auto start = steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+    xdr_from_msg(xdr_to_msg(t), t2);
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+void
+bench()
+{
+  constexpr int n = 100000, iterations = 200;
+  xvector<uint32_t> vi;
+  xvector<fix_4> vfi;
+  xvector<double> vd;
+  xvector<fix_8> vfd;
+  for (int i = 0; i < n; i++) {
+    vi.push_back(i);
+    vfi.emplace_back(i);
+    vd.push_back(i * 0.5);
+    vfd.emplace_back(i * 0.5);
+  }
+  cout << "round trip of " << n << " elements, " << iterations
+       << " iterations" << endl
+       << "  uint32 run:        " << time_roundtrip(vi, iterations) << "s\n"
+       << "  uint32 per-element: " << time_roundtrip(vfi, iterations) << "s\n"
+       << "  double run:        " << time_roundtrip(vd, iterations) << "s\n"
+       << "  double per-element: " << time_roundtrip(vfd, iterations) << "s\n";
+}
+
+int
+main(int argc, char **argv)
+{
+  test_bulk();
+  if (argc > 1 && !strcmp(argv[1], "-b"))
+    bench();
+  return 0;
+}
@@ -2,6 +2,7 @@
 #include <cassert>
 #include <iostream>
 #include <sstream>
+#include <xdrpp/arena.h>
 #include <xdrpp/printer.h>
 #include <cereal/archives/binary.hpp>
 #include <cereal/archives/json.hpp>
@@ -78,5 +79,27 @@ main()
     assert(obuf2.str().find("\"bort\": 9999") != string::npos);
   }
 
+  {
+    // Types generated with xdrc -arena are still archived as bytes.
+    static_assert(xdr::detail::bytes_superclass<
+		  xdr::arena_opaque_vec<>>::is_bytes, "arena opaque");
+    static_assert(xdr::detail::bytes_superclass<
+		  xdr::arena_xstring<>>::is_bytes, "arena string");
+    xdr::arena_xstring<> s1("arena"), s2;
+    xdr::arena_opaque_vec<> v1{1, 2, 3}, v2;
+    ostringstream obuf2;
+    {
+      cereal::BinaryOutputArchive archive(obuf2);
+      archive(s1, v1);
+    }
+    istringstream ibuf(obuf2.str());
+    {
+      cereal::BinaryInputArchive archive(ibuf);
+      archive(s2, v2);
+    }
+    assert(s2 == s1);
+    assert(v2 == v1);
+  }
+
   return 0;
 }
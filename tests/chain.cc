@@ -0,0 +1,128 @@
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <sys/socket.h>
+#include <xdrpp/marshal.h>
+#include <xdrpp/msgsock.h>
+#include "tests/xdrtest.hh"
+
+using namespace std;
+using namespace xdr;
+
+template<typename...Args> msg_chain
+to_chain(size_t chunk_size, const Args &...args)
+{
+  msg_chain c(chunk_size);
+  xdr_chain_put p(c);
+  xdr_argpack_archive(p, args...);
+  p.done();
+  return c;
+}
+
+// Gather the raw bytes described by iov, a few iovecs at a time.
+static string
+gather(const msg_chain &c, size_t skip = 0)
+{
+  string s;
+  iovec v[3];
+  for (size_t n; (n = c.iov(v, 3, skip + s.size())) > 0;)
+    for (size_t i = 0; i < n; i++)
+      s.append(static_cast<char *>(v[i].iov_base), v[i].iov_len);
+  return s;
+}
+
+template<typename...Args> void
+check_same(const Args &...args)
+{
+  msg_ptr m = xdr_to_msg(args...);
+  string raw(m->raw_data(), m->raw_size());
+  for (size_t chunk : { size_t(4), size_t(12), size_t(64),
+	  msg_chain::default_chunk_size }) {
+    msg_chain c = to_chain(chunk, args...);
+    assert(c.size() == m->size());
+    msg_ptr f = c.flatten();
+    assert(f->raw_size() == m->raw_size());
+    assert(!memcmp(f->raw_data(), m->raw_data(), m->raw_size()));
+    assert(gather(c) == raw);
+    if (raw.size() > 7)
+      assert(gather(c, 7) == raw.substr(7));
+  }
+}
+
+void
+test_encoding()
+{
+  test_recursive r;
+  r.elem = "a";
+  r.next.activate().elem = "bc";
+  r.next->next.activate().elem = "def";
+  r.nextvec.resize(20);
+  r.nextvec[5].elem = string(100, 'x');
+  check_same(r);
+
+  testns::containertest ct;
+  ct.uvec.resize(50);
+  for (auto &u : ct.uvec)
+    u.which(12).f12().d = 1.5;
+  ct.sarr[1] = "string";
+  check_same(ct, int(5), xvector<int>(1000, 7));
+
+  check_same(xdr_void{});
+
+  msg_chain c = xdr_to_chain(ct);
+  assert(c.size() == xdr_size(ct));
+}
+
+void
+test_send()
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+
+  test_recursive r;
+  r.nextvec.resize(2000);
+  r.nextvec[1999].elem = "last";
+
+  thread t([&r](sock_t s) {
+      pollset ps;
+      msg_sock ms(ps, s);
+      ms.putmsg(xdr_to_msg(int(1)));
+      ms.putmsg(to_chain(64, r));
+      ms.putmsg(to_chain(64, int(2)));
+      while (ms.wsize() && ps.pending())
+	ps.poll();
+    }, sock_t(fds[0]));
+
+  pollset ps;
+  int n = 0;
+  msg_sock ms(ps, sock_t(fds[1]), [&n,&r](msg_ptr m) {
+      assert(m);
+      if (n == 1) {
+	test_recursive r2;
+	xdr_from_msg(m, r2);
+	assert(r2 == r);
+      }
+      else {
+	int i;
+	xdr_from_msg(m, i);
+	assert(i == (n ? 2 : 1));
+      }
+      n++;
+    });
+  while (n < 3)
+    ps.poll();
+  t.join();
+}
+
+int
+main()
+{
+  test_encoding();
+  test_send();
+  return 0;
+}
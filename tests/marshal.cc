@@ -1,6 +1,7 @@
 
 #include <cassert>
 #include <iostream>
+#include <thread>
 #include <xdrpp/clear.h>
 #include <xdrpp/marshal.h>
 #include <xdrpp/printer.h>
@@ -70,6 +71,150 @@ test_size()
   CHECK_SIZE(tv, 32);
 }
 
+void
+test_fixed()
+{
+  // Fixed-size structures are bounds-checked once as a whole
+  fix_12 f1(7, 2.5), f2;
+  xdr::msg_ptr m = xdr::xdr_to_msg(f1);
+  xdr::xdr_from_msg(m, f2);
+  assert(f1 == f2);
+
+  m->shrink(8);
+  bool ok = false;
+  try { xdr::xdr_from_msg(m, f2); }
+  catch (const xdr::xdr_overflow &) { ok = true; }
+  assert(ok);
+
+  char buf[8];
+  ok = false;
+  try {
+    xdr::xdr_put p(buf, buf + sizeof(buf));
+    p(f1);
+  }
+  catch (const xdr::xdr_overflow &) { ok = true; }
+  assert(ok);
+
+  // Padding is still checked for fixed-size opaque
+  xdr::opaque_array<5> o;
+  m = xdr::xdr_to_msg(o);
+  m->data()[7] = 1;
+  ok = false;
+  try { xdr::xdr_from_msg(m, o); }
+  catch (const xdr::xdr_should_be_zero &) { ok = true; }
+  assert(ok);
+}
+
+void
+test_presize()
+{
+  using xdr::detail::min_size;
+  static_assert(min_size<fix_12>::value == 12, "fixed-size struct");
+  static_assert(min_size<xdr::xstring<>>::value == 4, "string");
+  static_assert(min_size<u_4_12>::value == 4, "union");
+  static_assert(min_size<test_recursive>::value == 12, "recursive struct");
+  static_assert(min_size<xdr::xarray<xdr::xstring<>, 3>>::value == 12,
+		"array of strings");
+
+  xdr::xvector<xdr::xstring<>> v1(100, "x"), v2;
+  xdr::xdr_from_msg(xdr::xdr_to_msg(v1), v2);
+  assert(v1 == v2);
+  assert(v2.capacity() == 100);
+
+  // A count that cannot fit in the message is rejected before
+  // anything is allocated for it.
+  xdr::msg_ptr m = xdr::xdr_to_msg(v1);
+  m->data()[0] = 0x10;
+  bool ok = false;
+  try { xdr::xdr_from_msg(m, v2); }
+  catch (const xdr::xdr_overflow &) { ok = true; }
+  assert(ok);
+  assert(v2.capacity() == 100);
+
+  v12 v3(3), v4;
+  m = xdr::xdr_to_msg(v3);
+  m->shrink(m->size() - 4);
+  ok = false;
+  try { xdr::xdr_from_msg(m, v4); }
+  catch (const xdr::xdr_overflow &) { ok = true; }
+  assert(ok && v4.capacity() == 0);
+}
+
+void
+test_bytes()
+{
+  xdr::xstring<> s1("hello"), s2("previous contents");
+  xdr::xdr_from_msg(xdr::xdr_to_msg(s1), s2);
+  assert(s1 == s2);
+
+  xdr::xstring<3> s3;
+  bool ok = false;
+  try { xdr::xdr_from_msg(xdr::xdr_to_msg(s1), s3); }
+  catch (const xdr::xdr_overflow &) { ok = true; }
+  assert(ok);
+
+  // Elements that can be built without clearing them are still
+  // completely overwritten.
+  xdr::xvector<xdr::opaque_array<5>> o1(3), o2;
+  for (int i = 0; i < 3; i++)
+    o1[i].fill(uint8_t(i + 1));
+  xdr::msg_ptr m = xdr::xdr_to_msg(o1);
+  xdr::xdr_from_msg(m, o2);
+  assert(o1 == o2);
+
+  xdr::xvector<xdr::xarray<int, 3>> a1(4), a2;
+  a1[3][2] = 9;
+  xdr::xdr_from_msg(xdr::xdr_to_msg(a1), a2);
+  assert(a1 == a2);
+
+  m->data()[4 + 8 + 6] = 1;	// padding of o1[1]
+  xdr::xvector<xdr::opaque_array<5>> o3;
+  ok = false;
+  try { xdr::xdr_from_msg(m, o3); }
+  catch (const xdr::xdr_should_be_zero &) { ok = true; }
+  assert(ok && o3.size() == 2 && o3[1] == o1[1]);
+}
+
+void
+test_pool()
+{
+  using xdr::message_t;
+  message_t::pool_trim();
+  xdr::message_pool_stats st0 = message_t::pool_stats();
+  assert(st0.thread_bytes == 0 && st0.shared_bytes == 0);
+
+  message_t::alloc(24).reset();
+  xdr::message_pool_stats st = message_t::pool_stats();
+  assert(st.allocs == st0.allocs + 1 && st.hits == st0.hits);
+  assert(st.thread_bytes > 0);
+  xdr::msg_ptr m = message_t::alloc(20);
+  st0 = st;
+  st = message_t::pool_stats();
+  assert(st.allocs == st0.allocs + 1 && st.hits == st0.hits + 1);
+  assert(st.thread_bytes == 0);
+  m.reset();
+
+  // Too big to pool
+  message_t::alloc(0x100000).reset();
+  assert(message_t::pool_stats().allocs == st.allocs);
+
+  // Buffers freed by another thread end up in the shared pool.
+  vector<xdr::msg_ptr> v;
+  for (int i = 0; i < 1000; i++)
+    v.push_back(message_t::alloc(1000));
+  thread([&v]() { v.clear(); }).join();
+  st0 = message_t::pool_stats();
+  assert(st0.shared_bytes >= 1000 * 1000);
+  m = message_t::alloc(1000);
+  st = message_t::pool_stats();
+  assert(st.hits == st0.hits + 1 && st.shared_bytes < st0.shared_bytes);
+  m.reset();
+
+  message_t::pool_trim();
+  st = message_t::pool_stats();
+  assert(st.thread_bytes == 0 && st.shared_bytes == 0);
+}
+
 void
 udsb(uint32_t, double, xdr::xstring<> &, bool, std::nullptr_t)
 {
@@ -115,6 +260,10 @@ int
 main()
 {
   test_size();
+  test_fixed();
+  test_presize();
+  test_bytes();
+  test_pool();
   test_tuple();
 
   testns::bytes b1, b2;
@@ -4,19 +4,23 @@
 #include <iostream>
 #include <sstream>
 #include <thread>
+#include <unistd.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <xdrpp/msgsock.h>
 #include <xdrpp/printer.h>
+#include <xdrpp/srpc.h>
 
 using namespace std;
 using namespace xdr;
 
 void
-echoserver(sock_t s)
+echoserver(sock_t s, size_t rbufsize, pollset::backend_t pb)
 {
-  pollset_plus ps;
+  pollset_plus ps(pb);
   bool done {false};
   msg_sock ss(ps, s, nullptr);
+  ss.set_rbufsize(rbufsize);
   int i = 0;
 
   ss.setrcb([&done,&ss,&i](msg_ptr b) {
@@ -34,10 +38,11 @@ echoserver(sock_t s)
 }
 
 void
-echoclient(sock_t s)
+echoclient(sock_t s, size_t rbufsize, pollset::backend_t pb)
 {
-  pollset_plus ps;
+  pollset_plus ps(pb);
   msg_sock ss { ps, s };
+  ss.set_rbufsize(rbufsize);
   unsigned int i = 0;
 
   {
@@ -61,8 +66,8 @@ echoclient(sock_t s)
     ps.poll();
 }
 
-int
-main(int argc, char **argv)
+void
+echo(size_t rbufsize, pollset::backend_t pb = pollset::Poll)
 {
   int fds[2];
   if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
@@ -70,9 +75,546 @@ main(int argc, char **argv)
     exit(1);
   }
 
-  thread t1 (echoclient, sock_t(fds[0]));
-  echoserver(sock_t(fds[1]));
+  thread t1 (echoclient, sock_t(fds[0]), rbufsize, pb);
+  echoserver(sock_t(fds[1]), rbufsize, pb);
   t1.join();
+}
+
+// Many messages sent back to back, some bigger than the receive
+// buffer, arrive intact and in order.
+void
+burst(size_t rbufsize)
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+
+  auto len = [](unsigned i) -> size_t {
+    return i % 100 == 50 ? 10000 + i : i % 13 * 4;
+  };
+  constexpr unsigned n = 1000;
+
+  thread t([&len](sock_t s) {
+      pollset ps;
+      msg_sock ms(ps, s);
+      for (unsigned i = 0; i < n; i++) {
+	msg_ptr b = message_t::alloc(len(i));
+	memset(b->data(), i, b->size());
+	ms.putmsg(b);
+      }
+      while (ms.wsize() && ps.pending())
+	ps.poll();
+    }, sock_t(fds[0]));
+
+  pollset ps;
+  unsigned i = 0;
+  bool eof = false;
+  msg_sock ms(ps, sock_t(fds[1]), [&](msg_ptr b) {
+      if (!b) {
+	eof = true;
+	return;
+      }
+      assert(b->size() == len(i));
+      for (size_t j = 0; j < b->size(); j++)
+	assert(uint8_t(b->data()[j]) == uint8_t(i));
+      i++;
+    });
+  ms.set_rbufsize(rbufsize);
+  while (!eof)
+    ps.poll();
+  assert(i == n);
+  t.join();
+}
+
+// An empty fragment, then the two halves of an int.
+static const char fragmented_seven[] = {
+  0, 0, 0, 0,  0, 0, 0, 2,  0, 0,  char(0x80), 0, 0, 2,  0, 7
+};
+
+// Records split into fragments, by msg_sock or by hand, arrive
+// whole.
+void
+fragments(size_t rbufsize)
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+
+  xvector<int> v;
+  for (int i = 0; i < 100; i++)
+    v.push_back(i);
+
+  thread t([&v](sock_t s) {
+      pollset ps;
+      msg_sock ms(ps, s);
+      ms.set_fragsize(12);
+      ms.putmsg(xdr_to_msg(v));
+      msg_chain c(16);
+      xdr_chain_put p(c);
+      xdr_argpack_archive(p, v);
+      p.done();
+      ms.putmsg(std::move(c));
+      ms.putmsg(xdr_to_msg(int(5), int(6)));
+      ms.putmsg(message_t::alloc(0));
+      while (ms.wsize() && ps.pending())
+	ps.poll();
+      assert(send(s.fd_, fragmented_seven, sizeof fragmented_seven, 0)
+	     == sizeof fragmented_seven);
+    }, sock_t(fds[0]));
+
+  pollset ps;
+  int n = 0;
+  msg_sock ms(ps, sock_t(fds[1]), [&](msg_ptr b) {
+      assert(b);
+      xvector<int> v2;
+      int i = 0, j = 0;
+      switch (n++) {
+      case 0:
+      case 1:
+	xdr_from_msg(b, v2);
+	assert(v2 == v);
+	break;
+      case 2:
+	xdr_from_msg(b, i, j);
+	assert(i == 5 && j == 6);
+	break;
+      case 3:
+	assert(b->size() == 0);
+	break;
+      case 4:
+	xdr_from_msg(b, i);
+	assert(i == 7);
+	break;
+      }
+    });
+  ms.set_rbufsize(rbufsize);
+  while (n < 5)
+    ps.poll();
+  t.join();
+}
+
+// The synchronous interface reads fragments, too.
+void
+read_fragments()
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+  assert(write(fds[0], fragmented_seven, sizeof fragmented_seven)
+	 == sizeof fragmented_seven);
+  int i = 0;
+  xdr_from_msg(read_message(sock_t(fds[1])), i);
+  assert(i == 7);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// A record may not have an unbounded number of (empty) fragments.
+void
+fragment_limit(bool sync)
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+  thread t([](int fd) {
+      string junk((max_record_fragments + 1) * 4, '\0');
+      send(fd, junk.data(), junk.size(), MSG_NOSIGNAL);
+      close(fd);
+    }, fds[0]);
+
+  if (sync) {
+    bool threw = false;
+    try { read_message(sock_t(fds[1])); }
+    catch (const xdr_bad_message_size &) { threw = true; }
+    assert(threw);
+    close(fds[1]);
+  }
+  else {
+    pollset ps;
+    bool failed = false;
+    msg_sock ms(ps, sock_t(fds[1]), [&failed](msg_ptr b) {
+	assert(!b && errno == E2BIG);
+	failed = true;
+      });
+    while (!failed)
+      ps.poll();
+  }
+  t.join();
+}
+
+// A corked socket writes messages queued together with one writev.
+void
+cork(bool corked)
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+  constexpr unsigned n = 100;
+
+  pollset ps;
+  msg_sock ws(ps, sock_t(fds[0]));
+  ws.set_cork(corked);
+  for (unsigned i = 0; i < n; i++)
+    ws.putmsg(xdr_to_msg(i));
+  while (ws.wsize())
+    ps.poll();
+  const msg_sock::wstats &st = ws.get_wstats();
+  assert(st.msgs == n);
+  assert(st.bytes == n * 8);
+  assert(st.writes == (corked ? 1 : n));
+
+  unsigned i = 0;
+  msg_sock rs(ps, sock_t(fds[1]), [&i](msg_ptr b) {
+      unsigned j;
+      xdr_from_msg(b, j);
+      assert(j == i++);
+    });
+  while (i < n)
+    ps.poll();
+}
+
+// Watermark callbacks fire as the output queue fills and drains, and
+// a receiver can pause and resume input.
+void
+flow_control(size_t rbufsize)
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+  constexpr unsigned n = 1000;
 
+  pollset ps;
+  msg_sock ws(ps, sock_t(fds[0]));
+  vector<bool> events;
+  ws.set_watermarks(1000, 100000, [&events](bool blocked) {
+      events.push_back(blocked);
+    });
+  for (unsigned i = 0; i < n; i++) {
+    msg_ptr b = message_t::alloc(1000);
+    memset(b->data(), i, b->size());
+    ws.putmsg(b);
+  }
+  assert(events == vector<bool>{ true });
+
+  unsigned i = 0;
+  msg_sock *rsp;
+  msg_sock rs(ps, sock_t(fds[1]), [&i,&rsp](msg_ptr b) {
+      assert(b && b->size() == 1000 && uint8_t(b->data()[0]) == uint8_t(i));
+      if (++i == 5)
+	rsp->pause_input();
+    });
+  rsp = &rs;
+  rs.set_rbufsize(rbufsize);
+  while (i < 5)
+    ps.poll();
+  for (int j = 0; j < 3; j++)
+    ps.poll(10);
+  assert(i == 5);
+  rs.resume_input();
+  while (i < n)
+    ps.poll();
+  assert(!ws.wsize());
+  assert(events == (vector<bool>{ true, false }));
+}
+
+// Exceeding the hard limit on queued output drops the connection.
+void
+wmax()
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+
+  pollset ps;
+  bool eof = false;
+  msg_sock ws(ps, sock_t(fds[0]), [&eof](msg_ptr b) {
+      assert(!b);
+      eof = true;
+    });
+  ws.set_wmax(100000);
+  // Far more than the socket buffer holds
+  for (unsigned i = 0; i < 10000; i++)
+    ws.putmsg(message_t::alloc(1000));
+  assert(!ws.wsize());
+  while (!eof)
+    ps.poll();
+  close(fds[1]);
+}
+
+// Large messages written with MSG_ZEROCOPY arrive intact.
+void
+zerocopy()
+{
+  unique_sock l = tcp_listen(nullptr, AF_INET);
+  sockaddr_in sin;
+  socklen_t sinlen = sizeof sin;
+  assert(getsockname(l.get().fd_, reinterpret_cast<sockaddr *>(&sin),
+		     &sinlen) == 0);
+  unique_sock c = tcp_connect("127.0.0.1",
+			      to_string(ntohs(sin.sin_port)).c_str(), AF_INET);
+  sock_t a = accept(l.get().fd_, nullptr, nullptr);
+  assert(a != invalid_sock);
+
+  pollset ps;
+  // A read callback lets the writer notice completions.
+  msg_sock ws(ps, c.release(), [](msg_ptr) {});
+  if (!ws.set_zerocopy(0x10000)) {
+    cerr << "zero-copy writes not supported" << endl;
+    close(a);
+    return;
+  }
+
+  constexpr unsigned n = 8;
+  auto len = [](unsigned i) -> size_t {
+    return i % 2 ? 0x100000 + 4 * i : 100;
+  };
+  unsigned i = 0;
+  msg_sock rs(ps, a, [&i,&len](msg_ptr b) {
+      assert(b && b->size() == len(i));
+      for (size_t j = 0; j < b->size(); j += 997)
+	assert(uint8_t(b->data()[j]) == uint8_t(i));
+      i++;
+    }, 0x200000);
+  for (unsigned j = 0; j < n; j++) {
+    msg_ptr b = message_t::alloc(len(j));
+    memset(b->data(), j, b->size());
+    ws.putmsg(b);
+  }
+  while (i < n)
+    ps.poll();
+  assert(!ws.wsize());
+  assert(ws.get_wstats().zc_writes > 0);
+
+  // Fragment lengths and chain record marks are sent from their own
+  // buffers, which must stay put while the kernel holds them.
+  ws.set_fragsize(0x30000);
+  for (unsigned j = n; j < 2 * n; j++) {
+    if (j % 2) {
+      msg_chain c(0x10000);
+      uint32_t *p = nullptr, *e = nullptr;
+      for (size_t words = len(j) / 4; words;) {
+	c.grow(p, e, 4);
+	size_t k = min<size_t>(words, e - p);
+	memset(p, j, 4 * k);
+	p += k;
+	words -= k;
+      }
+      c.finish(p);
+      ws.putmsg(std::move(c));
+    }
+    else {
+      msg_ptr b = message_t::alloc(len(j));
+      memset(b->data(), j, b->size());
+      ws.putmsg(b);
+    }
+  }
+  while (i < 2 * n)
+    ps.poll();
+  assert(!ws.wsize());
+}
+
+void
+uring(size_t bufsize)
+{
+  pollset ps;
+  std::unique_ptr<io_ring> ring = io_ring::create(ps, 64, bufsize, 16);
+  if (!ring) {
+    cerr << "io_uring not supported; skipping" << endl;
+    return;
+  }
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+  constexpr unsigned n = 1000;
+  // Assorted sizes, some bigger than the ring's buffers
+  auto size = [](unsigned i) -> size_t {
+    return i % 100 == 50 ? 100000 + i : 4 * (i % 37);
+  };
+  auto check = [&size](const msg_ptr &b, unsigned i) {
+    assert(b && b->size() == size(i));
+    for (size_t k = 0; k < b->size(); k++)
+      assert(uint8_t(b->data()[k]) == uint8_t(i));
+  };
+
+  // Echo everything back through the ring.
+  unsigned i = 0;
+  bool eof = false;
+  msg_sock *usp;
+  msg_sock us(ps, sock_t(fds[0]), [&](msg_ptr b) {
+      if (!b) {
+	assert(errno == 0);
+	eof = true;
+	return;
+      }
+      check(b, i);
+      if (++i == 300)
+	usp->pause_input();
+      usp->putmsg(b);
+    });
+  usp = &us;
+  assert(us.set_uring(ring.get()));
+
+  unsigned j = 0;
+  msg_sock ws(ps, sock_t(fds[1]), [&](msg_ptr b) {
+      if (b)
+	check(b, j++);
+    });
+  ws.set_fragsize(5000);
+  for (unsigned k = 0; k < n; k++) {
+    msg_ptr b = message_t::alloc(size(k));
+    memset(b->data(), k, b->size());
+    ws.putmsg(b);
+  }
+
+  while (i < 300)
+    ps.poll();
+  for (int k = 0; k < 3; k++)
+    ps.poll(10);
+  assert(i == 300);
+  us.resume_input();
+  while (j < n)
+    ps.poll();
+  assert(i == n);
+  assert(!us.wsize());
+  // Many completions are handled per system call.
+  assert(ring->nenter() < ring->ncomplete());
+
+  shutdown(fds[1], SHUT_WR);
+  while (!eof)
+    ps.poll();
+}
+
+void
+shm()
+{
+  pollset ps;
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    perror("socketpair");
+    exit(1);
+  }
+  std::unique_ptr<shm_link> wl = shm_link::connect(sock_t(fds[1]),
+						   shm_link::min_ringsize);
+  std::unique_ptr<shm_link> ul = shm_link::accept(sock_t(fds[0]));
+  assert(wl && ul && ul->ringsize() == shm_link::min_ringsize);
+
+  constexpr unsigned n = 1000;
+  // Assorted sizes, some much bigger than the ring
+  auto size = [](unsigned i) -> size_t {
+    return i % 100 == 50 ? 100000 + i : 4 * (i % 37);
+  };
+  auto check = [&size](const msg_ptr &b, unsigned i) {
+    assert(b && b->size() == size(i));
+    for (size_t k = 0; k < b->size(); k++)
+      assert(uint8_t(b->data()[k]) == uint8_t(i));
+  };
+
+  // Echo everything back, pausing for a while part way through.
+  unsigned i = 0;
+  bool eof = false;
+  msg_sock *usp;
+  msg_sock us(ps, sock_t(fds[0]), [&](msg_ptr b) {
+      if (!b) {
+	assert(errno == 0);
+	eof = true;
+	return;
+      }
+      check(b, i);
+      if (++i == 300)
+	usp->pause_input();
+      usp->putmsg(b);
+    });
+  usp = &us;
+  assert(us.set_shm(std::move(ul)));
+
+  unsigned j = 0;
+  msg_sock ws(ps, sock_t(fds[1]), [&](msg_ptr b) {
+      if (b)
+	check(b, j++);
+    });
+  assert(ws.set_shm(std::move(wl)));
+  ws.set_fragsize(5000);
+  for (unsigned k = 0; k < n; k++) {
+    msg_ptr b = message_t::alloc(size(k));
+    memset(b->data(), k, b->size());
+    ws.putmsg(b);
+  }
+
+  while (i < 300)
+    ps.poll();
+  for (int k = 0; k < 3; k++)
+    ps.poll(10);
+  assert(i == 300);
+  us.resume_input();
+  while (j < n)
+    ps.poll();
+  assert(i == n);
+  assert(!us.wsize() && !ws.wsize());
+  // Small messages are copied into the ring many at a time.
+  assert(ws.get_wstats().writes < n);
+
+  // Closing the socket is end of file, but only after the data
+  // already in the ring.
+  msg_ptr b = message_t::alloc(8);
+  memset(b->data(), 0, b->size());
+  i = 0;
+  us.pause_input();
+  ws.putmsg(b);
+  shutdown(fds[1], SHUT_WR);
+  for (int k = 0; k < 3; k++)
+    ps.poll(10);
+  assert(!eof);
+  us.setrcb([&](msg_ptr b) {
+      if (b)
+	++i;
+      else
+	eof = true;
+    });
+  us.resume_input();
+  while (!eof)
+    ps.poll();
+  assert(i == 1);
+}
+
+int
+main(int argc, char **argv)
+{
+  echo(0);
+  echo(64);
+  echo(64, pollset::Epoll);
+  burst(0);
+  burst(64);
+  burst(4096);
+  fragments(0);
+  fragments(8);
+  fragments(4096);
+  read_fragments();
+  fragment_limit(false);
+  fragment_limit(true);
+  cork(false);
+  cork(true);
+  flow_control(0);
+  flow_control(4096);
+  wmax();
+  zerocopy();
+  uring(io_ring::default_bufsize);
+  uring(64);
+  shm();
   return 0;
 }
@@ -0,0 +1,291 @@
+
+#include <cassert>
+#include <csignal>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <xdrpp/pollset.h>
+
+using namespace std;
+using namespace xdr;
+
+struct sockpair {
+  sock_t s[2];
+  sockpair() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+      perror("socketpair");
+      exit(1);
+    }
+    s[0] = fds[0];
+    s[1] = fds[1];
+    set_nonblock(s[0]);
+    set_nonblock(s[1]);
+  }
+  ~sockpair() {
+    if (s[0] != invalid_sock)
+      close(s[0].fd());
+    if (s[1] != invalid_sock)
+      close(s[1].fd());
+  }
+  sockpair(const sockpair &) = delete;
+  sockpair &operator=(const sockpair &) = delete;
+};
+
+void
+drain(sock_t s)
+{
+  char buf[64];
+  while (read(s.fd(), buf, sizeof buf) > 0)
+    ;
+}
+
+// Read, write, and one-shot callbacks run when, and only when, their
+// file descriptors are ready.
+void
+basic(pollset::backend_t b)
+{
+  pollset ps(b);
+  sockpair p;
+  int nread = 0, nwrite = 0, nonce = 0;
+
+  ps.fd_cb(p.s[0], pollset::Read, [&]() { ++nread; drain(p.s[0]); });
+  assert(ps.pending());
+  ps.poll(0);
+  assert(nread == 0);
+
+  write(p.s[1].fd(), "x", 1);
+  ps.poll(0);
+  assert(nread == 1);
+  ps.poll(0);
+  assert(nread == 1);
+
+  ps.fd_cb(p.s[0], pollset::Write, [&]() { ++nwrite; });
+  ps.poll(0);
+  assert(nread == 1 && nwrite == 1);
+  ps.fd_cb(p.s[0], pollset::Write);
+  ps.poll(0);
+  assert(nwrite == 1);
+
+  ps.fd_cb(p.s[1], pollset::WriteOnce, [&]() { ++nonce; });
+  ps.poll(0);
+  ps.poll(0);
+  assert(nonce == 1);
+
+  ps.fd_cb(p.s[0], pollset::ReadWrite);
+  write(p.s[1].fd(), "x", 1);
+  ps.poll(0);
+  assert(nread == 1);
+  assert(!ps.pending());
+
+  // Registering again after removal works.
+  ps.fd_cb(p.s[0], pollset::ReadOnce, [&]() { ++nread; });
+  ps.poll(0);
+  assert(nread == 2);
+  assert(!ps.pending());
+}
+
+// A callback may remove and close another descriptor that is also
+// ready in the same round, and may register new descriptors.
+void
+churn(pollset::backend_t b)
+{
+  pollset ps(b);
+  sockpair p1, p2;
+  vector<sockpair *> extra;
+  int n1 = 0, n2 = 0, nextra = 0;
+
+  write(p1.s[1].fd(), "x", 1);
+  write(p2.s[1].fd(), "x", 1);
+  auto cb = [&](int me) {
+    if (me == 1)
+      ++n1;
+    else
+      ++n2;
+    sockpair &other = me == 1 ? p2 : p1;
+    ps.fd_cb(other.s[0], pollset::Read);
+    close(other.s[0].fd());
+    other.s[0] = invalid_sock;
+    for (int i = 0; i < 64; i++) {
+      sockpair *sp = new sockpair;
+      extra.push_back(sp);
+      write(sp->s[1].fd(), "x", 1);
+      ps.fd_cb(sp->s[0], pollset::ReadOnce, [&nextra]() { ++nextra; });
+    }
+    // Captures must still be intact after registering new fds.
+    assert(me == 1 || me == 2);
+    sockpair &self = me == 1 ? p1 : p2;
+    ps.fd_cb(self.s[0], pollset::Read);
+  };
+  ps.fd_cb(p1.s[0], pollset::Read, [cb]() { cb(1); });
+  ps.fd_cb(p2.s[0], pollset::Read, [cb]() { cb(2); });
+  ps.poll(0);
+  assert(n1 + n2 == 1);
+  while (ps.pending())
+    ps.poll(0);
+  assert(nextra == 64);
+  for (sockpair *sp : extra)
+    delete sp;
+}
+
+// Only ready descriptors have their callbacks run, however many are
+// registered.
+void
+many(pollset::backend_t b)
+{
+  pollset ps(b);
+  constexpr int n = 200;
+  vector<sockpair> pairs(n);
+  vector<int> hits(n);
+  for (int i = 0; i < n; i++)
+    ps.fd_cb(pairs[i].s[0], pollset::Read, [&,i]() {
+	++hits[i];
+	drain(pairs[i].s[0]);
+      });
+
+  for (int i = 0; i < n; i += 7)
+    write(pairs[i].s[1].fd(), "x", 1);
+  ps.poll(0);
+  for (int i = 0; i < n; i++)
+    assert(hits[i] == (i % 7 == 0));
+
+  int fired = 0;
+  ps.timeout(0, [&fired]() { ++fired; });
+  ps.poll(1000);
+  assert(fired == 1);
+
+  for (int i = 0; i < n; i++)
+    ps.fd_cb(pairs[i].s[0], pollset::Read);
+  ps.poll(0);
+  assert(!ps.pending());
+}
+
+// Timeouts run in order (to within the resolution), never early, and
+// survive rescheduling.
+void
+timeouts(pollset::backend_t b, int64_t res)
+{
+  pollset ps(b);
+  ps.set_timeout_resolution(res);
+  int64_t start = pollset::now_ms();
+  vector<int64_t> ran;
+  auto arm = [&](int64_t at) {
+    return ps.timeout_at(at, [&ran,at,res]() {
+	assert(pollset::now_ms() >= at);
+	assert(ran.empty() || ran.back() < at + res);
+	ran.push_back(at);
+      });
+  };
+
+  unsigned seed = 1;
+  for (int i = 0; i < 500; i++) {
+    seed = seed * 1103515245 + 12345;
+    arm(start + (seed >> 16) % 250);
+  }
+  // Past due, far future, and beyond the outermost wheel level.
+  arm(start - 1000);
+  pollset::Timeout far = arm(start + 3600 * 1000);
+  pollset::Timeout huge = arm(start + (int64_t(1) << 40));
+  pollset::Timeout cancelled = arm(start + 10);
+  ps.timeout_cancel(cancelled);
+  assert(!cancelled);
+
+  int64_t moved_ran = 0;
+  pollset::Timeout moved = ps.timeout_at(start + 60 * 1000, [&moved_ran]() {
+      moved_ran = pollset::now_ms();
+    });
+  pollset::Timeout copy = moved;
+  ps.timeout_reschedule_at(moved, start + 120);
+  assert(ps.timeout_time(copy) == start + 120);
+  ps.timeout_reschedule_at(copy, start + 3600 * 1000 + 1);
+  ps.timeout_reschedule_at(copy, start + 5);
+
+  while (ran.size() < 501 || !moved_ran)
+    ps.poll();
+  assert(moved_ran >= start + 5);
+  assert(ps.pending());
+  assert(ps.timeout_time(far) == start + 3600 * 1000);
+  ps.poll(0);
+  assert(ran.size() == 501);
+  ps.timeout_cancel(far);
+  ps.timeout_cancel(huge);
+  assert(!ps.pending());
+
+  // A past-due timeout armed from a timeout callback runs right away.
+  int n = 0;
+  ps.timeout(0, [&]() { ps.timeout_at(start, [&n]() { ++n; }); ++n; });
+  ps.poll();
+  assert(n == 2);
+}
+
+void
+async(pollset::backend_t b)
+{
+  pollset_plus ps(b);
+  int n = 0;
+  ps.async([]() { return 7; }, [&n](int r) { n = r; });
+  while (!n)
+    ps.poll();
+  assert(n == 7);
+}
+
+// Callbacks injected from many threads all run, each thread's in
+// order, and signals still wake the pollset.
+void
+inject(pollset::backend_t b)
+{
+  pollset_plus ps(b);
+  constexpr int nthreads = 4, n = 10000;
+  vector<int> next(nthreads);
+  int total = 0;
+  vector<thread> producers;
+  for (int t = 0; t < nthreads; t++)
+    producers.emplace_back([&ps,&next,&total,t]() {
+	for (int i = 0; i < n; i++)
+	  ps.inject_cb([&next,&total,t,i]() {
+	      assert(next[t]++ == i);
+	      ++total;
+	    });
+      });
+  while (total < nthreads * n)
+    ps.poll();
+  for (thread &t : producers)
+    t.join();
+
+  bool got = false;
+  ps.signal_cb(SIGUSR1, [&got]() { got = true; });
+  raise(SIGUSR1);
+  while (!got)
+    ps.poll();
+  ps.signal_cb(SIGUSR1);
+}
+
+void
+run(pollset::backend_t b)
+{
+  basic(b);
+  churn(b);
+  many(b);
+  timeouts(b, 1);
+  timeouts(b, 7);
+  async(b);
+  inject(b);
+}
+
+int
+main()
+{
+  run(pollset::Poll);
+  {
+    pollset ps(pollset::Epoll);
+#ifdef __linux__
+    assert(ps.backend() == pollset::Epoll);
+#else
+    assert(ps.backend() == pollset::Poll);
+#endif
+  }
+  run(pollset::Epoll);
+  return 0;
+}
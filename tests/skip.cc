@@ -0,0 +1,276 @@
+
+#include <cassert>
+#include <iostream>
+#include <xdrpp/skip.h>
+#include "tests/xdrtest.hh"
+
+using namespace std;
+using namespace xdr;
+
+// Skipping over a well-formed value must consume exactly the bytes
+// the marshaling code produced.
+template<typename T> void
+check_walk(const T &t)
+{
+  msg_ptr m = xdr_to_msg(t);
+  xdr_skip s(m);
+  xdr_extent e;
+  assert(s.skip<T>(e));
+  assert(s.done());
+  assert(e.offset == 0 && e.size == xdr_size(t));
+  assert(xdr_check_msg<T>(m));
+}
+
+template<typename T> xdr_status
+status_of(const msg_ptr &m)
+{
+  xdr_status st = xdr_check_msg<T>(m);
+  // The exception-based decoder must agree on whether data is bad.
+  T t;
+  bool threw = false;
+  try { xdr_from_msg(m, t); }
+  catch (const xdr_runtime_error &) { threw = true; }
+  assert(threw == !st);
+  // And so must the non-throwing one, which leaves t alone on error.
+  T t2;
+  xdr_status st2 = xdr_try_from_msg(m, t2);
+  assert(st2.code == st.code && st2.offset == st.offset);
+  if (!st)
+    assert(t2 == T{});
+  return st;
+}
+
+void
+test_wellformed()
+{
+  testns::numerics n;
+  n.i3 = -5;
+  n.e1 = testns::REDDER;
+  check_walk(n);
+
+  testns::bytes b;
+  b.s = "hello";
+  b.variable = { 1, 2, 3 };
+  check_walk(b);
+
+  testns::hasbytes hb;
+  hb.the_bytes.resize(3);
+  hb.the_bytes[1].s = "x";
+  check_walk(hb);
+
+  test_recursive r;
+  r.elem = "a";
+  r.next.activate().elem = "bc";
+  r.next->next.activate().elem = "def";
+  r.nextvec.resize(2);
+  r.nextvec[1].nextvec.resize(1);
+  check_walk(r);
+
+  testns::containertest ct;
+  ct.uvec.resize(3);
+  ct.uvec[0].which(12).f12().d = 2.5;
+  ct.uvec[1].which(4).f4().i = 7;
+  ct.uvec[2].which(12);
+  ct.sarr[1] = "string";
+  check_walk(ct);
+
+  testns::uniontest ut;
+  ut.ip.activate() = 3;
+  ut.key.arbitrary(REDDEST).big() = { 9, 9, 9, 9, 9 };
+  check_walk(ut);
+
+  testns::unionvoidtest uv;
+  uv.arbitrary(REDDER);
+  check_walk(uv);
+
+  xvector<int> iv { 1, 2, 3, 4 };
+  check_walk(iv);
+  xarray<double, 3> da;
+  check_walk(da);
+  check_walk(std::make_tuple(1, xstring<>("x"), true));
+}
+
+void
+test_extents()
+{
+  testns::bytes b;
+  b.s = "hello";
+  b.variable = { 1, 2, 3 };
+  msg_ptr m = xdr_to_msg(b);
+
+  vector<xdr_extent> ev;
+  xdr_skip s(m);
+  assert(s.each_field<testns::bytes>([&ev](size_t i, const xdr_extent &e) {
+	assert(i == ev.size());
+	ev.push_back(e);
+      }));
+  assert(s.done());
+  assert(ev.size() == 3);
+  assert(ev[0].offset == 0 && ev[0].size == 12);
+  assert(ev[1].offset == 12 && ev[1].size == 16);
+  assert(ev[2].offset == 28 && ev[2].size == 8);
+
+  xdr_extent e = xdr_field_extent<testns::bytes>(m, 2);
+  assert(e.offset == 28 && e.size == 8);
+  bool ok = false;
+  try { xdr_field_extent<testns::bytes>(m, 3); }
+  catch (const std::out_of_range &) { ok = true; }
+  assert(ok);
+
+  xvector<xstring<>> sv { "a", "bcdef", "" };
+  m = xdr_to_msg(sv);
+  ev.clear();
+  xdr_skip s2(m);
+  assert(s2.each_element<xvector<xstring<>>>(
+	   [&ev](size_t, const xdr_extent &e) { ev.push_back(e); }));
+  assert(ev.size() == 3);
+  assert(ev[0].offset == 4 && ev[0].size == 8);
+  assert(ev[1].offset == 12 && ev[1].size == 12);
+  assert(ev[2].offset == 24 && ev[2].size == 4);
+}
+
+void
+test_malformed()
+{
+  testns::bytes b;
+  b.s = "hello";
+  b.variable = { 1, 2, 3 };
+
+  msg_ptr m = xdr_to_msg(b);
+  m->data()[4 + 5] = 1;		// padding after "hello"
+  xdr_status st = status_of<testns::bytes>(m);
+  assert(st.code == xdr_errc::should_be_zero);
+  assert(st.offset == 9);
+
+  m = xdr_to_msg(b);
+  m->data()[3] = 17;		// string longer than 16
+  st = status_of<testns::bytes>(m);
+  assert(st.code == xdr_errc::overflow && st.offset == 0);
+
+  m = xdr_to_msg(b);
+  m->shrink(m->size() - 4);
+  assert(status_of<testns::bytes>(m).code == xdr_errc::overflow);
+
+  m = xdr_to_msg(b, 0);
+  assert(status_of<testns::bytes>(m).code == xdr_errc::bad_message_size);
+
+  testns::uniontest ut;
+  m = xdr_to_msg(ut);
+  m->data()[7] = 99;		// key discriminant
+  st = status_of<testns::uniontest>(m);
+  assert(st.code == xdr_errc::bad_discriminant && st.offset == 4);
+  bool ok = false;
+  try { st.raise(); }
+  catch (const xdr_bad_discriminant &) { ok = true; }
+  assert(ok);
+
+  xvector<int> iv { 1, 2, 3 };
+  m = xdr_to_msg(iv);
+  m->data()[0] = 0x40;		// huge element count
+  assert(status_of<xvector<int>>(m).code == xdr_errc::overflow);
+
+  test_recursive r;
+  test_recursive *rp = &r;
+  for (int i = 0; i < 10; ++i)
+    rp = &rp->next.activate();
+  m = xdr_to_msg(r);
+  marshaling_stack_limit = 5;
+  assert(status_of<test_recursive>(m).code == xdr_errc::stack_overflow);
+  marshaling_stack_limit = 0xffffffff;
+  assert(status_of<test_recursive>(m));
+
+  // Depth is charged as xdr_get charges it: not for numeric vectors,
+  // nor for anything within a fixed-size value.
+  using pair12 = xarray<fix_12, 2>;
+  m = xdr_to_msg(iv);
+  msg_ptr m2 = xdr_to_msg(pair12{});
+  msg_ptr m3 = xdr_to_msg(v12(1));
+  marshaling_stack_limit = 0;
+  assert(status_of<xvector<int>>(m));
+  marshaling_stack_limit = 1;
+  assert(status_of<pair12>(m2));
+  assert(status_of<v12>(m3).code == xdr_errc::stack_overflow);
+  marshaling_stack_limit = 0xffffffff;
+
+  m = xdr_to_msg(b);
+  m->shrink(m->size() - 1);
+  assert(status_of<testns::bytes>(m).code == xdr_errc::bad_message_size);
+}
+
+void
+test_try_get()
+{
+  testns::bytes b;
+  b.s = "hello";
+  b.variable = { 1, 2, 3 };
+  msg_ptr m = xdr_to_msg(b, int(7));
+
+  testns::bytes b2;
+  int i = 0;
+  assert(xdr_try_from_msg(m, b2, i));
+  assert(b2 == b && i == 7);
+
+  // xdr_try_get decodes a prefix and leaves the archive after it.
+  xdr_get g(m);
+  assert(xdr_try_get(g, b2));
+  assert(b2 == b);
+  assert(xdr_try_get(g, i) && i == 7);
+  g.done();
+
+  xdr_get g2(m);
+  xdr_status st = xdr_try_get(g2, b2, i, i);
+  assert(st.code == xdr_errc::overflow && st.offset == m->size());
+  assert(g2.p_ == reinterpret_cast<const uint32_t *>(m->data()));
+
+  assert(xdr_try_from_msg(m, b2).code == xdr_errc::bad_message_size);
+}
+
+void
+test_try_get_fixed()
+{
+  // Fixed-size arguments skip the walk, but must report exactly the
+  // errors it would have.
+  fix_12 f;
+  f.i = 3;
+  f.d = 1.5;
+  msg_ptr m = xdr_to_msg(f, int(4));
+  fix_12 f2;
+  int i = 0;
+  assert(xdr_try_from_msg(m, f2, i));
+  assert(f2.i == 3 && f2.d == 1.5 && i == 4);
+
+  m = xdr_to_msg(f);
+  m->shrink(m->size() - 4);
+  xdr_status st = status_of<fix_12>(m);
+  assert(st.code == xdr_errc::overflow && st.offset == 4);
+
+  m = xdr_to_msg(f, int(4));
+  st = status_of<fix_12>(m);
+  assert(st.code == xdr_errc::bad_message_size && st.offset == 12);
+
+  opaque_array<5> oa;
+  m = xdr_to_msg(oa);
+  m->data()[6] = 1;
+  st = status_of<opaque_array<5>>(m);
+  assert(st.code == xdr_errc::should_be_zero && st.offset == 6);
+
+  m = xdr_to_msg(f);
+  marshaling_stack_limit = 0;
+  assert(status_of<fix_12>(m).code == xdr_errc::stack_overflow);
+  xdr_get g(m);
+  assert(xdr_try_get(g, f2).code == xdr_errc::stack_overflow);
+  assert(g.stack_limit == 0);
+  assert(g.p_ == reinterpret_cast<const uint32_t *>(m->data()));
+  marshaling_stack_limit = 0xffffffff;
+}
+
+int
+main()
+{
+  test_wellformed();
+  test_extents();
+  test_malformed();
+  test_try_get();
+  test_try_get_fixed();
+  return 0;
+}
@@ -1,12 +1,12 @@
-
 #include <cassert>
 #include <xdrpp/marshal.h>
+#include <xdrpp/skip.h>
 #include "tests/xdrtest.hh"
 
 using namespace xdr;
 
-int
-main()
+void
+test_recursion()
 {
   test_recursive tr;
   tr.next.activate().next.activate();
@@ -26,6 +26,74 @@ main()
     bad = false;
   }
   assert(!bad);
+}
+
+// Linked lists are handled iteratively, so their length is limited
+// by neither marshaling_stack_limit nor the call stack.
+void
+test_long_list()
+{
+  static_assert(pointer<test_list>::is_list::value, "test_list is a list");
+  static_assert(!pointer<test_recursive>::is_list::value,
+		"test_recursive is not a list");
+
+  constexpr int n = 500000;
+  pointer<test_list> l;
+  pointer<test_list> *p = &l;
+  for (int i = 0; i < n; i++) {
+    p->activate().val = i;
+    p = &(*p)->next;
+  }
+  l->next->name = "second";
+
+  xdr::marshaling_stack_limit = 3;
+  assert(xdr_size(l) == 4 + n * 12 + 8);
+  msg_ptr m = xdr_to_msg(l);
+  assert(m->size() == xdr_size(l));
+  assert(xdr_check_msg<pointer<test_list>>(m));
 
+  pointer<test_list> l2;
+  l2.activate().name = "stale";
+  xdr_from_msg(m, l2);
+  assert(l2->next->name == "second");
+  int i = 0;
+  for (const pointer<test_list> *q = &l2; *q; q = &(*q)->next)
+    assert((*q)->val == i++);
+  assert(i == n);
+
+  pointer<test_list> l3(l2);
+  assert(xdr_to_msg(l3)->size() == m->size());
+  l3->next = l3->next->next->next;
+  assert(l3->next->val == 3);
+  l3 = std::move(l3->next->next);
+  assert(l3->val == 4);
+  l3.resize(0);
+  assert(!l3);
+
+  // Assigning a longer list over a shorter one and vice versa
+  l3.activate().val = -1;
+  l3 = l2;
+  assert(xdr_to_msg(l3)->size() == m->size());
+  l2->next->next.reset();
+  l3 = l2;
+  assert(l3->val == 0 && l3->next->val == 1 && !l3->next->next);
+
+  // unique_ptr's reset(T*) is still available.
+  l3.reset(new test_list);
+  assert(l3 && !l3->next);
+  pointer<int> ip;
+  ip.reset(new int(3));
+  assert(*ip == 3);
+  ip.reset(nullptr);
+  assert(!ip);
+
+  xdr::marshaling_stack_limit = 0xffffffff;
+}
+
+int
+main()
+{
+  test_recursion();
+  test_long_list();
   return 0;
 }
@@ -0,0 +1,151 @@
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <xdrpp/pollset.h>
+
+using namespace std;
+using namespace xdr;
+
+// Holds workers in a task until opened.
+struct gate {
+  mutex m;
+  condition_variable cv;
+  bool open = false;
+  void wait() {
+    unique_lock<mutex> lk(m);
+    cv.wait(lk, [this]() { return open; });
+  }
+  void release() {
+    lock_guard<mutex> lk(m);
+    open = true;
+    cv.notify_all();
+  }
+};
+
+void
+wait_running(thread_pool &p, size_t n)
+{
+  while (p.get_stats().running != n)
+    this_thread::yield();
+}
+
+// Queued tasks run by priority, then in order.
+void
+priorities()
+{
+  gate g;
+  vector<int> order;
+  {
+    thread_pool p(1);
+    p.submit([&g]() { g.wait(); });
+    wait_running(p, 1);
+    for (int i = 0; i < 6; i++)
+      p.submit([&order,i]() { order.push_back(i); }, i % 3);
+    thread_pool::stats st = p.get_stats();
+    assert(st.queued == 6 && st.max_queued == 6 && st.running == 1);
+    g.release();
+  }
+  assert((order == vector<int>{2, 5, 1, 4, 0, 3}));
+}
+
+void
+reject()
+{
+  gate g;
+  thread_pool p(1, 2, thread_pool::Reject);
+  assert(p.submit([&g]() { g.wait(); }));
+  wait_running(p, 1);
+  assert(p.submit([]() {}));
+  assert(p.submit([]() {}));
+  assert(!p.submit([]() {}));
+  assert(p.get_stats().rejected == 1);
+  g.release();
+}
+
+// A producer blocks until a worker makes room in the queue.
+void
+block()
+{
+  gate g;
+  thread_pool p(1, 1, thread_pool::Block);
+  p.submit([&g]() { g.wait(); });
+  wait_running(p, 1);
+  p.submit([]() {});
+  atomic<bool> submitted {false};
+  thread t([&]() {
+      assert(p.submit([]() {}));
+      submitted = true;
+    });
+  this_thread::sleep_for(chrono::milliseconds(50));
+  assert(!submitted);
+  g.release();
+  t.join();
+  assert(submitted);
+}
+
+// Results come back on the thread calling poll.
+void
+async()
+{
+  pollset_plus ps;
+  ps.set_thread_pool(make_shared<thread_pool>(2, 1, thread_pool::Reject));
+  gate g;
+  thread::id self = this_thread::get_id();
+  int ndone = 0;
+  assert(ps.async([&g]() { g.wait(); return this_thread::get_id(); },
+		  [&](thread::id id) {
+		    assert(id != self && this_thread::get_id() == self);
+		    ++ndone;
+		  }));
+  wait_running(ps.get_thread_pool(), 1);
+  assert(ps.async([&g]() { g.wait(); return 1; },
+		  [&ndone](int) { ++ndone; }));
+  wait_running(ps.get_thread_pool(), 2);
+  assert(ps.async([]() { return 2; }, [&ndone](int) { ++ndone; }));
+  assert(!ps.async([]() { return 3; }, [](int) { assert(!"rejected"); }));
+  g.release();
+  while (ndone < 3)
+    ps.poll();
+  assert(ps.get_thread_pool().get_stats().rejected == 1);
+}
+
+// A pollset sharing a pool waits for its own tasks when destroyed,
+// without running their callbacks.
+void
+shared_pool()
+{
+  auto pool = make_shared<thread_pool>(1);
+  gate g;
+  atomic<bool> worked {false};
+  thread t;
+  {
+    pollset_plus ps;
+    ps.set_thread_pool(pool);
+    pool->submit([&g]() { g.wait(); });
+    wait_running(*pool, 1);
+    assert(ps.async([&worked]() { worked = true; return 0; },
+		    [](int) { assert(!"callback after destruction"); }));
+    t = thread([&g]() {
+	this_thread::sleep_for(chrono::milliseconds(50));
+	g.release();
+      });
+  }
+  t.join();
+  assert(worked);
+  assert(pool->get_stats().queued == 0);
+}
+
+int
+main()
+{
+  priorities();
+  reject();
+  block();
+  async();
+  shared_pool();
+  return 0;
+}
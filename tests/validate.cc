@@ -3,6 +3,7 @@
 #include <iostream>
 #include <xdrpp/marshal.h>
 #include <xdrpp/printer.h>
+#include <xdrpp/skip.h>
 #include "tests/xdrtest.hh"
 
 using namespace std;
@@ -42,6 +43,16 @@ main()
   }
   assert(ok);
 
+  xdr_status st = xdr_try_from_msg(xdr_to_msg(f4), ff4);
+  assert(st.code == xdr_errc::invariant_failed);
+  ok = false;
+  try {
+    st.raise();
+  } catch (const xdr::xdr_invariant_failed &) {
+    ok = true;
+  }
+  assert(ok);
+
   xstring<2> s;
   static_cast<string &>(s) = "1234";
   ok = false;
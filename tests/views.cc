@@ -0,0 +1,94 @@
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <xdrpp/marshal.h>
+#include <xdrpp/printer.h>
+#include "tests/xdrtest.hh"
+
+using namespace std;
+using namespace xdr;
+
+static bool
+in_msg(const msg_ptr &m, const void *p)
+{
+  const char *c = static_cast<const char *>(p);
+  return c >= m->data() && c < m->data() + m->size();
+}
+
+void
+test_decode()
+{
+  owned_rec o;
+  o.a = 7;
+  o.blob = { 1, 2, 3, 4, 5 };
+  o.name = "hello";
+  o.b = -1;
+  msg_ptr m = xdr_to_msg(o);
+
+  view_rec v;
+  xdr_from_msg(m, v);
+  assert(v.a == 7);
+  assert(v.b == -1);
+  assert(v.blob.size() == 5);
+  assert(v.blob[4] == 5);
+  assert(v.name.str() == "hello");
+  assert(in_msg(m, v.blob.data()));
+  assert(in_msg(m, v.name.data()));
+  assert(v.blob.vec() == o.blob);
+
+  // Views marshal exactly like the owned types.
+  msg_ptr m2 = xdr_to_msg(v);
+  assert(m2->size() == m->size());
+  assert(!memcmp(m2->data(), m->data(), m->size()));
+
+  assert(xdr_to_string(v) == xdr_to_string(o));
+
+  view_rec empty;
+  m = xdr_to_msg(empty);
+  xdr_from_msg(m, v);
+  assert(v.blob.empty() && v.name.empty());
+}
+
+void
+test_errors()
+{
+  bool ok = false;
+  try { name_view n("0123456789abcdefX"); }
+  catch (const xdr_overflow &) { ok = true; }
+  assert(ok);
+
+  owned_rec o;
+  o.name = "abc";
+  o.blob = { 1, 2, 3 };
+  msg_ptr m = xdr_to_msg(o);
+  m->data()[4 + 4 + 3] = 1;	// first padding byte of blob
+  view_rec v;
+  ok = false;
+  try { xdr_from_msg(m, v); }
+  catch (const xdr_should_be_zero &) { ok = true; }
+  assert(ok);
+
+  m = xdr_to_msg(o);
+  m->shrink(m->size() - 8);	// truncate inside name
+  ok = false;
+  try { xdr_from_msg(m, v); }
+  catch (const xdr_overflow &) { ok = true; }
+  assert(ok);
+
+  xstring_view<4> sv("abcd");
+  ok = false;
+  try { sv.resize(5); }
+  catch (const xdr_overflow &) { ok = true; }
+  assert(ok);
+  sv.resize(2);
+  assert(sv.str() == "ab");
+}
+
+int
+main()
+{
+  test_decode();
+  test_errors();
+  return 0;
+}
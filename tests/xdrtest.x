@@ -32,6 +32,12 @@ struct test_recursive {
   test_recursive nextvec<>;
 };
 
+struct test_list {
+  int val;
+  string name<>;
+  test_list *next;
+};
+
 struct fix_4 {
   int i;
 };
@@ -41,6 +47,27 @@ struct fix_12 {
   double d;
 };
 
+struct fix_8 {
+  double d;
+};
+
+%typedef xdr::opaque_view<> blob_view;
+%typedef xdr::xstring_view<16> name_view;
+
+struct owned_rec {
+  int a;
+  opaque blob<>;
+  string name<16>;
+  int b;
+};
+
+struct view_rec {
+  int a;
+  blob_view blob;
+  name_view name;
+  int b;
+};
+
 union u_4_12 switch (int which) {
  case 4:
    fix_4 f4;
@@ -151,6 +178,12 @@ program xdrtest_prog {
   } = 2;
 } = 0x20000000;
 
+program view_prog {
+  version view_v1 {
+    bigstr echo_name(view_rec) = 1;
+  } = 1;
+} = 0x20000002;
+
 program other_prog {
   version opv1 {
     void o_null(void) = 1;
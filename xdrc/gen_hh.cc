@@ -98,26 +98,27 @@ string
 decl_type(const rpc_decl &d)
 {
   string type = map_type(d.type);
+  string prefix = opt_arena ? "xdr::arena_" : "xdr::";
 
   if (type == "string")
-    return string("xdr::xstring<") + d.bound + ">";
+    return prefix + "xstring<" + d.bound + ">";
   if (d.type == "opaque")
     switch (d.qual) {
     case rpc_decl::ARRAY:
       return string("xdr::opaque_array<") + d.bound + ">";
     case rpc_decl::VEC:
-      return string("xdr::opaque_vec<") + d.bound + ">";
+      return prefix + "opaque_vec<" + d.bound + ">";
     default:
       assert(!"bad opaque qualifier");
     }
 
   switch (d.qual) {
   case rpc_decl::PTR:
-    return string("xdr::pointer<") + type + ">";
+    return prefix + "pointer<" + type + ">";
   case rpc_decl::ARRAY:
     return string("xdr::xarray<") + type + "," + d.bound + ">";
   case rpc_decl::VEC:
-    return string("xdr::xvector<") + type +
+    return prefix + "xvector<" + type +
       (d.bound.empty() ? ">" : string(",") + d.bound + ">");
   default:
     return type;
@@ -206,8 +207,18 @@ gen(std::ostream &os, const rpc_struct &s)
       os << "," << nl << "    ";
     os << d.id << "(std::forward<_" << d.id << "_T>(_" << d.id << "))";
   }
-  os << " {}"
-     << nl.close << "}";
+  os << " {}";
+
+  // A struct whose last field points to another of the same struct
+  // is a linked list, which xdr::pointer handles without recursion.
+  const rpc_decl &last = s.decls.back();
+  if (last.qual == rpc_decl::PTR && last.ts_which == rpc_decl::TS_ID
+      && map_type(last.type) == s.id)
+    os << endl
+       << nl << "static Constexpr " << decl_type(last) << ' ' << s.id
+       << "::*_xdr_list_next() { return &" << s.id << "::" << last.id
+       << "; }";
+  os << nl.close << "}";
 
   top_material
     << "template<> struct xdr_traits<" << cur_scope()
@@ -819,6 +830,8 @@ gen_hh(std::ostream &os)
   os << nl << "#ifndef " << gtok
      << nl << "#define " << gtok << " 1" << endl
      << nl << "#include <xdrpp/types.h>";
+  if (opt_arena)
+    os << nl << "#include <xdrpp/arena.h>";
 
   int last_type = -1;
 
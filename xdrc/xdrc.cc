@@ -20,6 +20,7 @@ string server_session;
 bool server_ptr;
 bool server_async;
 bool opt_pedantic;
+bool opt_arena;
 
 string
 guard_token(const string &extra)
@@ -96,6 +97,8 @@ and OPTIONAL arguments for -server{hh,cc} can contain:
       -s[ession] T  Use type T to track client sessions
       -p[tr]        To accept arguments by std::unique_ptr
       -a[sync]      To generate arpc server scaffolding (with callbacks)
+and OPTIONAL arguments for -hh can contain:
+      -arena        Use xdr::arena_allocator for strings, vectors, pointers
 )";
   exit(err);
 }
@@ -107,6 +110,7 @@ enum opttag {
   OPT_SERVERHH,
   OPT_SERVERCC,
   OPT_PEDANTIC,
+  OPT_ARENA,
 };
 
 static const struct option xdrc_options[] = {
@@ -119,6 +123,7 @@ static const struct option xdrc_options[] = {
   {"session", required_argument, nullptr, 's'},
   {"async", no_argument, nullptr, 'a'},
   {"pedantic", no_argument, nullptr, OPT_PEDANTIC},
+  {"arena", no_argument, nullptr, OPT_ARENA},
   {nullptr, 0, nullptr, 0}
 };
 
@@ -177,6 +182,9 @@ main(int argc, char **argv)
     case OPT_PEDANTIC:
       opt_pedantic = true;
       break;
+    case OPT_ARENA:
+      opt_arena = true;
+      break;
     case 'p':
       server_ptr = true;
       break;
@@ -0,0 +1,68 @@
+
+#include <cstdlib>
+#include <xdrpp/arena.h>
+
+namespace xdr {
+
+thread_local arena *arena::current_;
+
+namespace {
+// Block headers are padded to max_align_t, so any fundamental
+// alignment is satisfied by the start of the data area.
+constexpr std::size_t hdr =
+  (2 * sizeof(void *) + alignof(std::max_align_t) - 1)
+  & ~(alignof(std::max_align_t) - 1);
+}
+
+arena::~arena()
+{
+  while (block *b = head_) {
+    head_ = b->next;
+    std::free(b);
+  }
+}
+
+void *
+arena::grow(std::size_t n, std::size_t align)
+{
+  static_assert(sizeof(block) <= hdr, "arena block header too big");
+  assert(align <= alignof(std::max_align_t));
+  if (n > std::numeric_limits<std::size_t>::max() - hdr)
+    throw std::bad_alloc();
+  std::size_t size = std::max(n, block_size_);
+  block *b = static_cast<block *>(std::malloc(hdr + size));
+  if (!b)
+    throw std::bad_alloc();
+  b->size = size;
+  char *data = reinterpret_cast<char *>(b) + hdr;
+  if (n < block_size_ || !head_) {
+    // Start allocating from the new block.
+    b->next = head_;
+    head_ = b;
+    p_ = data + n;
+    e_ = data + size;
+  }
+  else {
+    // Oversized request; keep using the current block for small ones.
+    b->next = head_->next;
+    head_->next = b;
+  }
+  return data;
+}
+
+void
+arena::reset()
+{
+  if (!head_)
+    return;
+  // Keep the current block (never an oversized one, unless it was the
+  // very first allocation) and free the rest.
+  while (block *b = head_->next) {
+    head_->next = b->next;
+    std::free(b);
+  }
+  p_ = reinterpret_cast<char *>(head_) + hdr;
+  e_ = p_ + head_->size;
+}
+
+} // namespace xdr
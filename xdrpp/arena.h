@@ -0,0 +1,200 @@
+// -*- C++ -*-
+
+/** \file arena.h Arena (monotonic) allocation for decoded XDR data.
+ *
+ * Normally, every \c xvector, \c xstring, and \c pointer in a decoded
+ * structure is a separate heap allocation, so freeing a large
+ * argument tree means many calls to \c free.  Types generated by \c
+ * xdrc \c -arena instead use \c xdr::arena_allocator, which takes
+ * memory from the \c xdr::arena made current by an \c
+ * xdr::arena_scope (or from the heap if there is none).  The memory
+ * is released all at once when the arena is reset or destroyed.
+ *
+ * An object allocated in an arena must not outlive the arena (or
+ * its next \c reset).  Note that moving from such an object moves the
+ * allocator along with the contents.
+ */
+
+#ifndef _XDRPP_ARENA_H_HEADER_INCLUDED_
+#define _XDRPP_ARENA_H_HEADER_INCLUDED_ 1
+
+#include <limits>
+#include <new>
+#include <xdrpp/marshal.h>
+
+namespace xdr {
+
+//! A monotonic allocator.  Memory is carved sequentially out of large
+//! blocks, and individual deallocations are no-ops.
+class arena {
+  struct block {
+    block *next;
+    std::size_t size;
+  };
+  block *head_ {nullptr};
+  char *p_ {nullptr};
+  char *e_ {nullptr};
+  const std::size_t block_size_;
+
+  static thread_local arena *current_;
+  friend class arena_scope;
+
+  void *grow(std::size_t n, std::size_t align);
+
+public:
+  static constexpr std::size_t default_block_size = 0x10000;
+
+  explicit arena(std::size_t block_size = default_block_size)
+    : block_size_(block_size) {}
+  ~arena();
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+
+  //! Allocate \c n bytes aligned to \c align (a power of 2 no larger
+  //! than the alignment of \c std::max_align_t).
+  void *allocate(std::size_t n, std::size_t align) {
+    std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(p_) + align - 1)
+      & ~std::uintptr_t(align - 1);
+    if (p_ && n <= std::size_t(e_ - reinterpret_cast<char *>(p))) {
+      p_ = reinterpret_cast<char *>(p) + n;
+      return reinterpret_cast<void *>(p);
+    }
+    return grow(n, align);
+  }
+
+  //! Free everything allocated from the arena.  The first block is
+  //! kept for reuse, so an arena that is reset after each request
+  //! typically makes no calls to \c malloc at all.
+  void reset();
+
+  //! The arena made current by the innermost \c xdr::arena_scope on
+  //! this thread, or \c nullptr.
+  static arena *current() { return current_; }
+};
+
+//! Makes an arena current on this thread for the lifetime of the
+//! scope object.  Scopes nest.
+class arena_scope {
+  arena *const prev_;
+public:
+  explicit arena_scope(arena *a) : prev_(arena::current_) {
+    arena::current_ = a;
+  }
+  explicit arena_scope(arena &a) : arena_scope(&a) {}
+  ~arena_scope() { arena::current_ = prev_; }
+  arena_scope(const arena_scope &) = delete;
+  arena_scope &operator=(const arena_scope &) = delete;
+};
+
+//! Allocator for XDR containers.  A default-constructed allocator
+//! captures the current arena (see \c xdr::arena_scope) and allocates
+//! from it, or from the heap if there is no current arena.  Copying
+//! a container re-captures the current arena rather than sharing the
+//! source's, so that a copy made outside any scope is safe to keep.
+//! As with \c std::pmr::polymorphic_allocator, the allocator does
+//! not propagate on move assignment or swap, so moving arena data
+//! into an existing heap-backed container copies it.  Move
+//! construction, however, keeps the source's arena.
+template<typename T> struct arena_allocator {
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::false_type;
+  using propagate_on_container_swap = std::false_type;
+
+  arena *arena_;
+
+  arena_allocator() : arena_(arena::current()) {}
+  explicit arena_allocator(arena *a) : arena_(a) {}
+  template<typename U> arena_allocator(const arena_allocator<U> &a)
+    : arena_(a.arena_) {}
+
+  T *allocate(std::size_t n) {
+    if (!arena_)
+      return std::allocator<T>().allocate(n);
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+      throw std::bad_alloc();
+    return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *p, std::size_t n) {
+    if (!arena_)
+      std::allocator<T>().deallocate(p, n);
+  }
+  arena_allocator select_on_container_copy_construction() const {
+    return arena_allocator();
+  }
+
+  template<typename U> friend bool
+  operator==(const arena_allocator &a, const arena_allocator<U> &b) {
+    return a.arena_ == b.arena_;
+  }
+  template<typename U> friend bool
+  operator!=(const arena_allocator &a, const arena_allocator<U> &b) {
+    return a.arena_ != b.arena_;
+  }
+};
+
+namespace detail {
+template<typename T> struct arena_delete {
+  arena *arena_ = nullptr;
+  void operator()(T *p) const {
+    if (arena_)
+      p->~T();
+    else
+      delete p;
+  }
+};
+
+template<typename T> struct pointer_alloc<T, arena_allocator<T>> {
+  using deleter = arena_delete<T>;
+  template<typename...Args> static std::unique_ptr<T, deleter>
+  make(Args &&...args) {
+    arena *a = arena::current();
+    if (!a)
+      return std::unique_ptr<T, deleter>(new T(std::forward<Args>(args)...));
+    void *raw = a->allocate(sizeof(T), alignof(T));
+    return std::unique_ptr<T, deleter>(new (raw) T(std::forward<Args>(args)...),
+				       deleter{a});
+  }
+};
+} // namespace detail
+
+//! Arena-aware counterparts of the XDR container types, as emitted by
+//! <tt>xdrc -arena</tt>.
+template<typename T, uint32_t N = XDR_MAX_LEN>
+using arena_xvector = xvector<T, N, arena_allocator<T>>;
+template<uint32_t N = XDR_MAX_LEN>
+using arena_opaque_vec = xvector<std::uint8_t, N, arena_allocator<std::uint8_t>>;
+template<uint32_t N = XDR_MAX_LEN>
+using arena_xstring = xstring<N, arena_allocator<char>>;
+template<typename T> using arena_pointer = pointer<T, arena_allocator<T>>;
+
+namespace detail {
+//! Replace \c t with a value constructed within the current arena.
+//! Assignment would keep \c t's allocator (which does not propagate),
+//! so \c t is instead re-created by move construction, which takes
+//! the new value's allocator.
+template<typename T> void
+arena_reconstruct(T &t)
+{
+  T fresh{};
+  t.~T();
+  new (&t) T(std::move(fresh));
+}
+} // namespace detail
+
+//! Like \c xdr::xdr_from_msg, but allocates the decoded data from
+//! arena \c a.  Each argument is first replaced by a value
+//! constructed within the arena, so that the top-level containers
+//! (and not only the nested ones) use the arena.
+template<typename...Args> void
+xdr_from_msg(const msg_ptr &m, arena &a, Args &...args)
+{
+  arena_scope scope(a);
+  bool seq[] = { true, (detail::arena_reconstruct(args), true)... };
+  (void) seq;
+  xdr_from_msg(m, args...);
+}
+
+} // namespace xdr
+
+#endif // !_XDRPP_ARENA_H_HEADER_INCLUDED_
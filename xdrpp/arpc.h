@@ -20,23 +20,27 @@ template<typename T> struct call_result : std::unique_ptr<T> {
       this->reset(new T{});
   }
   call_result(rpc_call_stat::stat_type type) : stat_(type) {}
+  call_result(const rpc_call_stat &stat) : stat_(stat) {}
   const char *message() const { return *this ? nullptr : stat_.message(); }
 };
 template<> struct call_result<void> {
   rpc_call_stat stat_;
   call_result(const rpc_msg &hdr) : stat_(hdr) {}
   call_result(rpc_call_stat::stat_type type) : stat_(type) {}
+  call_result(const rpc_call_stat &stat) : stat_(stat) {}
   const char *message() const { return stat_ ? nullptr : stat_.message(); }
   explicit operator bool() const { return bool(stat_); }
   xdr_void &operator*() { static xdr_void v; return v; }
 };
 
-class asynchronous_client_base {
-  rpc_sock &s_;
+//! Client stub base for making calls over \c Sock, which is \c
+//! rpc_sock or \c rpc_udp_sock.
+template<typename Sock> class basic_asynchronous_client {
+  Sock &s_;
 
 public:
-  asynchronous_client_base(rpc_sock &s) : s_(s) {}
-  asynchronous_client_base(asynchronous_client_base &c) : s_(c.s_) {}
+  basic_asynchronous_client(Sock &s) : s_(s) {}
+  basic_asynchronous_client(basic_asynchronous_client &c) : s_(c.s_) {}
 
   template<typename P, typename...A>
   void invoke(const A &...a,
@@ -90,11 +94,20 @@ public:
       });
   }
 
-  asynchronous_client_base *operator->() { return this; }
+  basic_asynchronous_client *operator->() { return this; }
 };
 
+using asynchronous_client_base = basic_asynchronous_client<rpc_sock>;
+
 template<typename T> using arpc_client =
   typename T::template _xdr_client<asynchronous_client_base>;
+//! Asynchronous client for calls over UDP (see \c rpc_udp_sock).
+template<typename T> using arpc_udp_client = typename T::template
+  _xdr_client<basic_asynchronous_client<rpc_udp_sock>>;
+//! Asynchronous client for calls to a server in the same process
+//! (see \c rpc_loopback).
+template<typename T> using arpc_loopback_client = typename T::template
+  _xdr_client<basic_asynchronous_client<rpc_loopback>>;
 
 
 // And now for the server
@@ -108,10 +121,15 @@ class reply_cb_impl {
   uint32_t xid_;
   cb_t cb_;
   const char *const proc_name_;
+  // The call message, held until the reply is sent when the decoded
+  // arguments contain views into it.
+  msg_ptr call_;
 
 public:
-  template<typename CB> reply_cb_impl(uint32_t xid, CB &&cb, const char *name)
-    : xid_(xid), cb_(std::forward<CB>(cb)), proc_name_(name) {}
+  template<typename CB> reply_cb_impl(uint32_t xid, CB &&cb, const char *name,
+				      msg_ptr call = nullptr)
+    : xid_(xid), cb_(std::forward<CB>(cb)), proc_name_(name),
+      call_(std::move(call)) {}
   reply_cb_impl(const reply_cb_impl &rcb) = delete;
   reply_cb_impl &operator=(const reply_cb_impl &rcb) = delete;
   ~reply_cb_impl() { if (cb_) reject(PROC_UNAVAIL); }
@@ -121,6 +139,7 @@ private:
     assert(cb_);		// If this fails you replied twice
     cb_(std::move(b));
     cb_ = nullptr;
+    call_.reset();
   }
 
   template<typename T> void send_reply(const T &t) {
@@ -140,6 +159,44 @@ private:
     send_reply_msg(rpc_auth_error_msg(xid_, stat));
   }
 };
+
+template<typename T> struct direct_result { using type = call_result<T>; };
+template<> struct direct_result<xdr_void> { using type = call_result<void>; };
+
+// Passes a result straight to the callback of an arpc_direct_client
+// call, without marshaling it.
+template<typename T> class direct_reply_impl {
+public:
+  using result_t = typename direct_result<T>::type;
+  using cb_t = std::function<void(result_t)>;
+
+  explicit direct_reply_impl(cb_t &&cb) : cb_(std::move(cb)) {}
+  direct_reply_impl(const direct_reply_impl &) = delete;
+  direct_reply_impl &operator=(const direct_reply_impl &) = delete;
+  ~direct_reply_impl() { if (cb_) reject(PROC_UNAVAIL); }
+
+  void send_reply(const T &t) {
+    result_t r {rpc_call_stat()};
+    set(r, t);
+    deliver(std::move(r));
+  }
+  void reject(accept_stat stat) { deliver(result_t(stat)); }
+  void reject(auth_stat stat) { deliver(result_t(stat)); }
+
+private:
+  cb_t cb_;
+
+  template<typename U> static void set(call_result<U> &r, const U &t) {
+    r.reset(new U(t));
+  }
+  static void set(call_result<void> &, const xdr_void &) {}
+  void deliver(result_t &&r) {
+    assert(cb_);		// If this fails you replied twice
+    cb_t cb (std::move(cb_));
+    cb_ = nullptr;
+    cb(std::move(r));
+  }
+};
 } // namespace detail
 
 // Prior to C++14, it's a pain to move objects into another thread.
@@ -149,15 +206,36 @@ template<typename T> class reply_cb {
   using impl_t = detail::reply_cb_impl;
 public:
   using type = T;
+  using direct_t = detail::direct_reply_impl<T>;
   std::shared_ptr<impl_t> impl_;
+  //! Set instead of \c impl_ for calls from an \c arpc_direct_client.
+  std::shared_ptr<direct_t> direct_;
 
   reply_cb() {}
-  template<typename CB> reply_cb(uint32_t xid, CB &&cb, const char *name)
-    : impl_(std::make_shared<impl_t>(xid, std::forward<CB>(cb), name)) {}
-
-  void operator()(const type &t) const { impl_->send_reply(t); }
-  void reject(accept_stat stat) const { impl_->reject(stat); }
-  void reject(auth_stat stat) const { impl_->reject(stat); }
+  template<typename CB> reply_cb(uint32_t xid, CB &&cb, const char *name,
+				 msg_ptr call = nullptr)
+    : impl_(std::make_shared<impl_t>(xid, std::forward<CB>(cb), name,
+				     std::move(call))) {}
+  explicit reply_cb(std::shared_ptr<direct_t> d) : direct_(std::move(d)) {}
+
+  void operator()(const type &t) const {
+    if (direct_)
+      direct_->send_reply(t);
+    else
+      impl_->send_reply(t);
+  }
+  void reject(accept_stat stat) const {
+    if (direct_)
+      direct_->reject(stat);
+    else
+      impl_->reject(stat);
+  }
+  void reject(auth_stat stat) const {
+    if (direct_)
+      direct_->reject(stat);
+    else
+      impl_->reject(stat);
+  }
 };
 template<> class reply_cb<void> : public reply_cb<xdr_void> {
 public:
@@ -172,20 +250,25 @@ class arpc_service : public service_base {
   T &server_;
 
 public:
-  void process(void *session, rpc_msg &hdr, xdr_get &g, cb_t reply) override {
+  void process(void *session, rpc_msg &hdr, xdr_get &g, msg_ptr &m,
+	       cb_t reply) override {
     if (!check_call(hdr))
       reply(nullptr);
     if (!Interface::call_dispatch(*this, hdr.body.cbody().proc,
 				  static_cast<Session *>(session),
-				  hdr, g, std::move(reply)))
+				  hdr, g, m, std::move(reply)))
       reply(rpc_accepted_error_msg(hdr.xid, PROC_UNAVAIL));
   }
 
   template<typename P>
-  void dispatch(Session *session, rpc_msg &hdr, xdr_get &g, cb_t reply) {
+  void dispatch(Session *session, rpc_msg &hdr, xdr_get &g, msg_ptr &m,
+		cb_t reply) {
     wrap_transparent_ptr<typename P::arg_tuple_type> arg;
     if (!decode_arg(g, arg))
       return reply(rpc_accepted_error_msg(hdr.xid, GARBAGE_ARGS));
+    // Only the arguments come from the request's arena, if any; what
+    // the handler creates or copies must outlive the request.
+    arena_scope heap(nullptr);
 
     if (xdr_trace_server) {
       std::string s = "CALL ";
@@ -194,9 +277,28 @@ public:
       std::clog << xdr_to_string(arg, s.c_str());
     }
 
+    // Arguments of type xdr::opaque_view or xdr::xstring_view point
+    // into the call message, so it lives until the handler replies.
     dispatch_with_session<P>(server_, session, std::move(arg),
 			     reply_cb<typename P::res_type>{
-			       hdr.xid, std::move(reply), P::proc_name()});
+			       hdr.xid, std::move(reply), P::proc_name(),
+			       g.borrowed_ ? std::move(m) : msg_ptr()});
+  }
+
+  //! Invoke the method for \c P with arguments that were never
+  //! marshaled (see \c arpc_direct_client).
+  template<typename P>
+  void dispatch(Session *session,
+		wrap_transparent_ptr<typename P::arg_tuple_type> &&arg,
+		reply_cb<typename P::res_type> reply) {
+    if (xdr_trace_server) {
+      std::string s = "CALL ";
+      s += P::proc_name();
+      s += " <- [direct]";
+      std::clog << xdr_to_string(arg, s.c_str());
+    }
+    dispatch_with_session<P>(server_, session, std::move(arg),
+			     std::move(reply));
   }
 
   arpc_service(T &server)
@@ -204,6 +306,10 @@ public:
       server_(server) {}
 };
 
+//! Server that dispatches calls to asynchronous handlers, which reply
+//! through a \c reply_cb.  Argument views (\c xdr::opaque_view and
+//! \c xdr::xstring_view) stay valid until the reply is sent, but not
+//! after.
 class arpc_server : public rpc_server_base {
 public:
   template<typename T, typename Interface = typename T::rpc_interface_type>
@@ -218,6 +324,60 @@ template<typename Session = void,
 using arpc_tcp_listener =
   generic_rpc_tcp_listener<arpc_service, Session, SessionAllocator>;
 
+template<typename Session = void,
+	 typename SessionAllocator = session_allocator<Session>>
+using arpc_tcp_multi_listener =
+  generic_rpc_tcp_multi_listener<arpc_service, Session, SessionAllocator>;
+
+using arpc_udp_listener = generic_rpc_udp_listener<arpc_service>;
+
+//! Client stub base that calls the methods of server object \c S
+//! (which implements \c Interface) in the same process, without
+//! marshaling anything.  The arguments are copied when the call is
+//! made, and moved into the method at the end of the current
+//! PollSet::poll iteration.  The result goes straight from the
+//! method's \c reply_cb to the callback.
+template<typename S, typename Session = void,
+	 typename Interface = typename S::rpc_interface_type>
+class direct_client_base {
+  pollset &ps_;
+  S &server_;
+  Session *const session_;
+
+public:
+  direct_client_base(pollset &ps, S &server, Session *session = nullptr)
+    : ps_(ps), server_(server), session_(session) {}
+  direct_client_base(direct_client_base &c)
+    : ps_(c.ps_), server_(c.server_), session_(c.session_) {}
+
+  template<typename P, typename...A>
+  void invoke(const A &...a,
+	      std::function<void(call_result<typename P::res_type>)> cb) {
+    using arg_t = wrap_transparent_ptr<typename P::arg_tuple_type>;
+    using reply_t = reply_cb<typename P::res_type>;
+    using direct_t = typename reply_t::direct_t;
+    // Shared, because std::function must be copyable.
+    auto arg = std::make_shared<arg_t>(transparent_ptr<A>(new A(a))...);
+    auto d = std::make_shared<direct_t>(std::move(cb));
+    S *server = &server_;
+    Session *session = session_;
+    ps_.defer_cb([server,session,arg,d]() {
+	arpc_service<S, Session, Interface> svc(*server);
+	svc.template dispatch<P>(session, std::move(*arg), reply_t(d));
+      });
+  }
+
+  direct_client_base *operator->() { return this; }
+};
+
+//! Asynchronous client for server object \c S in the same process
+//! (see \c direct_client_base).  Construct it with a \c pollset and
+//! the server object.
+template<typename S, typename Session = void,
+	 typename Interface = typename S::rpc_interface_type>
+using arpc_direct_client = typename Interface::template
+  _xdr_client<direct_client_base<S, Session, Interface>>;
+
 } // namespace xdr
 
 #endif // !_XDRPP_ARPC_H_HEADER_INCLUDED_
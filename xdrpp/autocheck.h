@@ -159,8 +159,8 @@ struct generator_t {
       archive(g, e);
   }
 
-  template<typename T> void
-  operator()(pointer<T> &t) const {
+  template<typename T, typename A> void
+  operator()(pointer<T,A> &t) const {
     if (autocheck::generator<std::uint32_t>{}(size_+1)) {
       generator_t g(elt_gen());
       archive(g, t.activate());
@@ -60,18 +60,23 @@ template<typename Archive> constexpr bool is_cereal_binary =
 template<typename T> struct bytes_superclass {
   static constexpr bool is_bytes = false;
 };
-#define DECLARE_BYTES(TYPE, ...)				\
-template<uint32_t N> struct bytes_superclass<TYPE> {		\
-  static constexpr bool is_bytes = true;			\
-  using type = TYPE;						\
-  using super = __VA_ARGS__;					\
-  static super &upcast(type &t) { return t; }			\
-  static const super &upcast(const type &t) { return t; }	\
+template<typename T, typename S> struct bytes_superclass_base {
+  static constexpr bool is_bytes = true;
+  using type = T;
+  using super = S;
+  static super &upcast(type &t) { return t; }
+  static const super &upcast(const type &t) { return t; }
 };
-DECLARE_BYTES(opaque_array<N>, std::array<std::uint8_t, size_t(N)>)
-DECLARE_BYTES(opaque_vec<N>, std::vector<std::uint8_t>)
-DECLARE_BYTES(xstring<N>, std::string)
-#undef DECLARE_BYTES
+template<uint32_t N> struct bytes_superclass<opaque_array<N>>
+  : bytes_superclass_base<opaque_array<N>,
+			  std::array<std::uint8_t, size_t(N)>> {};
+template<uint32_t N, typename A>
+struct bytes_superclass<xvector<std::uint8_t, N, A>>
+  : bytes_superclass_base<xvector<std::uint8_t, N, A>,
+			  std::vector<std::uint8_t, A>> {};
+template<uint32_t N, typename A> struct bytes_superclass<xstring<N, A>>
+  : bytes_superclass_base<xstring<N, A>,
+			  std::basic_string<char, std::char_traits<char>, A>> {};
 
 template<typename Archive, typename T>
 std::enable_if_t<!is_cereal_binary<Archive> && bytes_superclass<T>::is_bytes>
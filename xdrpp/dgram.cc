@@ -0,0 +1,310 @@
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <xdrpp/dgram.h>
+#include <xdrpp/rpc_msg.hh>
+
+namespace xdr {
+
+namespace {
+
+// Most datagrams handled per system call
+constexpr unsigned max_batch = 64;
+
+// Rounds of max_batch reads per call to dgram_sock::input, so that a
+// busy socket cannot starve the rest of the pollset.
+constexpr int max_input_rounds = 3;
+
+#ifdef __linux__
+inline int
+recv_batch(int fd, mmsghdr *v, unsigned n)
+{
+  return recvmmsg(fd, v, n, MSG_DONTWAIT, nullptr);
+}
+
+inline int
+send_batch(int fd, mmsghdr *v, unsigned n)
+{
+  return sendmmsg(fd, v, n, MSG_DONTWAIT);
+}
+#else // !__linux__
+struct mmsghdr {
+  msghdr msg_hdr;
+  unsigned msg_len;
+};
+
+int
+recv_batch(int fd, mmsghdr *v, unsigned n)
+{
+  unsigned i;
+  for (i = 0; i < n; i++) {
+    ssize_t r = recvmsg(fd, &v[i].msg_hdr, MSG_DONTWAIT);
+    if (r < 0)
+      return i ? int(i) : -1;
+    v[i].msg_len = r;
+  }
+  return i;
+}
+
+int
+send_batch(int fd, mmsghdr *v, unsigned n)
+{
+  unsigned i;
+  for (i = 0; i < n; i++) {
+    ssize_t r = sendmsg(fd, &v[i].msg_hdr, MSG_DONTWAIT);
+    if (r < 0)
+      return i ? int(i) : -1;
+    v[i].msg_len = r;
+  }
+  return i;
+}
+#endif // !__linux__
+
+inline bool
+eagain(int err)
+{
+  return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
+
+} // namespace
+
+dgram_sock::~dgram_sock()
+{
+  ps_.fd_cb(s_, pollset::ReadWrite);
+  close(s_);
+  *destroyed_ = true;
+}
+
+void
+dgram_sock::init()
+{
+  assert(maxmsglen_ > 0);
+  if (batch_ == 0 || batch_ > max_batch)
+    batch_ = max_batch;
+  rbuf_.reset(new char[batch_ * maxmsglen_]);
+  set_nonblock(s_);
+  if (rcb_)
+    ps_.fd_cb(s_, pollset::Read, [this](){ input(); });
+}
+
+void
+dgram_sock::input()
+{
+  mmsghdr hdrs[max_batch];
+  iovec iov[max_batch];
+  sockaddr_storage addrs[max_batch];
+  std::shared_ptr<bool> destroyed = destroyed_;
+
+  for (int round = 0; round < max_input_rounds; round++) {
+    std::memset(hdrs, 0, batch_ * sizeof hdrs[0]);
+    for (unsigned i = 0; i < batch_; i++) {
+      iov[i].iov_base = rbuf_.get() + i * maxmsglen_;
+      iov[i].iov_len = maxmsglen_;
+      hdrs[i].msg_hdr.msg_name = &addrs[i];
+      hdrs[i].msg_hdr.msg_namelen = sizeof addrs[i];
+      hdrs[i].msg_hdr.msg_iov = &iov[i];
+      hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n = recv_batch(s_.fd_, hdrs, batch_);
+    if (n <= 0) {
+      // ECONNREFUSED just means an earlier datagram on a connected
+      // socket was not delivered.
+      if (n < 0 && !eagain(errno) && errno != ECONNREFUSED)
+	std::cerr << "dgram_sock::input: " << sock_errmsg() << std::endl;
+      return;
+    }
+
+    for (int i = 0; i < n; i++) {
+      const msghdr &h = hdrs[i].msg_hdr;
+      if (h.msg_flags & MSG_TRUNC) {
+	std::cerr << "dgram_sock::input: dropping datagram larger than "
+		  << maxmsglen_ << " bytes" << std::endl;
+	continue;
+      }
+      msg_ptr m = message_t::alloc(hdrs[i].msg_len);
+      std::memcpy(m->data(), iov[i].iov_base, hdrs[i].msg_len);
+      if (h.msg_namelen)
+	m->set_peer(static_cast<const sockaddr *>(h.msg_name), h.msg_namelen);
+      rcb_(std::move(m));
+      if (*destroyed)
+	return;
+    }
+    if (unsigned(n) < batch_)
+      return;
+  }
+}
+
+void
+dgram_sock::putmsg(msg_ptr &&m, const sockaddr *to)
+{
+  wqueue_.emplace_back();
+  wbuf &b = wqueue_.back();
+  b.msg_ = std::move(m);
+  if (to) {
+    b.tolen_ = socksize(to);
+    std::memcpy(&b.to_, to, b.tolen_);
+  }
+  else
+    b.tolen_ = 0;
+
+  // If waiting for the socket to become writable, flush() runs then.
+  if (!flush_pending_ && !wblocked_) {
+    flush_pending_ = true;
+    ps_.defer_cb([this,destroyed=destroyed_]() {
+	if (!*destroyed) {
+	  flush_pending_ = false;
+	  flush();
+	}
+      });
+  }
+}
+
+void
+dgram_sock::flush()
+{
+  mmsghdr hdrs[max_batch];
+  iovec iov[max_batch];
+
+  size_t done = 0;
+  while (done < wqueue_.size()) {
+    unsigned n = std::min<size_t>(max_batch, wqueue_.size() - done);
+    std::memset(hdrs, 0, n * sizeof hdrs[0]);
+    for (unsigned i = 0; i < n; i++) {
+      wbuf &b = wqueue_[done + i];
+      iov[i].iov_base = b.msg_->data();
+      iov[i].iov_len = b.msg_->size();
+      if (b.tolen_) {
+	hdrs[i].msg_hdr.msg_name = &b.to_;
+	hdrs[i].msg_hdr.msg_namelen = b.tolen_;
+      }
+      hdrs[i].msg_hdr.msg_iov = &iov[i];
+      hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int r = send_batch(s_.fd_, hdrs, n);
+    if (r >= 0)
+      done += r;
+    else if (eagain(errno))
+      break;
+    else {
+      // Datagrams are unreliable anyway, so drop the one that failed
+      // (e.g., with EMSGSIZE) and carry on with the rest.
+      if (errno != ECONNREFUSED)
+	std::cerr << "dgram_sock::flush: " << sock_errmsg() << std::endl;
+      done++;
+    }
+  }
+  wqueue_.erase(wqueue_.begin(), wqueue_.begin() + done);
+
+  if (wqueue_.empty()) {
+    if (wblocked_) {
+      wblocked_ = false;
+      ps_.fd_cb(s_, pollset::Write);
+    }
+  }
+  else if (!wblocked_) {
+    wblocked_ = true;
+    ps_.fd_cb(s_, pollset::Write, [this](){ flush(); });
+  }
+}
+
+
+rpc_udp_sock::rpc_udp_sock(pollset &ps, sock_t s, size_t maxmsglen)
+  : ps_(ps),
+    ds_(ps, s, std::bind(&rpc_udp_sock::recv_msg, this,
+			 std::placeholders::_1), maxmsglen)
+{
+}
+
+void
+rpc_udp_sock::abort_all_calls()
+{
+  decltype(calls_) calls(std::move(calls_));
+  calls_.clear();
+  for (auto &c : calls)
+    ps_.timeout_cancel(c.second.to_);
+  for (auto &c : calls)
+    try { c.second.cb_(nullptr); }
+    catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+}
+
+void
+rpc_udp_sock::send_call(msg_ptr &b, rcb_t cb)
+{
+  uint32_t xid = b->word(0);
+  // A reply could not be told apart from one to an earlier call with
+  // the same xid, so fail the earlier call.
+  rcb_t old;
+  auto calli = calls_.find(xid);
+  if (calli != calls_.end()) {
+    ps_.timeout_cancel(calli->second.to_);
+    old = std::move(calli->second.cb_);
+    calls_.erase(calli);
+  }
+
+  call &c = calls_[xid];
+  c.cb_ = std::move(cb);
+  c.wait_ = timeout_;
+  c.tries_ = tries_;
+  c.msg_ = std::move(b);
+  transmit(xid);
+
+  if (old) {
+    errno = EEXIST;
+    old(nullptr);
+  }
+}
+
+void
+rpc_udp_sock::transmit(uint32_t xid)
+{
+  call &c = calls_.at(xid);
+  // The message is needed again if there is no reply, so send a copy.
+  msg_ptr m = message_t::alloc(c.msg_->size());
+  std::memcpy(m->data(), c.msg_->data(), c.msg_->size());
+  ds_.putmsg(std::move(m));
+  c.tries_--;
+  c.to_ = ps_.timeout(c.wait_, [this,xid]() {
+      // The pollset has already freed this timeout, so forget it
+      // before anything can cancel it.
+      call &c = calls_.at(xid);
+      c.to_ = pollset::timeout_null();
+      if (c.tries_ > 0) {
+	c.wait_ *= 2;
+	transmit(xid);
+	return;
+      }
+      auto cb (std::move(c.cb_));
+      calls_.erase(xid);
+      errno = ETIMEDOUT;
+      cb(nullptr);
+    });
+}
+
+void
+rpc_udp_sock::recv_msg(msg_ptr b)
+{
+  if (b->size() < 8 || b->word(1) != swap32le(REPLY)) {
+    std::cerr << "rpc_udp_sock: ignoring datagram that is not a reply"
+	      << std::endl;
+    return;
+  }
+  auto calli = calls_.find(b->word(0));
+  if (calli == calls_.end())
+    // Most likely a duplicate reply to a retransmitted call.
+    return;
+  ps_.timeout_cancel(calli->second.to_);
+  auto cb (std::move(calli->second.cb_));
+  calls_.erase(calli);
+  cb(std::move(b));
+}
+
+}
@@ -0,0 +1,128 @@
+// -*- C++ -*-
+
+//! \file dgram.h Send and receive messages as datagrams, and make RPC
+//! calls over UDP.
+
+#ifndef _XDRPP_DGRAM_H_INCLUDED_
+#define _XDRPP_DGRAM_H_INCLUDED_ 1
+
+#include <xdrpp/msgsock.h>
+
+namespace xdr {
+
+//! Send and receive messages as datagrams on a non-blocking socket.
+//! Unlike \c msg_sock, messages carry no length, and each received
+//! message has the sender's address as its \c message_t::peer.
+//! Datagrams are read up to \c batch at a time, and the messages
+//! queued during one PollSet::poll iteration are sent together (with
+//! \c recvmmsg and \c sendmmsg where the system has them).
+class dgram_sock {
+public:
+  static constexpr size_t default_maxmsglen = 0x10000;
+  static constexpr unsigned default_batch = 16;
+  using rcb_t = std::function<void(msg_ptr)>;
+
+  template<typename T> dgram_sock(pollset &ps, sock_t s, T &&rcb,
+				  size_t maxmsglen = default_maxmsglen,
+				  unsigned batch = default_batch)
+    : ps_(ps), s_(s), maxmsglen_(maxmsglen), batch_(batch),
+      rcb_(std::forward<T>(rcb)) {
+    init();
+  }
+  ~dgram_sock();
+  dgram_sock &operator=(dgram_sock &&) = delete;
+
+  //! Queue a message to be sent to \c to, or, if \c to is null, to
+  //! the address the socket is connected to.  Messages that cannot
+  //! be sent (e.g., because they are too large) are dropped.
+  void putmsg(msg_ptr &&m, const sockaddr *to = nullptr);
+
+  sock_t get_sock() const { return s_; }
+  //! Returns pointer to a \c bool that becomes \c true once the
+  //! dgram_sock has been deleted.
+  std::shared_ptr<const bool> destroyed_ptr() const { return destroyed_; }
+
+private:
+  pollset &ps_;
+  const sock_t s_;
+  const size_t maxmsglen_;
+  unsigned batch_;
+  rcb_t rcb_;
+  std::shared_ptr<bool> destroyed_{std::make_shared<bool>(false)};
+
+  // One buffer of maxmsglen_ bytes per datagram in a batch
+  std::unique_ptr<char[]> rbuf_;
+
+  struct wbuf {
+    msg_ptr msg_;
+    sockaddr_storage to_;
+    socklen_t tolen_;
+  };
+  std::vector<wbuf> wqueue_;
+  bool flush_pending_ {false};
+  bool wblocked_ {false};
+
+  void init();
+  void input();
+  void flush();
+};
+
+//! Makes RPC calls over a connected UDP socket (see \c udp_connect),
+//! in the manner of \c rpc_sock.  Since datagrams may be lost, a call
+//! with no reply is sent again, with the wait doubling each time.
+//! After the last try, the callback gets \c nullptr, with \c errno
+//! set to \c ETIMEDOUT.  Calls should be idempotent, as a server may
+//! execute one more than once.
+class rpc_udp_sock {
+public:
+  using rcb_t = msg_sock::rcb_t;
+  static constexpr std::int64_t default_timeout = 500;
+  static constexpr unsigned default_tries = 5;
+
+  rpc_udp_sock(pollset &ps, sock_t s,
+	       size_t maxmsglen = dgram_sock::default_maxmsglen);
+  ~rpc_udp_sock() { abort_all_calls(); }
+
+  //! Wait \c ms milliseconds for the first reply, and send each call
+  //! at most \c tries times.
+  void set_retransmit(std::int64_t ms, unsigned tries) {
+    timeout_ = ms;
+    tries_ = tries;
+  }
+
+  uint32_t get_xid() {
+    while (calls_.find(++xid_) != calls_.end() && xid_ != 0)
+      ;
+    return xid_;
+  }
+
+  //! Send a call, whose xid should come from \c get_xid.  If another
+  //! call with the same xid is still outstanding, that call's
+  //! callback gets \c nullptr, with \c errno set to \c EEXIST.
+  void send_call(msg_ptr &b, rcb_t cb);
+  void send_call(msg_ptr &&b, rcb_t cb) { send_call(b, cb); }
+
+private:
+  struct call {
+    msg_ptr msg_;
+    rcb_t cb_;
+    pollset::Timeout to_;
+    std::int64_t wait_;
+    unsigned tries_;
+  };
+
+  pollset &ps_;
+  uint32_t xid_ {0};
+  std::int64_t timeout_ {default_timeout};
+  unsigned tries_ {default_tries};
+  std::unordered_map<uint32_t, call> calls_;
+  dgram_sock ds_;
+
+  void abort_all_calls();
+  void recv_msg(msg_ptr m);
+  void transmit(uint32_t xid);
+};
+
+} // namespace xdr
+
+#endif // !_XDRPP_DGRAM_H_INCLUDED_
@@ -1,43 +1,316 @@
 
+#include <atomic>
+#include <mutex>
 #include <xdrpp/marshal.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XDRPP_X86_SIMD 1
+#include <immintrin.h>
+#endif // __GNUC__ && x86
+
 namespace xdr {
 
 std::uint32_t marshaling_stack_limit = 0xffffffff;
 
+namespace {
+
+// Pooled buffers are 2^(pool_min_shift + c) bytes for size class c.
+constexpr unsigned pool_min_shift = 6;
+constexpr unsigned pool_nclasses = 11;
+constexpr std::uint8_t pool_none = 0xff;
+// Bytes of each class cached per thread and shared, respectively.
+constexpr std::size_t pool_thread_bytes = 0x40000;
+constexpr std::size_t pool_shared_bytes = 0x400000;
+
+inline std::size_t
+class_size(unsigned c)
+{
+  return std::size_t(1) << (pool_min_shift + c);
+}
+
+// Blocks a thread caches before handing half of them to the shared
+// pool.
+inline std::size_t
+class_max(unsigned c)
+{
+  return std::max(std::size_t(4), pool_thread_bytes / class_size(c));
+}
+
+struct free_block {
+  free_block *next;
+};
+
+struct pool_bin {
+  free_block *head;
+  std::size_t count;
+  void push(void *p) {
+    free_block *b = static_cast<free_block *>(p);
+    b->next = head;
+    head = b;
+    ++count;
+  }
+  void *pop() {
+    free_block *b = head;
+    head = b->next;
+    --count;
+    return b;
+  }
+};
+
+struct shared_pool {
+  std::mutex lock[pool_nclasses];
+  pool_bin bins[pool_nclasses] {};
+  std::atomic<std::size_t> bytes {0};
+
+  // Take up to n blocks, which must then be freed with put.
+  void get(unsigned c, pool_bin &to, std::size_t n) {
+    std::lock_guard<std::mutex> lk(lock[c]);
+    std::size_t i = 0;
+    for (; i < n && bins[c].head; ++i)
+      to.push(bins[c].pop());
+    bytes -= i * class_size(c);
+  }
+  // Move n blocks here, freeing any beyond pool_shared_bytes.
+  void put(unsigned c, pool_bin &from, std::size_t n) {
+    std::lock_guard<std::mutex> lk(lock[c]);
+    std::size_t i = 0;
+    for (; i < n && (bins[c].count + 1) * class_size(c) <= pool_shared_bytes;
+	 ++i)
+      bins[c].push(from.pop());
+    bytes += i * class_size(c);
+    for (; i < n; ++i)
+      std::free(from.pop());
+  }
+};
+
+// Never destroyed, because threads may free messages during exit.
+shared_pool &
+shared()
+{
+  static shared_pool *sp = new shared_pool;
+  return *sp;
+}
+
+// Trivially destructible, so it can still be used (as a pass-through
+// to the shared pool) after thread_pool_flusher runs.
+struct thread_pool {
+  pool_bin bins[pool_nclasses];
+  std::size_t allocs;
+  std::size_t hits;
+  bool exited;
+};
+thread_local thread_pool tpool;
+
+struct thread_pool_flusher {
+  bool used;
+  ~thread_pool_flusher() {
+    for (unsigned c = 0; c < pool_nclasses; ++c)
+      shared().put(c, tpool.bins[c], tpool.bins[c].count);
+    tpool.exited = true;
+  }
+};
+thread_local thread_pool_flusher tflusher;
+
+void *
+pool_alloc(std::size_t n, std::uint8_t &cls)
+{
+  if (n > class_size(pool_nclasses - 1)) {
+    cls = pool_none;
+    return std::malloc(n);
+  }
+  unsigned c = 0;
+  while (class_size(c) < n)
+    ++c;
+  cls = c;
+
+  thread_pool &t = tpool;
+  ++t.allocs;
+  pool_bin &b = t.bins[c];
+  if (!b.head) {
+    if (t.exited) {
+      pool_bin tmp {};
+      shared().get(c, tmp, 1);
+      if (!tmp.head)
+	return std::malloc(class_size(c));
+      ++t.hits;
+      return tmp.pop();
+    }
+    tflusher.used = true;
+    shared().get(c, b, class_max(c) / 2);
+    if (!b.head)
+      return std::malloc(class_size(c));
+  }
+  ++t.hits;
+  return b.pop();
+}
+
+void
+pool_free(void *p, std::uint8_t cls)
+{
+  if (cls == pool_none)
+    return std::free(p);
+  thread_pool &t = tpool;
+  if (t.exited) {
+    pool_bin tmp {};
+    tmp.push(p);
+    return shared().put(cls, tmp, 1);
+  }
+  tflusher.used = true;
+  pool_bin &b = t.bins[cls];
+  b.push(p);
+  if (b.count > class_max(cls))
+    shared().put(cls, b, b.count / 2);
+}
+
+} // namespace
+
 namespace detail {
 void free_message_t::operator()(message_t *p) {
+  std::uint8_t cls = p->pool_class_;
   p->~message_t();
-  free(p);
+  pool_free(p, cls);
 }
 } // namespace detail
 
+message_pool_stats
+message_t::pool_stats()
+{
+  message_pool_stats st { tpool.allocs, tpool.hits, 0,
+			  shared().bytes.load() };
+  for (unsigned c = 0; c < pool_nclasses; ++c)
+    st.thread_bytes += tpool.bins[c].count * class_size(c);
+  return st;
+}
+
+void
+message_t::pool_trim()
+{
+  for (unsigned c = 0; c < pool_nclasses; ++c) {
+    while (tpool.bins[c].head)
+      std::free(tpool.bins[c].pop());
+    shared_pool &sp = shared();
+    std::lock_guard<std::mutex> lk(sp.lock[c]);
+    sp.bytes -= sp.bins[c].count * class_size(c);
+    while (sp.bins[c].head)
+      std::free(sp.bins[c].pop());
+  }
+}
+
+// In RPC (see RFC5531 section 11), the high bit means this is the
+// last record fragment in a record.  If the high bit is clear, it
+// means another fragment follows.  The length stored in front of a
+// message_t always describes a single-fragment record; messages too
+// big for that are split up when sent.
+static inline std::uint32_t
+record_mark(std::size_t size)
+{
+  return size <= max_fragment_len
+    ? swap32le(std::uint32_t(size) | 0x80000000) : 0;
+}
+
 msg_ptr
 message_t::alloc(std::size_t size)
 {
-  // In RPC (see RFC5531 section 11), the high bit means this is the
-  // last record fragment in a record.  If the high bit is clear, it
-  // means another fragment follows.  We don't currently implement
-  // continuation fragments, and instead always set the last-record
-  // bit to produce a single-fragment record.
-  assert(size < 0x80000000);
-  void *raw = std::malloc(offsetof(message_t, buf_[size + 4]));
+  if (size > std::size_t(-1) - offsetof(message_t, buf_) - 4)
+    throw std::bad_alloc();
+  std::uint8_t cls;
+  void *raw = pool_alloc(offsetof(message_t, buf_) + 4 + size, cls);
   if (!raw)
     throw std::bad_alloc();
-  message_t *m = new (raw) message_t (size);
-  *reinterpret_cast<std::uint32_t *>(m->raw_data()) =
-    swap32le(size32(size) | 0x80000000);
+  message_t *m = new (raw) message_t (size, cls);
+  *reinterpret_cast<std::uint32_t *>(m->raw_data()) = record_mark(size);
   return msg_ptr(m);
 }
 
+msg_ptr
+message_t::concat(const std::vector<msg_ptr> &v)
+{
+  std::size_t size = 0;
+  for (const msg_ptr &m : v)
+    size += m->size();
+  msg_ptr r = alloc(size);
+  char *p = r->data();
+  for (const msg_ptr &m : v) {
+    std::memcpy(p, m->data(), m->size());
+    p += m->size();
+  }
+  return r;
+}
+
+void
+message_t::set_peer(const sockaddr *sa, std::size_t len)
+{
+  peer_.reset(static_cast<sockaddr *>(::operator new(len)));
+  std::memcpy(peer_.get(), sa, len);
+}
+
 void
 message_t::shrink(std::size_t newsize)
 {
   if (newsize > size_)
     throw std::out_of_range("message_t::shrink new size bigger than old");
   size_ = newsize;
-  *reinterpret_cast<std::uint32_t *>(raw_data()) =
-    swap32le(size32(newsize) | 0x80000000);
+  *reinterpret_cast<std::uint32_t *>(raw_data()) = record_mark(newsize);
+}
+
+void
+msg_chain::grow(std::uint32_t *&p, std::uint32_t *&e, std::size_t n)
+{
+  finish(p);
+  std::size_t words = (std::max(n, chunk_size_) + 3) / 4;
+  chunks_.push_back(chunk{std::unique_ptr<std::uint32_t[]>(
+	new std::uint32_t[words]), 0});
+  p = chunks_.back().buf.get();
+  e = p + words;
+}
+
+void
+msg_chain::finish(std::uint32_t *p)
+{
+  if (p) {
+    chunk &c = chunks_.back();
+    std::size_t n = reinterpret_cast<char *>(p)
+      - reinterpret_cast<char *>(c.buf.get());
+    size_ += n - c.size;
+    c.size = n;
+  }
+  if (!mark_)
+    mark_.reset(new std::uint32_t);
+  *mark_ = record_mark(size_);
+}
+
+std::size_t
+msg_chain::iov(iovec *v, std::size_t max, std::size_t skip) const
+{
+  std::size_t i = 0;
+  auto add = [&](const void *base, std::size_t len) {
+    if (skip >= len) {
+      skip -= len;
+      return;
+    }
+    v[i].iov_base = const_cast<char *>(static_cast<const char *>(base)) + skip;
+    v[i].iov_len = len - skip;
+    skip = 0;
+    ++i;
+  };
+  static const std::uint32_t empty_mark = record_mark(0);
+  if (max)
+    add(mark_ ? mark_.get() : &empty_mark, sizeof empty_mark);
+  for (auto c = chunks_.begin(); i < max && c != chunks_.end(); ++c)
+    add(c->buf.get(), c->size);
+  return i;
+}
+
+msg_ptr
+msg_chain::flatten() const
+{
+  msg_ptr m = message_t::alloc(size_);
+  char *p = m->data();
+  for (const chunk &c : chunks_) {
+    std::memcpy(p, c.buf.get(), c.size);
+    p += c.size;
+  }
+  return m;
 }
 
 void
@@ -56,6 +329,20 @@ marshal_base::get_bytes(const std::uint32_t *&pr, void *buf, std::size_t len)
   pr = reinterpret_cast<const std::uint32_t *>(p);
 }
 
+void
+marshal_base::skip_bytes(const std::uint32_t *&pr, std::size_t len)
+{
+  if (!len)
+    return;
+  const char *p = reinterpret_cast<const char *>(pr) + len;
+  while (len & 3) {
+    ++len;
+    if (*p++ != '\0')
+      throw xdr_should_be_zero("Non-zero padding bytes encountered");
+  }
+  pr = reinterpret_cast<const std::uint32_t *>(p);
+}
+
 void
 marshal_base::put_bytes(std::uint32_t *&pr, const void *buf, std::size_t len)
 {
@@ -71,4 +358,142 @@ marshal_base::put_bytes(std::uint32_t *&pr, const void *buf, std::size_t len)
   pr = reinterpret_cast<std::uint32_t *>(p);
 }
 
+namespace {
+
+using swapv_t = void (*)(void *, const void *, std::size_t);
+
+void
+swap32v_scalar(void *dst, const void *src, std::size_t n)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  for (; n > 0; --n, d += 4, s += 4) {
+    std::uint32_t v;
+    std::memcpy(&v, s, 4);
+    v = swap32(v);
+    std::memcpy(d, &v, 4);
+  }
+}
+
+void
+swap64v_scalar(void *dst, const void *src, std::size_t n)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  for (; n > 0; --n, d += 8, s += 8) {
+    std::uint64_t v;
+    std::memcpy(&v, s, 8);
+    v = swap64(v);
+    std::memcpy(d, &v, 8);
+  }
+}
+
+#if XDRPP_X86_SIMD
+// The shuffle masks reverse the bytes within each 4- or 8-byte lane.
+// Each routine handles as many whole vectors as it can, then leaves
+// the tail (fewer than 16 or 32 bytes) to the scalar code.
+
+__attribute__((target("ssse3"))) void
+swapv_ssse3(char *&d, const char *&s, std::size_t &nbytes, __m128i mask)
+{
+  for (; nbytes >= 16; nbytes -= 16, d += 16, s += 16)
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(d),
+		     _mm_shuffle_epi8(_mm_loadu_si128(
+		       reinterpret_cast<const __m128i *>(s)), mask));
+}
+
+__attribute__((target("ssse3"))) void
+swap32v_ssse3(void *dst, const void *src, std::size_t n)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  std::size_t nbytes = 4*n;
+  swapv_ssse3(d, s, nbytes, _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+					 4, 5, 6, 7, 0, 1, 2, 3));
+  swap32v_scalar(d, s, nbytes/4);
+}
+
+__attribute__((target("ssse3"))) void
+swap64v_ssse3(void *dst, const void *src, std::size_t n)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  std::size_t nbytes = 8*n;
+  swapv_ssse3(d, s, nbytes, _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+					 0, 1, 2, 3, 4, 5, 6, 7));
+  swap64v_scalar(d, s, nbytes/8);
+}
+
+__attribute__((target("avx2"))) void
+swapv_avx2(char *&d, const char *&s, std::size_t &nbytes, __m256i mask)
+{
+  for (; nbytes >= 32; nbytes -= 32, d += 32, s += 32)
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d),
+			_mm256_shuffle_epi8(_mm256_loadu_si256(
+			  reinterpret_cast<const __m256i *>(s)), mask));
+}
+
+__attribute__((target("avx2"))) void
+swap32v_avx2(void *dst, const void *src, std::size_t n)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  std::size_t nbytes = 4*n;
+  // _mm256_shuffle_epi8 shuffles within each 128-bit half.
+  swapv_avx2(d, s, nbytes,
+	     _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+			     12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+  swap32v_scalar(d, s, nbytes/4);
+}
+
+__attribute__((target("avx2"))) void
+swap64v_avx2(void *dst, const void *src, std::size_t n)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  std::size_t nbytes = 8*n;
+  swapv_avx2(d, s, nbytes,
+	     _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+			     8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7));
+  swap64v_scalar(d, s, nbytes/8);
+}
+
+swapv_t
+pick_swapv(swapv_t avx2, swapv_t ssse3, swapv_t scalar)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return ssse3;
+  return scalar;
+}
+#endif // XDRPP_X86_SIMD
+
+} // namespace
+
+void
+marshal_swap::swap32v(void *dst, const void *src, std::size_t n)
+{
+#if XDRPP_X86_SIMD
+  static const swapv_t impl =
+    pick_swapv(swap32v_avx2, swap32v_ssse3, swap32v_scalar);
+#else // !XDRPP_X86_SIMD
+  static const swapv_t impl = swap32v_scalar;
+#endif // !XDRPP_X86_SIMD
+  impl(dst, src, n);
+}
+
+void
+marshal_swap::swap64v(void *dst, const void *src, std::size_t n)
+{
+#if XDRPP_X86_SIMD
+  static const swapv_t impl =
+    pick_swapv(swap64v_avx2, swap64v_ssse3, swap64v_scalar);
+#else // !XDRPP_X86_SIMD
+  static const swapv_t impl = swap64v_scalar;
+#endif // !XDRPP_X86_SIMD
+  impl(dst, src, n);
+}
+
 }
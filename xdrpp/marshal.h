@@ -40,6 +40,9 @@ struct marshal_base {
   //! Copy \c len bytes from buf, then add 0-3 zero-valued padding
   //! bytes to make the overall marshaled length a multiple of 4.
   static void put_bytes(std::uint32_t *&pr, const void *buf, std::size_t len);
+  //! Like \c get_bytes, but skip over the \c len bytes instead of
+  //! copying them anywhere.
+  static void skip_bytes(const std::uint32_t *&pr, std::size_t len);
 };
 
 //! Numeric marshaling mixin that does not byteswap any numeric values
@@ -58,6 +61,27 @@ struct marshal_noswap : marshal_base {
     u.u32[1] = *p++;
     return u.u64;
   }
+
+  //! Marshal a run of \c n 32-bit values stored at \c v.
+  static void put32v(std::uint32_t *&p, const void *v, std::size_t n) {
+    std::memcpy(p, v, 4*n);
+    p += n;
+  }
+  //! Marshal a run of \c n 64-bit values stored at \c v.
+  static void put64v(std::uint32_t *&p, const void *v, std::size_t n) {
+    std::memcpy(p, v, 8*n);
+    p += 2*n;
+  }
+  //! Unmarshal a run of \c n 32-bit values into \c v.
+  static void get32v(const std::uint32_t *&p, void *v, std::size_t n) {
+    std::memcpy(v, p, 4*n);
+    p += n;
+  }
+  //! Unmarshal a run of \c n 64-bit values into \c v.
+  static void get64v(const std::uint32_t *&p, void *v, std::size_t n) {
+    std::memcpy(v, p, 8*n);
+    p += 2*n;
+  }
 };
 
 //! Numeric marshaling mixin that byteswaps all numeric values (thus
@@ -77,8 +101,126 @@ struct marshal_swap : marshal_base {
     u.u32[0] = swap32(*p++);
     return u.u64;
   }
+
+  //! Byteswap a run of \c n 32-bit values from \c src to \c dst.
+  //! Uses SSSE3 or AVX2 shuffles when the CPU supports them.
+  static void swap32v(void *dst, const void *src, std::size_t n);
+  //! Byteswap a run of \c n 64-bit values from \c src to \c dst.
+  static void swap64v(void *dst, const void *src, std::size_t n);
+
+  static void put32v(std::uint32_t *&p, const void *v, std::size_t n) {
+    swap32v(p, v, n);
+    p += n;
+  }
+  static void put64v(std::uint32_t *&p, const void *v, std::size_t n) {
+    swap64v(p, v, n);
+    p += 2*n;
+  }
+  static void get32v(const std::uint32_t *&p, void *v, std::size_t n) {
+    swap32v(v, p, n);
+    p += n;
+  }
+  static void get64v(const std::uint32_t *&p, void *v, std::size_t n) {
+    swap64v(v, p, n);
+    p += 2*n;
+  }
 };
 
+namespace detail {
+//! True for 32- and 64-bit numeric and enum types whose in-memory
+//! representation is exactly their \c uint_type (so excludes \c
+//! bool).
+template<typename T, bool = (xdr_traits<T>::is_numeric
+			     || xdr_traits<T>::is_enum)>
+struct is_numeric_elem : std::false_type {};
+template<typename T> struct is_numeric_elem<T, true>
+  : std::integral_constant<bool, (sizeof(T) ==
+				  sizeof(typename xdr_traits<T>::uint_type))> {};
+
+//! True for an \c xvector or \c xarray of numeric values, which can
+//! be marshaled as a single run with only one bounds check.
+template<typename T> struct is_numeric_run : std::false_type {};
+template<typename T, std::uint32_t N, typename A>
+struct is_numeric_run<xvector<T,N,A>>
+  : is_numeric_elem<T> {};
+template<typename T, std::uint32_t N> struct is_numeric_run<xarray<T,N>>
+  : is_numeric_elem<T> {};
+
+//! Archive used by \c xdr_generic_put for the contents of a
+//! fixed-size type, after checking once that the whole type fits in
+//! the buffer.  Performs no bounds checks of its own.
+template<typename Base> struct xdr_unchecked_put : Base {
+  std::uint32_t *&p_;
+  explicit xdr_unchecked_put(std::uint32_t *&p) : p_(p) {}
+
+  template<typename T> typename std::enable_if<
+    std::is_same<std::uint32_t, typename xdr_traits<T>::uint_type>::value>::type
+  operator()(T t) { Base::put32(p_, xdr_traits<T>::to_uint(t)); }
+
+  template<typename T> typename std::enable_if<
+    std::is_same<std::uint64_t, typename xdr_traits<T>::uint_type>::value>::type
+  operator()(T t) { Base::put64(p_, xdr_traits<T>::to_uint(t)); }
+
+  template<typename T> typename std::enable_if<xdr_traits<T>::is_bytes>::type
+  operator()(const T &t) {
+    static_assert(!xdr_traits<T>::variable_nelem,
+		  "variable-length bytes in fixed-size type");
+    Base::put_bytes(p_, t.data(), t.size());
+  }
+
+  template<typename T> typename std::enable_if<
+    is_numeric_run<T>::value>::type
+  operator()(const T &t) {
+    if (sizeof(typename xdr_traits<typename T::value_type>::uint_type) == 4)
+      Base::put32v(p_, t.data(), t.size());
+    else
+      Base::put64v(p_, t.data(), t.size());
+  }
+
+  template<typename T> typename std::enable_if<
+    (xdr_traits<T>::is_class || xdr_traits<T>::is_container)
+    && !is_numeric_run<T>::value>::type
+  operator()(const T &t) { xdr_traits<T>::save(*this, t); }
+};
+
+//! Archive used by \c xdr_generic_get for the contents of a
+//! fixed-size type, after checking once that the whole type is
+//! present in the buffer.  Performs no bounds checks of its own.
+template<typename Base> struct xdr_unchecked_get : Base {
+  const std::uint32_t *&p_;
+  explicit xdr_unchecked_get(const std::uint32_t *&p) : p_(p) {}
+
+  template<typename T> typename std::enable_if<
+    std::is_same<std::uint32_t, typename xdr_traits<T>::uint_type>::value>::type
+  operator()(T &t) { t = xdr_traits<T>::from_uint(Base::get32(p_)); }
+
+  template<typename T> typename std::enable_if<
+    std::is_same<std::uint64_t, typename xdr_traits<T>::uint_type>::value>::type
+  operator()(T &t) { t = xdr_traits<T>::from_uint(Base::get64(p_)); }
+
+  template<typename T> typename std::enable_if<xdr_traits<T>::is_bytes>::type
+  operator()(T &t) {
+    static_assert(!xdr_traits<T>::variable_nelem,
+		  "variable-length bytes in fixed-size type");
+    Base::get_bytes(p_, t.data(), t.size());
+  }
+
+  template<typename T> typename std::enable_if<
+    is_numeric_run<T>::value>::type
+  operator()(T &t) {
+    if (sizeof(typename xdr_traits<typename T::value_type>::uint_type) == 4)
+      Base::get32v(p_, t.data(), t.size());
+    else
+      Base::get64v(p_, t.data(), t.size());
+  }
+
+  template<typename T> typename std::enable_if<
+    (xdr_traits<T>::is_class || xdr_traits<T>::is_container)
+    && !is_numeric_run<T>::value>::type
+  operator()(T &t) { xdr_traits<T>::load(*this, t); }
+};
+} // namespace detail
+
 //! Archive type for marshaling to a buffer.  Depending on the `Base`
 //! type, will marshal in either big- or little-endian order.
 template<typename Base> struct xdr_generic_put : Base {
@@ -127,13 +269,43 @@ template<typename Base> struct xdr_generic_put : Base {
   }
 
   template<typename T> typename std::enable_if<
-    xdr_traits<T>::is_class || xdr_traits<T>::is_container>::type
+    detail::is_numeric_run<T>::value>::type
+  operator()(const T &t) {
+    constexpr std::size_t width =
+      sizeof(typename xdr_traits<typename T::value_type>::uint_type);
+    if (xdr_traits<T>::variable_nelem) {
+      check(4 + width * t.size());
+      put32(p_, size32(t.size()));
+    }
+    else
+      check(width * t.size());
+    if (width == 4)
+      Base::put32v(p_, t.data(), t.size());
+    else
+      Base::put64v(p_, t.data(), t.size());
+  }
+
+  template<typename T> typename std::enable_if<
+    (xdr_traits<T>::is_class || xdr_traits<T>::is_container)
+    && !detail::is_numeric_run<T>::value>::type
   operator()(const T &t) {
     if (!marshal_base::stack_limit--)
       throw xdr_stack_overflow("stack overflow in xdr_generic_put");
-    xdr_traits<T>::save(*this, t);
+    save(t, std::integral_constant<bool, xdr_traits<T>::has_fixed_size>{});
     ++marshal_base::stack_limit;
   }
+
+private:
+  template<typename T> void save(const T &t, std::false_type) {
+    xdr_traits<T>::save(*this, t);
+  }
+  // The size of a fixed-size type is known at compile time, so check
+  // it once and marshal the fields with no further bounds checks.
+  template<typename T> void save(const T &t, std::true_type) {
+    check(xdr_traits<T>::fixed_size);
+    detail::xdr_unchecked_put<Base> u(p_);
+    xdr_traits<T>::save(u, t);
+  }
 };
 
 //! Archive type for unmarshaling from a buffer.  Depending on the
@@ -146,6 +318,9 @@ template<typename Base> struct xdr_generic_get : Base {
 
   const std::uint32_t *p_;
   const std::uint32_t *const e_;
+  //! Set once a view (\c xdr::opaque_view or \c xdr::xstring_view)
+  //! pointing into the buffer has been unmarshaled.
+  bool borrowed_ = false;
 
   // Set the buffer to marshal from.  Both \c start and \c end must be
   // 4-byte aligned.
@@ -163,9 +338,14 @@ template<typename Base> struct xdr_generic_get : Base {
   xdr_generic_get(const msg_ptr &m)
     : xdr_generic_get(m->data(), m->end()) {}
 
+  //! Bytes of input not yet consumed.
+  std::size_t remaining() const {
+    return reinterpret_cast<const char *>(e_)
+      - reinterpret_cast<const char *>(p_);
+  }
+
   void check(std::size_t n) const {
-    if (n > std::size_t(reinterpret_cast<const char *>(e_)
-			- reinterpret_cast<const char *>(p_)))
+    if (n > remaining())
       throw xdr_overflow("insufficient buffer space in xdr_generic_get");
   }
 
@@ -177,25 +357,57 @@ template<typename Base> struct xdr_generic_get : Base {
     std::is_same<std::uint64_t, typename xdr_traits<T>::uint_type>::value>::type
   operator()(T &t) { check(8); t = xdr_traits<T>::from_uint(get64(p_)); }
 
-  template<typename T> typename std::enable_if<xdr_traits<T>::is_bytes>::type
+  template<typename T> typename std::enable_if<
+    xdr_traits<T>::is_bytes && !detail::is_bytes_view<T>::value>::type
+  operator()(T &t) {
+    load_bytes(t, std::integral_constant<bool,
+			 xdr_traits<T>::variable_nelem>{});
+  }
+
+  // Views point into the buffer rather than copying out of it.
+  template<typename T> typename std::enable_if<
+    detail::is_bytes_view<T>::value>::type
+  operator()(T &t) {
+    check(4);
+    std::uint32_t size = get32(p_);
+    check(size);
+    t = T(reinterpret_cast<const typename T::value_type *>(p_), size);
+    Base::skip_bytes(p_, size);
+    borrowed_ = true;
+  }
+
+  template<typename T> typename std::enable_if<
+    detail::is_numeric_run<T>::value>::type
   operator()(T &t) {
+    constexpr std::size_t width =
+      sizeof(typename xdr_traits<typename T::value_type>::uint_type);
+    std::uint32_t n;
     if (xdr_traits<T>::variable_nelem) {
       check(4);
-      std::uint32_t size = get32(p_);
-      check(size);
-      t.resize(size);
+      n = get32(p_);
+      t.check_size(n);
+      // Divide rather than multiply, as n comes from untrusted input.
+      if (n > remaining() / width)
+	throw xdr_overflow("insufficient buffer space in xdr_generic_get");
+      t.resize(n);
     }
+    else {
+      n = size32(t.size());
+      check(width * n);
+    }
+    if (width == 4)
+      Base::get32v(p_, t.data(), n);
     else
-      check(t.size());
-    get_bytes(p_, t.data(), t.size());
+      Base::get64v(p_, t.data(), n);
   }
 
   template<typename T> typename std::enable_if<
-    xdr_traits<T>::is_class || xdr_traits<T>::is_container>::type
+    (xdr_traits<T>::is_class || xdr_traits<T>::is_container)
+    && !detail::is_numeric_run<T>::value>::type
   operator()(T &t) {
     if (!marshal_base::stack_limit--)
       throw xdr_stack_overflow("stack overflow in xdr_generic_get");
-    xdr_traits<T>::load(*this, t);
+    load(t, std::integral_constant<bool, xdr_traits<T>::has_fixed_size>{});
     ++marshal_base::stack_limit;
   }
 
@@ -203,16 +415,130 @@ template<typename Base> struct xdr_generic_get : Base {
     if (p_ != e_)
       throw xdr_bad_message_size("unmarshaling did not consume whole message");
   }
+
+private:
+  template<typename T> void load_bytes(T &t, std::true_type) {
+    check(4);
+    std::uint32_t size = get32(p_);
+    check(size);
+    t.check_size(size);
+    // Copy straight from the buffer, rather than having resize
+    // zero-fill memory that is about to be overwritten.
+    const auto *src = reinterpret_cast<const typename T::value_type *>(p_);
+    t.assign(src, src + size);
+    Base::skip_bytes(p_, size);
+  }
+  template<typename T> void load_bytes(T &t, std::false_type) {
+    check(t.size());
+    get_bytes(p_, t.data(), t.size());
+  }
+
+  template<typename T> void load(T &t, std::false_type) {
+    xdr_traits<T>::load(*this, t);
+  }
+  // See xdr_generic_put::save.
+  template<typename T> void load(T &t, std::true_type) {
+    check(xdr_traits<T>::fixed_size);
+    detail::xdr_unchecked_get<Base> u(p_);
+    xdr_traits<T>::load(u, t);
+  }
+};
+
+//! Archive type for marshaling to an \c xdr::msg_chain in a single
+//! pass, without first computing the size with \c xdr::xdr_size.
+//! Whenever the current chunk is too small for the next value, a new
+//! chunk is appended.  Values are never split across chunks, so
+//! fixed-size types still get a single bounds check.  Call \c done()
+//! when finished.
+template<typename Base> struct xdr_generic_chain_put : Base {
+  using Base::put32;
+  using Base::put64;
+  using Base::put_bytes;
+
+  msg_chain &c_;
+  std::uint32_t *p_ {nullptr};
+  std::uint32_t *e_ {nullptr};
+
+  explicit xdr_generic_chain_put(msg_chain &c) : c_(c) {}
+
+  //! Ensure the next \c n bytes are available contiguously.
+  void check(std::size_t n) {
+    if (n > std::size_t(reinterpret_cast<char *>(e_)
+			- reinterpret_cast<char *>(p_)))
+      c_.grow(p_, e_, n);
+  }
+  void done() { c_.finish(p_); }
+
+  template<typename T> typename std::enable_if<
+    std::is_same<std::uint32_t, typename xdr_traits<T>::uint_type>::value>::type
+  operator()(T t) { check(4); put32(p_, xdr_traits<T>::to_uint(t)); }
+
+  template<typename T> typename std::enable_if<
+    std::is_same<std::uint64_t, typename xdr_traits<T>::uint_type>::value>::type
+  operator()(T t) { check(8); put64(p_, xdr_traits<T>::to_uint(t)); }
+
+  template<typename T> typename std::enable_if<xdr_traits<T>::is_bytes>::type
+  operator()(const T &t) {
+    std::size_t n = (t.size() + 3) & ~std::size_t(3);
+    if (xdr_traits<T>::variable_nelem) {
+      check(4 + n);
+      put32(p_, size32(t.size()));
+    }
+    else
+      check(n);
+    put_bytes(p_, t.data(), t.size());
+  }
+
+  template<typename T> typename std::enable_if<
+    detail::is_numeric_run<T>::value>::type
+  operator()(const T &t) {
+    constexpr std::size_t width =
+      sizeof(typename xdr_traits<typename T::value_type>::uint_type);
+    if (xdr_traits<T>::variable_nelem) {
+      check(4 + width * t.size());
+      put32(p_, size32(t.size()));
+    }
+    else
+      check(width * t.size());
+    if (width == 4)
+      Base::put32v(p_, t.data(), t.size());
+    else
+      Base::put64v(p_, t.data(), t.size());
+  }
+
+  template<typename T> typename std::enable_if<
+    (xdr_traits<T>::is_class || xdr_traits<T>::is_container)
+    && !detail::is_numeric_run<T>::value>::type
+  operator()(const T &t) {
+    if (!marshal_base::stack_limit--)
+      throw xdr_stack_overflow("stack overflow in xdr_generic_chain_put");
+    save(t, std::integral_constant<bool, xdr_traits<T>::has_fixed_size>{});
+    ++marshal_base::stack_limit;
+  }
+
+private:
+  template<typename T> void save(const T &t, std::false_type) {
+    xdr_traits<T>::save(*this, t);
+  }
+  template<typename T> void save(const T &t, std::true_type) {
+    check(xdr_traits<T>::fixed_size);
+    detail::xdr_unchecked_put<Base> u(p_);
+    xdr_traits<T>::save(u, t);
+  }
 };
 
 #if XDRPP_WORDS_BIGENDIAN
 using xdr_put = xdr_generic_put<marshal_noswap>;
 using xdr_get = xdr_generic_get<marshal_noswap>;
+using xdr_chain_put = xdr_generic_chain_put<marshal_noswap>;
 #else // !XDRPP_WORDS_BIGENDIAN
 //! Archive for marshaling in RFC4506 big-endian order.
 using xdr_put = xdr_generic_put<marshal_swap>;
 //! Archive for unmarshaling in RFC4506 big-endian order.
 using xdr_get = xdr_generic_get<marshal_swap>;
+//! Archive for single-pass marshaling to an \c xdr::msg_chain in
+//! RFC4506 big-endian order.
+using xdr_chain_put = xdr_generic_chain_put<marshal_swap>;
 #endif // !XDRPP_WORDS_BIGENDIAN
 
 inline std::size_t
@@ -254,6 +580,21 @@ xdr_to_msg(const Args &...args)
   return m;
 }
 
+//! Like \c xdr::xdr_to_msg, but marshals into a chain of chunks in a
+//! single pass, rather than traversing the arguments once to compute
+//! their size and again to marshal them.  Produces exactly the same
+//! bytes.  This is faster for large, deeply nested values, which can
+//! be sent directly with \c xdr::msg_sock::putmsg.
+template<typename...Args> msg_chain
+xdr_to_chain(const Args &...args)
+{
+  msg_chain c;
+  xdr_chain_put p (c);
+  xdr_argpack_archive(p, args...);
+  p.done();
+  return c;
+}
+
 //! Marshal one or a series of XDR types into a newly allocated opaque
 //! structure for embedding in other XDR types.
 template<typename...Args> opaque_vec<>
@@ -267,15 +608,30 @@ xdr_to_opaque(const Args &...args)
 }
 
 
+namespace detail {
+//! Unmarshal \c args from \c g and, if \c Whole, check that the
+//! input is used up.  \throws xdr_runtime_error on malformed input.
+//! This is the one decoder behind both \c xdr::xdr_from_msg and the
+//! non-throwing \c xdr::xdr_try_from_msg (see \c xdrpp/skip.h), which
+//! checks the input before calling it.
+template<bool Whole, typename...Args> inline void
+get_args(xdr_get &g, Args &...args)
+{
+  xdr_argpack_archive(g, args...);
+  if (Whole)
+    g.done();
+}
+} // namespace detail
+
 //! This does the reverse of xdr::xdr_to_msg, unmarshalling one or
 //! more types from a message.  Note that it throws an exception if
-//! the entire buffer is not consumed.
+//! the entire buffer is not consumed.  See \c xdr::xdr_try_from_msg
+//! for a version that reports errors without throwing.
 template<typename...Args> void
 xdr_from_msg(const msg_ptr &m, Args &...args)
 {
   xdr_get g(m);
-  xdr_argpack_archive(g, args...);
-  g.done();
+  detail::get_args<true>(g, args...);
 }
 
 namespace detail {
@@ -296,8 +652,7 @@ xdr_from_opaque(const Bytes &m, Args &...args)
   -> decltype(detail::bytes_to_void(m))
 {
   xdr_get g(m.data(), m.data()+m.size());
-  xdr_argpack_archive(g, args...);
-  g.done();
+  detail::get_args<true>(g, args...);
 }
 
 }
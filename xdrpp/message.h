@@ -8,6 +8,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <vector>
 #include <xdrpp/endian.h>
 #include <xdrpp/socket.h>
 
@@ -25,16 +26,41 @@ struct free_message_t {
 } // namespace detail
 using msg_ptr = std::unique_ptr<message_t, detail::free_message_t>;
 
+//! Largest record fragment length.  In RPC (see RFC5531 section 11),
+//! the high bit of the 4-byte length marks the last fragment of a
+//! record, so a fragment holds at most \c 0x7fffffff bytes.
+constexpr std::size_t max_fragment_len = 0x7fffffff;
+//! Most fragments accepted in one received record.  Fragments may be
+//! empty, so the total length alone does not bound their number.
+constexpr std::size_t max_record_fragments = 0x10000;
+
+//! Statistics on the pool from which \c message_t buffers are
+//! allocated.
+struct message_pool_stats {
+  std::size_t allocs;		//!< Pool-sized allocations by this thread
+  std::size_t hits;		//!< How many of those reused a buffer
+  std::size_t thread_bytes;	//!< Bytes cached by this thread
+  std::size_t shared_bytes;	//!< Bytes cached for use by any thread
+};
+
 //! Message buffer, with room at beginning for 4-byte length.  Note
 //! the constructor is private, so you must create one with \c
 //! message_t::alloc, which allocates more space than the size of the
 //! \c message_t structure.  Hence \c message_t is just a data
 //! structure at the beginning of the buffer.
+//!
+//! Buffers of up to 64 KiB come from a pool with power-of-two size
+//! classes.  Each thread caches freed buffers of each class, and
+//! hands some to a shared cache when it has too many, so buffers
+//! freed by one thread can be reused by another.
 class message_t {
   std::unique_ptr<sockaddr> peer_;
   std::size_t size_;
+  std::uint8_t pool_class_;
   alignas(std::uint32_t) char buf_[4];
-  message_t(std::size_t size) : size_(size) {}
+  message_t(std::size_t size, std::uint8_t pool_class)
+    : size_(size), pool_class_(pool_class) {}
+  friend struct detail::free_message_t;
 public:
   std::size_t size() const { return size_; }
   void shrink(std::size_t newsize);
@@ -48,7 +74,11 @@ public:
   char *end() { return buf_ + 4 + size_; }
   const char *end() const { return buf_ + 4 + size_; }
 
-  //! 4-byte buffer to store size in network byte order, followed by data.
+  //! 4-byte buffer to store size in network byte order, followed by
+  //! data.  The length marks a single-fragment record, so is only
+  //! meaningful if <tt>size() <= max_fragment_len</tt>; larger
+  //! messages must be sent as several fragments (as \c msg_sock and
+  //! \c write_message do).
   char *raw_data() { return buf_; }
   const char *raw_data() const { return buf_; }
   //! Size of 4-byte length plus data.
@@ -58,14 +88,79 @@ public:
   const sockaddr *peer() const { return peer_.get(); }
   //! Returns unique_ptr to peer address so it can be set/moved.
   std::unique_ptr<sockaddr> &&unique_peer() { return std::move(peer_); }
+  //! Set the peer address to a copy of \c sa, which is \c len bytes.
+  void set_peer(const sockaddr *sa, std::size_t len);
 
   //! Allocate a new buffer.
   static msg_ptr alloc(std::size_t size);
+  //! Allocate a new buffer holding the data of each message in \c v
+  //! in turn, e.g., to reassemble the fragments of a record.
+  static msg_ptr concat(const std::vector<msg_ptr> &v);
+
+  //! Statistics on the buffer pool.
+  static message_pool_stats pool_stats();
+  //! Free all cached buffers held by this thread or shared.
+  static void pool_trim();
 };
 
 static_assert(std::is_standard_layout<message_t>::value,
 	      "message_t should be standard layout");
 
+//! A message stored as a chain of separately allocated chunks, as
+//! produced by \c xdr::xdr_to_chain.  Unlike a \c message_t, the
+//! size need not be known before marshaling starts.  The chain is
+//! transmitted (with the same 4-byte length as \c message_t) by
+//! handing the iovecs returned by \c msg_chain::iov to \c writev.
+class msg_chain {
+  struct chunk {
+    std::unique_ptr<std::uint32_t[]> buf;
+    std::size_t size;		// Bytes used
+  };
+  std::vector<chunk> chunks_;
+  std::size_t chunk_size_;
+  std::size_t size_ {0};
+  // On the heap, so that iovecs pointing at it stay valid when the
+  // chain is moved (e.g., while a zero-copy send is outstanding).
+  // Null until the first finish.
+  std::unique_ptr<std::uint32_t> mark_;
+
+public:
+  static constexpr std::size_t default_chunk_size = 0x2000;
+
+  //! Chunks are \c chunk_size bytes, except that a single value too
+  //! large for one chunk gets a chunk of its own.
+  explicit msg_chain(std::size_t chunk_size = default_chunk_size)
+    : chunk_size_((chunk_size + 3) & ~std::size_t(3)) {
+    assert(chunk_size_ > 0);
+  }
+  msg_chain(msg_chain &&) = default;
+  msg_chain &operator=(msg_chain &&) = default;
+
+  //! Size of the marshaled data (not including the 4-byte length).
+  std::size_t size() const { return size_; }
+  //! Size of 4-byte length plus data.
+  std::size_t raw_size() const { return size_ + 4; }
+  std::size_t nchunks() const { return chunks_.size(); }
+  //! Number of iovecs needed to describe the whole raw message.
+  std::size_t iovcnt() const { return chunks_.size() + 1; }
+
+  //! Fill in at most \c max iovecs describing the raw message (length
+  //! followed by data), starting \c skip bytes in.  Returns the
+  //! number of iovecs used.
+  std::size_t iov(iovec *v, std::size_t max, std::size_t skip = 0) const;
+
+  //! Copy the data into a single contiguous \c message_t.
+  msg_ptr flatten() const;
+
+  //! Used by \c xdr::xdr_generic_chain_put.  Ends the current chunk
+  //! (if \c p is not null) at \c p, and sets \c p and \c e to the
+  //! bounds of a fresh chunk that has room for at least \c n bytes.
+  void grow(std::uint32_t *&p, std::uint32_t *&e, std::size_t n);
+  //! Used by \c xdr::xdr_generic_chain_put.  Ends the current chunk
+  //! (if \c p is not null) at \c p, and updates the length.
+  void finish(std::uint32_t *p);
+};
+
 }
 
 #endif // !_XDRPP_MESSAGE_H_HEADER_INCLUDED_
@@ -1,19 +1,56 @@
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define XDRPP_ZEROCOPY 1
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif // __linux__ && MSG_ZEROCOPY && SO_ZEROCOPY
+
 #include <xdrpp/msgsock.h>
 #include <xdrpp/rpc_msg.hh>
 #include <xdrpp/server.h>
 
 namespace xdr {
 
+namespace {
+#ifdef IOV_MAX
+constexpr size_t maxiov = IOV_MAX;
+#else // !IOV_MAX
+constexpr size_t maxiov = 16;
+#endif // !IOV_MAX
+
+// Reads per call to input, so that a busy socket cannot starve the
+// rest of the pollset.  Reading from a shm_link makes no system
+// call, so can go on longer.
+constexpr int input_rounds = 3;
+constexpr int shm_input_rounds = 64;
+}
+
+// An io_uring send in progress, which the kernel may read until the
+// send completes.
+struct msg_sock::uwrite {
+  msghdr mh;
+  iovec iov[maxiov];
+};
+
 msg_sock::~msg_sock()
 {
+  if (rop_)
+    ring_->release(rop_);
+  if (wop_)
+    ring_->release(wop_, uring_keep());
+  if (shm_)
+    ps_.fd_cb(shm_->doorbell(), pollset::Read);
   ps_.fd_cb(s_, pollset::ReadWrite);
   close(s_);
   *destroyed_ = true;
@@ -29,93 +66,304 @@ msg_sock::init()
 void
 msg_sock::initcb()
 {
-  if (rcb_)
+  if (shm_)
+    shm_initcb();
+  else if (ring_) {
+    if (rcb_ && !rpaused_) {
+      if (!rop_ && !rfail_)
+	uring_recv();
+    }
+    else if (rop_)
+      ring_->cancel(rop_);
+  }
+  else if (rcb_ && !rpaused_)
     ps_.fd_cb(s_, pollset::Read, [this](){ input(); });
   else
     ps_.fd_cb(s_, pollset::Read);
 }
 
+void
+msg_sock::set_rbufsize(size_t n)
+{
+  assert(!rdmsg_ && !rdpos_ && rbeg_ == rend_);
+  assert(n == 0 || n >= 8);
+  rbufsize_ = n;
+  if (n)
+    rbuf_.reset(new char[n]);
+  else
+    rbuf_.reset();
+  rbeg_ = rend_ = 0;
+}
+
+void
+msg_sock::pause_input()
+{
+  rpaused_ = true;
+  initcb();
+}
+
+void
+msg_sock::resume_input()
+{
+  if (!rpaused_)
+    return;
+  rpaused_ = false;
+  initcb();
+  if (ring_) {
+    if ((rbuf_ && rend_ - rbeg_ >= 4) || !rstash_.empty() || rerr_ != 1)
+      ps_.defer_cb([this,destroyed=destroyed_]() {
+	  if (!*destroyed && !rpaused_ && rcb_)
+	    uring_resume();
+	});
+    return;
+  }
+  if (shm_)
+    // The peer only rings the doorbell when asked to.
+    shm_->wake_self();
+  // Messages already in the buffer won't make the socket readable.
+  if (rbuf_ && rend_ - rbeg_ >= 4)
+    ps_.defer_cb([this,destroyed=destroyed_]() {
+	if (!*destroyed && !rpaused_ && rcb_)
+	  input_records(destroyed);
+      });
+}
+
 void
 msg_sock::input()
 {
+  if (!zcdone_.empty())
+    zc_reap();
+  if (rbuf_)
+    return input_buffered();
+
   std::shared_ptr<bool> destroyed{destroyed_};
-  for (int i = 0; i < 3 && !*destroyed; i++) {
+  int rounds = shm_ ? shm_input_rounds : input_rounds;
+  for (int i = 0; i < rounds && !*destroyed && !rpaused_; i++) {
     if (rdmsg_) {
       iovec iov[2];
       iov[0].iov_base = rdmsg_->data() + rdpos_;
       iov[0].iov_len = rdmsg_->size() - rdpos_;
       iov[1].iov_base = nextlenp();
       iov[1].iov_len = sizeof nextlen_;
-      ssize_t n = readv(s_, iov, 2);
-      if (n <= 0) {
-	if (n < 0 && eagain(errno))
-	  return;
-	if (n == 0)
-	  errno = ECONNRESET;
-	else
-	  std::cerr << "msg_sock::input: " << sock_errmsg() << std::endl;
-	rcb_(nullptr);
-	return;
-      }
+      ssize_t n = rawreadv(iov, 2);
+      if (n <= 0)
+	return input_error(n, true);
       rdpos_ += n;
       if (rdpos_ >= rdmsg_->size()) {
 	rdpos_ -= rdmsg_->size();
-	rcb_(std::move(rdmsg_));
+	deliver(std::move(rdmsg_), rdlast_);
 	if (*destroyed)
 	  return;
       }
     }
     else if (rdpos_ < sizeof nextlen_) {
-      ssize_t n = read(s_, nextlenp() + rdpos_, sizeof nextlen_ - rdpos_);
-      if (n <= 0) {
-	if (n < 0 && eagain(errno))
-	  return;
-	if (n == 0)
-	  errno = rdpos_ ? ECONNRESET : 0;
-	else
-	  std::cerr << "msg_sock::input: " << sock_errmsg() << std::endl;
-	rcb_(nullptr);
-	return;
-      }
+      iovec iov;
+      iov.iov_base = nextlenp() + rdpos_;
+      iov.iov_len = sizeof nextlen_ - rdpos_;
+      ssize_t n = rawreadv(&iov, 1);
+      if (n <= 0)
+	return input_error(n, rdpos_);
       rdpos_ += n;
     }
 
     if (rdmsg_ || rdpos_ < sizeof nextlen_)
       return;
     size_t len = nextlen();
-    if (!(len & 0x80000000)) {
-      std::cerr << "msgsock: message fragments unimplemented" << std::endl;
-      errno = ECONNRESET;
-      rcb_(nullptr);
-      return;
-    }
+    bool last = len & 0x80000000;
     len &= 0x7fffffff;
+    if (!check_fraglen(len))
+      return;
     if (!len) {
       rdpos_ = 0;
-      rcb_(message_t::alloc(0));
+      deliver(message_t::alloc(0), last);
       continue;
     }
 
-    if (len <= maxmsglen_) {
-      // Length comes from untrusted source; don't crash if can't alloc
-      try { rdmsg_ = message_t::alloc(len); }
-      catch (const std::bad_alloc &) {
-	std::cerr << "msg_sock: allocation of " << len << "-byte message failed"
-		  << std::endl;
-      }
-    }
-    else {
-      std::cerr << "msg_sock: rejecting " << len << "-byte message (too long)"
+    // Length comes from untrusted source; don't crash if can't alloc
+    try { rdmsg_ = message_t::alloc(len); }
+    catch (const std::bad_alloc &) {
+      std::cerr << "msg_sock: allocation of " << len << "-byte message failed"
 		<< std::endl;
-      ps_.fd_cb(s_, pollset::Read);
+      errno = E2BIG;
+      rcb_(nullptr);
+      return;
     }
-    if (rdmsg_)
+    rdpos_ = 0;
+    rdlast_ = last;
+  }
+}
+
+// Returns true if a fragment of len bytes keeps the record within
+// maxmsglen_ and max_record_fragments.  Otherwise, stops reading and
+// reports an error.
+bool
+msg_sock::check_fraglen(size_t len)
+{
+  if (len <= maxmsglen_ - fragbytes_ && frags_.size() < max_record_fragments)
+    return true;
+  if (len > maxmsglen_ - fragbytes_)
+    std::cerr << "msg_sock: rejecting " << fragbytes_ + len
+	      << "-byte message (too long)" << std::endl;
+  else
+    std::cerr << "msg_sock: rejecting message of more than "
+	      << max_record_fragments << " fragments" << std::endl;
+  stop_input();
+  errno = E2BIG;
+  rcb_(nullptr);
+  return false;
+}
+
+// Pass a received fragment to the callback, first joining it with
+// any earlier fragments of the same record.  Nothing is passed on
+// until the last fragment arrives.
+void
+msg_sock::deliver(msg_ptr m, bool last)
+{
+  if (last && frags_.empty())
+    return rcb_(std::move(m));
+  fragbytes_ += m->size();
+  frags_.push_back(std::move(m));
+  if (!last)
+    return;
+
+  try { m = message_t::concat(frags_); }
+  catch (const std::bad_alloc &) {
+    std::cerr << "msg_sock: allocation of " << fragbytes_
+	      << "-byte message failed" << std::endl;
+    errno = E2BIG;
+  }
+  frags_.clear();
+  fragbytes_ = 0;
+  rcb_(std::move(m));
+}
+
+void
+msg_sock::input_error(ssize_t n, bool partial)
+{
+  if (n < 0 && eagain(errno))
+    return;
+  if (n == 0)
+    errno = partial ? ECONNRESET : 0;
+  else
+    std::cerr << "msg_sock::input: " << sock_errmsg() << std::endl;
+  rcb_(nullptr);
+}
+
+void
+msg_sock::input_buffered()
+{
+  std::shared_ptr<bool> destroyed{destroyed_};
+  int rounds = shm_ ? shm_input_rounds : input_rounds;
+  for (int i = 0; i < rounds && !*destroyed && !rpaused_; i++) {
+    // A message too big for the buffer is read in place, along with
+    // whatever follows it.
+    iovec iov[2];
+    int iovcnt = 0;
+    if (rdmsg_) {
+      iov[iovcnt].iov_base = rdmsg_->data() + rdpos_;
+      iov[iovcnt++].iov_len = rdmsg_->size() - rdpos_;
+    }
+    else if (rbeg_) {
+      std::memmove(rbuf_.get(), rbuf_.get() + rbeg_, rend_ - rbeg_);
+      rend_ -= rbeg_;
+      rbeg_ = 0;
+    }
+    iov[iovcnt].iov_base = rbuf_.get() + rend_;
+    iov[iovcnt++].iov_len = rbufsize_ - rend_;
+    size_t want = 0;
+    for (int j = 0; j < iovcnt; j++)
+      want += iov[j].iov_len;
+
+    ssize_t n = rawreadv(iov, iovcnt);
+    if (n <= 0)
+      return input_error(n, rdmsg_ || rend_);
+
+    size_t got = n;
+    if (rdmsg_) {
+      size_t need = rdmsg_->size() - rdpos_;
+      if (got < need) {
+	rdpos_ += got;
+	continue;
+      }
+      rend_ = got - need;
       rdpos_ = 0;
-    else {
+      deliver(std::move(rdmsg_), rdlast_);
+      if (*destroyed)
+	return;
+    }
+    else
+      rend_ += got;
+
+    if (!input_records(destroyed))
+      return;
+    // A short read means the socket has been drained.
+    if (got < want)
+      return;
+  }
+}
+
+// Pass each complete fragment in the buffer on to deliver.  If the
+// next fragment is too big for the buffer, move what there is of it
+// to rdmsg_.  Returns false if the msg_sock has been destroyed or has
+// failed.
+bool
+msg_sock::input_records(const std::shared_ptr<bool> &destroyed)
+{
+  const char *p = rbuf_.get() + rbeg_;
+  bool ok = take_records(p, rbuf_.get() + rend_, destroyed);
+  if (*destroyed)
+    return false;
+  rbeg_ = p - rbuf_.get();
+  if (rbeg_ == rend_)
+    rbeg_ = rend_ = 0;
+  return ok;
+}
+
+// Deliver the complete fragments in [p, e), advancing p past them.
+// Stops (without error) at a fragment that is incomplete but would
+// fit in the buffer; an incomplete fragment too big for the buffer
+// is moved to rdmsg_.
+bool
+msg_sock::take_records(const char *&p, const char *e,
+		       const std::shared_ptr<bool> &destroyed)
+{
+  while (e - p >= 4 && !rpaused_) {
+    std::uint32_t hdr;
+    std::memcpy(&hdr, p, 4);
+    size_t len = swap32le(hdr);
+    bool last = len & 0x80000000;
+    len &= 0x7fffffff;
+    if (!check_fraglen(len))
+      return false;
+
+    size_t avail = e - p - 4;
+    if (len > avail && 4 + len <= rbufsize_)
+      break;			// The rest will fit in the buffer
+
+    msg_ptr m;
+    // Length comes from untrusted source; don't crash if can't alloc
+    try { m = message_t::alloc(len); }
+    catch (const std::bad_alloc &) {
+      std::cerr << "msg_sock: allocation of " << len << "-byte message failed"
+		<< std::endl;
       errno = E2BIG;
       rcb_(nullptr);
+      return false;
     }
+    size_t n = std::min(len, avail);
+    std::memcpy(m->data(), p + 4, n);
+    p += 4 + n;
+    if (n < len) {
+      rdmsg_ = std::move(m);
+      rdpos_ = n;
+      rdlast_ = last;
+      break;
+    }
+    deliver(std::move(m), last);
+    if (*destroyed)
+      return false;
   }
+  return true;
 }
 
 void
@@ -127,10 +375,88 @@ msg_sock::putmsg(msg_ptr &mb)
   }
 
   bool was_empty = !wsize_;
-  wsize_ += mb->raw_size();
-  wqueue_.emplace_back(mb.release());
+  wqueue_.emplace_back(std::move(mb), fragsize_);
+  wsize_ += wqueue_.back().raw_size();
+  if (was_empty)
+    start_output();
+  check_wsize();
+}
+
+void
+msg_sock::putmsg(msg_chain &&c)
+{
+  if (wfail_)
+    return;
+
+  bool was_empty = !wsize_;
+  wqueue_.emplace_back(std::move(c), fragsize_);
+  wsize_ += wqueue_.back().raw_size();
   if (was_empty)
-    output(false);
+    start_output();
+  check_wsize();
+}
+
+void
+msg_sock::wbuf::setfrag(std::size_t fragsize)
+{
+  std::size_t n = size();
+  if (n <= fragsize)
+    return;
+  frag_ = fragsize;
+  hdrs_.reset(new std::uint32_t[2]);
+  hdrs_[0] = swap32le(std::uint32_t(frag_));
+  hdrs_[1] = swap32le(std::uint32_t(n - (nfrags() - 1) * frag_) | 0x80000000);
+}
+
+// Fill in at most max iovecs describing the bytes to be written,
+// starting skip bytes in.  Returns the number of iovecs used.
+std::size_t
+msg_sock::wbuf::iov(iovec *v, std::size_t max, std::size_t skip) const
+{
+  if (!frag_) {
+    if (!msg_)
+      return chain_.iov(v, max, skip);
+    if (!max)
+      return 0;
+    v->iov_base = const_cast<char *>(msg_->raw_data()) + skip;
+    v->iov_len = msg_->raw_size() - skip;
+    return 1;
+  }
+
+  std::size_t i = 0, n = size();
+  for (std::size_t k = skip / (frag_ + 4), off = skip % (frag_ + 4);
+       i < max && k * frag_ < n; ++k, off = 0) {
+    std::size_t pos = k * frag_, end = std::min(pos + frag_, n);
+    if (off < 4) {
+      const std::uint32_t *hdr = &hdrs_[end == n];
+      v[i].iov_base =
+	const_cast<char *>(reinterpret_cast<const char *>(hdr)) + off;
+      v[i++].iov_len = 4 - off;
+      off = 4;
+    }
+    if (i < max)
+      i += data_iov(v + i, max - i, pos + off - 4, end);
+  }
+  return i;
+}
+
+// Like iov, but describes only data bytes [pos, end), without any
+// length.
+std::size_t
+msg_sock::wbuf::data_iov(iovec *v, std::size_t max,
+			 std::size_t pos, std::size_t end) const
+{
+  if (msg_) {
+    v->iov_base = const_cast<char *>(msg_->data()) + pos;
+    v->iov_len = end - pos;
+    return 1;
+  }
+  std::size_t n = chain_.iov(v, max, 4 + pos), i = 0;
+  for (std::size_t left = end - pos; i < n && left; ++i) {
+    v[i].iov_len = std::min(v[i].iov_len, left);
+    left -= v[i].iov_len;
+  }
+  return i;
 }
 
 void
@@ -140,51 +466,507 @@ msg_sock::pop_wbytes(size_t n)
     return;
   assert (n <= wsize_);
   wsize_ -= n;
-  size_t frontbytes = wqueue_.front()->raw_size() - wstart_;
+  size_t frontbytes = wqueue_.front().raw_size() - wstart_;
   if (n < frontbytes) {
     wstart_ += n;
     return;
   }
   n -= frontbytes;
+  zc_release(std::move(wqueue_.front()));
   wqueue_.pop_front();
-  while (n > 0 && n >= (frontbytes = wqueue_.front()->raw_size())) {
+  ++wstats_.msgs;
+  while (n > 0 && n >= (frontbytes = wqueue_.front().raw_size())) {
     n -= frontbytes;
+    zc_release(std::move(wqueue_.front()));
     wqueue_.pop_front();
+    ++wstats_.msgs;
   }
   wstart_ = n;
 }
 
+// Called after queueing a message, to apply the limits on queued
+// output.
+void
+msg_sock::check_wsize()
+{
+  if (wmax_ && wsize_ > wmax_) {
+    std::cerr << "msg_sock: dropping connection with " << wsize_
+	      << " bytes of unsent output" << std::endl;
+    wdrop();
+    shutdown(s_.fd_, SHUT_RDWR);
+    wunblock();
+  }
+  else if (whigh_ && wsize_ > whigh_ && !wblocked_) {
+    wblocked_ = true;
+    if (wflow_cb_)
+      wflow_cb_(true);
+  }
+}
+
+// Discard all queued output, and give up on writing.
+void
+msg_sock::wdrop()
+{
+  wfail_ = true;
+  if (wop_) {
+    ring_->release(wop_, uring_keep());
+    wop_ = nullptr;
+  }
+  wsize_ = wstart_ = 0;
+  for (wbuf &b : wqueue_)
+    zc_release(std::move(b));
+  wqueue_.clear();
+  ps_.fd_cb(s_, pollset::Write);
+}
+
+// Report that the output queue has drained.  Since the callback
+// might delete the msg_sock, call this last.
+void
+msg_sock::wunblock()
+{
+  if (wblocked_ && wsize_ <= wlow_) {
+    wblocked_ = false;
+    if (wflow_cb_)
+      wflow_cb_(false);
+  }
+}
+
+// Called when the first message is queued.
+void
+msg_sock::start_output()
+{
+  if (!corked_)
+    return output(false);
+  if (flush_pending_)
+    return;
+  flush_pending_ = true;
+  ps_.defer_cb([this,destroyed=destroyed_]() {
+      if (*destroyed)
+	return;
+      flush_pending_ = false;
+      if (wsize_)
+	output(false);
+    });
+}
+
 void
 msg_sock::output(bool cbset)
 {
-  static constexpr size_t maxiov = 8;
+  if (ring_)
+    return uring_output();
+  if (shm_)
+    return shm_output();
+  if (!zcdone_.empty())
+    zc_reap();
+
   size_t i = 0;
   iovec v[maxiov];
-  for (auto b = wqueue_.begin(); i < maxiov && b != wqueue_.end(); ++b, ++i) {
-    if (i) {
-      v[i].iov_len = (*b)->raw_size();
-      v[i].iov_base = const_cast<char *> ((*b)->raw_data());
-    }
-    else {
-      v[i].iov_len = (*b)->raw_size() - wstart_;
-      v[i].iov_base = const_cast<char *> ((*b)->raw_data()) + wstart_;
-    }
+  bool zc = false;
+  auto b = wqueue_.begin();
+  for (; i < maxiov && b != wqueue_.end(); ++b) {
+    size_t skip = b == wqueue_.begin() ? wstart_ : 0;
+    i += b->iov(v + i, maxiov - i, skip);
+    zc = zc || (zcthresh_ && b->size() >= zcthresh_);
   }
-  ssize_t n = writev(s_, v, i);
+  ssize_t n = zc ? zc_write(v, i, b) : writev(s_, v, i);
   if (n <= 0) {
     if (n != -1 || !eagain(errno)) {
-      wfail_ = true;
-      wsize_ = wstart_ = 0;
-      wqueue_.clear();
+      wdrop();
+      return wunblock();
     }
-    return;
   }
-  pop_wbytes(n);
+  else {
+    ++wstats_.writes;
+    wstats_.bytes += n;
+    pop_wbytes(n);
+  }
 
   if (wsize_ && !cbset)
     ps_.fd_cb(s_, pollset::Write, [this](){ output(true); });
   else if (!wsize_ && cbset)
     ps_.fd_cb(s_, pollset::Write);
+  wunblock();
+}
+
+bool
+msg_sock::set_zerocopy(size_t threshold)
+{
+#ifdef XDRPP_ZEROCOPY
+  int one = 1;
+  if (threshold && setsockopt(s_.fd_, SOL_SOCKET, SO_ZEROCOPY,
+			      &one, sizeof one) == -1)
+    return false;
+  zcthresh_ = threshold;
+  return true;
+#else // !XDRPP_ZEROCOPY
+  return !threshold;
+#endif // !XDRPP_ZEROCOPY
+}
+
+// Keep a buffer that is leaving the write queue until the kernel is
+// done with it.
+void
+msg_sock::zc_release(wbuf &&b)
+{
+  if (zc_pending(b))
+    zcwait_.push_back(std::move(b));
+}
+
+// Write with MSG_ZEROCOPY the iovecs describing the write queue up
+// to end.
+ssize_t
+msg_sock::zc_write(iovec *v, size_t iovcnt, std::deque<wbuf>::iterator end)
+{
+#ifdef XDRPP_ZEROCOPY
+  msghdr mh {};
+  mh.msg_iov = v;
+  mh.msg_iovlen = iovcnt;
+  ssize_t n = sendmsg(s_.fd_, &mh, MSG_ZEROCOPY);
+  if (n > 0) {
+    std::uint32_t seq = zcbase_ + zcdone_.size();
+    zcdone_.push_back(false);
+    for (auto b = wqueue_.begin(); b != end; ++b) {
+      b->zc_ = true;
+      b->zcseq_ = seq;
+    }
+    ++wstats_.zc_writes;
+    return n;
+  }
+  // ENOBUFS means too much memory is pinned, so fall back to copying.
+  if (n == 0 || errno != ENOBUFS)
+    return n;
+#endif // XDRPP_ZEROCOPY
+  return writev(s_, v, iovcnt);
+}
+
+// Process zero-copy completion notifications from the socket's error
+// queue, and free buffers the kernel no longer needs.
+void
+msg_sock::zc_reap()
+{
+#ifdef XDRPP_ZEROCOPY
+  for (;;) {
+    char control[128];
+    msghdr mh {};
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof control;
+    if (recvmsg(s_.fd_, &mh, MSG_ERRQUEUE) == -1)
+      break;
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+	  && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+	continue;
+      sock_extended_err ee;
+      std::memcpy(&ee, CMSG_DATA(cm), sizeof ee);
+      if (ee.ee_errno || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	continue;
+      // Writes ee_info through ee_data have completed.
+      if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+	wstats_.zc_copied += ee.ee_data - ee.ee_info + 1;
+      for (std::uint32_t seq = ee.ee_info;; ++seq) {
+	std::uint32_t i = seq - zcbase_;
+	if (i < zcdone_.size())
+	  zcdone_[i] = true;
+	if (seq == ee.ee_data)
+	  break;
+      }
+    }
+  }
+  while (!zcdone_.empty() && zcdone_.front()) {
+    zcdone_.pop_front();
+    ++zcbase_;
+  }
+  zcwait_.erase(std::remove_if(zcwait_.begin(), zcwait_.end(),
+			       [this](const wbuf &b) { return !zc_pending(b); }),
+		zcwait_.end());
+#endif // XDRPP_ZEROCOPY
+}
+
+bool
+msg_sock::set_uring(io_ring *r)
+{
+  assert(!ring_ && !rdmsg_ && !rdpos_ && rbeg_ == rend_ && !wsize_);
+  if (!r)
+    return false;
+  if (!rbuf_)
+    set_rbufsize(r->bufsize());
+  // The ring waits for the socket to be ready itself, and on a
+  // non-blocking socket some operations would fail with EAGAIN.
+  int flags = fcntl(s_.fd_, F_GETFL);
+  if (flags != -1)
+    fcntl(s_.fd_, F_SETFL, flags & ~O_NONBLOCK);
+  ps_.fd_cb(s_, pollset::ReadWrite);
+  ring_ = r;
+  initcb();
+  return true;
+}
+
+// Stop reading after an error.
+void
+msg_sock::stop_input()
+{
+  if (!ring_ && !shm_)
+    return ps_.fd_cb(s_, pollset::Read);
+  rfail_ = true;
+  if (shm_)
+    return shm_initcb();
+  if (rop_) {
+    ring_->release(rop_);
+    rop_ = nullptr;
+  }
+}
+
+void
+msg_sock::uring_recv()
+{
+  rop_ = ring_->recv_multishot(s_, [this](int res, unsigned flags,
+					  const char *buf) {
+      bool last = !io_ring::more(flags);
+      if (last)
+	rop_ = nullptr;
+      if (res > 0) {
+	std::shared_ptr<bool> destroyed{destroyed_};
+	uring_input(buf, res);
+	if (*destroyed)
+	  return;
+      }
+      // The receive also ends when the ring runs out of buffers.
+      else if (res == 0 || (res != -ECANCELED && res != -ENOBUFS
+			    && !eagain(-res)))
+	return uring_input_error(res);
+      if (last && !rop_ && !rfail_ && rcb_ && !rpaused_)
+	uring_recv();
+    });
+}
+
+// Process data received through the ring.  Complete fragments are
+// copied straight into their messages; only an incomplete one at the
+// end goes through rbuf_.
+void
+msg_sock::uring_input(const char *p, size_t n)
+{
+  std::shared_ptr<bool> destroyed{destroyed_};
+  const char *e = p + n;
+  while (p < e) {
+    // Keep data in order behind anything stashed while paused.
+    if (rpaused_ || !rstash_.empty()) {
+      rstash_.append(p, e);
+      return;
+    }
+    if (rdmsg_) {
+      size_t k = std::min<size_t>(e - p, rdmsg_->size() - rdpos_);
+      std::memcpy(rdmsg_->data() + rdpos_, p, k);
+      p += k;
+      rdpos_ += k;
+      if (rdpos_ < rdmsg_->size())
+	return;
+      rdpos_ = 0;
+      deliver(std::move(rdmsg_), rdlast_);
+      if (*destroyed)
+	return;
+    }
+    else if (rbeg_ < rend_) {
+      // Complete the fragment started in the buffer.
+      if (rbeg_) {
+	std::memmove(rbuf_.get(), rbuf_.get() + rbeg_, rend_ - rbeg_);
+	rend_ -= rbeg_;
+	rbeg_ = 0;
+      }
+      size_t k = std::min<size_t>(e - p, rbufsize_ - rend_);
+      std::memcpy(rbuf_.get() + rend_, p, k);
+      p += k;
+      rend_ += k;
+      if (!input_records(destroyed))
+	return;
+    }
+    else {
+      if (!take_records(p, e, destroyed))
+	return;
+      if (!rpaused_ && !rdmsg_) {
+	rbeg_ = 0;
+	rend_ = e - p;
+	std::memcpy(rbuf_.get(), p, rend_);
+	p = e;
+      }
+    }
+  }
+}
+
+// The receive ended with res (0 for end of file, or -errno).  If
+// paused, report it once the input before it has been processed.
+void
+msg_sock::uring_input_error(int res)
+{
+  rfail_ = true;
+  if (rpaused_ || !rstash_.empty()) {
+    rerr_ = res;
+    return;
+  }
+  if (res < 0)
+    errno = -res;
+  input_error(res < 0 ? -1 : 0, rdmsg_ || rbeg_ < rend_);
+}
+
+void
+msg_sock::uring_resume()
+{
+  std::shared_ptr<bool> destroyed{destroyed_};
+  if (rend_ - rbeg_ >= 4 && !input_records(destroyed))
+    return;
+  if (!rstash_.empty()) {
+    std::string stash;
+    stash.swap(rstash_);
+    uring_input(stash.data(), stash.size());
+    if (*destroyed)
+      return;
+  }
+  if (rerr_ != 1 && !rpaused_ && rstash_.empty()) {
+    int res = rerr_;
+    rerr_ = 1;
+    uring_input_error(res);
+  }
+}
+
+void
+msg_sock::uring_output()
+{
+  if (wop_ || !wsize_)
+    return;
+  if (!uw_)
+    uw_ = std::make_shared<uwrite>();
+  size_t i = 0;
+  for (auto b = wqueue_.begin(); i < maxiov && b != wqueue_.end(); ++b)
+    i += b->iov(uw_->iov + i, maxiov - i, b == wqueue_.begin() ? wstart_ : 0);
+  std::memset(&uw_->mh, 0, sizeof uw_->mh);
+  uw_->mh.msg_iov = uw_->iov;
+  uw_->mh.msg_iovlen = i;
+  wop_ = ring_->sendmsg(s_, &uw_->mh, [this](int res, unsigned,
+					     const char *) {
+      wop_ = nullptr;
+      if (res <= 0 && !(res < 0 && eagain(-res))) {
+	wdrop();
+	return wunblock();
+      }
+      if (res > 0) {
+	++wstats_.writes;
+	wstats_.bytes += res;
+	pop_wbytes(res);
+      }
+      uring_output();
+      wunblock();
+    });
+}
+
+// Whatever the kernel may still read for a send in progress, so that
+// it outlives the msg_sock or the discarded write queue.
+std::shared_ptr<void>
+msg_sock::uring_keep()
+{
+  using keep_t = std::pair<std::shared_ptr<uwrite>, std::deque<wbuf>>;
+  return std::make_shared<keep_t>(std::move(uw_), std::move(wqueue_));
+}
+
+bool
+msg_sock::set_shm(std::unique_ptr<shm_link> l)
+{
+  assert(!ring_ && !shm_ && !rdmsg_ && !rdpos_ && rbeg_ == rend_ && !wsize_);
+  if (!l)
+    return false;
+  ps_.fd_cb(s_, pollset::ReadWrite);
+  shm_ = std::move(l);
+  ps_.fd_cb(s_, pollset::Read, [this](){ shm_hangup(); });
+  initcb();
+  // The peer may have written before we started listening.
+  shm_->wake_self();
+  return true;
+}
+
+ssize_t
+msg_sock::rawreadv(const iovec *iov, int iovcnt)
+{
+  if (shm_)
+    return shm_->readv(iov, iovcnt);
+  return readv(s_, iov, iovcnt);
+}
+
+// Listen for the doorbell while reading or waiting to write.
+void
+msg_sock::shm_initcb()
+{
+  if ((rcb_ && !rpaused_ && !rfail_) || shm_wwait_)
+    ps_.fd_cb(shm_->doorbell(), pollset::Read, [this](){ shm_ready(); });
+  else
+    ps_.fd_cb(shm_->doorbell(), pollset::Read);
+}
+
+void
+msg_sock::shm_ready()
+{
+  shm_->clear_doorbell();
+  std::shared_ptr<bool> destroyed{destroyed_};
+  if (shm_wwait_) {
+    shm_output();
+    if (*destroyed)
+      return;
+  }
+  if (rcb_ && !rpaused_ && !rfail_)
+    shm_input();
+}
+
+// Read until the ring is empty and the peer has been asked to ring
+// the doorbell when there is more.  If input stops early, ring the
+// doorbell ourselves to carry on in the next poll iteration.
+void
+msg_sock::shm_input()
+{
+  std::shared_ptr<bool> destroyed{destroyed_};
+  input();
+  if (!*destroyed && rcb_ && !rpaused_ && !rfail_ && !shm_->read_wait())
+    shm_->wake_self();
+}
+
+// Nothing should arrive on the socket, so it becoming readable means
+// the peer has closed it (or broken the protocol).
+void
+msg_sock::shm_hangup()
+{
+  char c;
+  ssize_t n = read(s_, &c, 1);
+  if (n < 0 && eagain(errno))
+    return;
+  if (n > 0)
+    std::cerr << "msg_sock: unexpected data on shared-memory socket"
+	      << std::endl;
+  ps_.fd_cb(s_, pollset::Read);
+  shm_->set_eof();
+  shm_->wake_self();
+}
+
+void
+msg_sock::shm_output()
+{
+  // Copying into the ring is cheap, so fill it as far as possible.
+  while (wsize_) {
+    size_t i = 0;
+    iovec v[maxiov];
+    for (auto b = wqueue_.begin(); i < maxiov && b != wqueue_.end(); ++b)
+      i += b->iov(v + i, maxiov - i, b == wqueue_.begin() ? wstart_ : 0);
+    ssize_t n = shm_->writev(v, i);
+    if (n < 0) {
+      if (!eagain(errno))
+	wdrop();
+      break;
+    }
+    ++wstats_.writes;
+    wstats_.bytes += n;
+    pop_wbytes(n);
+  }
+  bool wait = wsize_ != 0;
+  if (wait != shm_wwait_) {
+    shm_wwait_ = wait;
+    shm_initcb();
+  }
+  wunblock();
 }
 
 void
@@ -7,27 +7,38 @@
 #define _XDRPP_MSGSOCK_H_INCLUDED_ 1
 
 #include <deque>
+#include <string>
 #include <xdrpp/message.h>
 #include <xdrpp/pollset.h>
+#include <xdrpp/shm.h>
+#include <xdrpp/uring.h>
 
 namespace xdr {
 
 //! Send and receive a series of delimited messages on a stream
 //! socket.  The format (specified in RFC5531, Section 11) is simple:
 //! A 4-byte length (in little-endian format) followed by that many
-//! bytes.  The implementation is optimized for having many sockets
-//! each receiving a small number of messages, as opposed to receiving
-//! many messages over the same socket.
+//! bytes.  If the high bit of the length is clear, the bytes are only
+//! a fragment of the message, and another length and fragment
+//! follow.  Received fragments are joined into a single \c message_t
+//! (subject to the same \c maxmsglen limit on the total size, and to
+//! at most \c max_record_fragments fragments).  Messages larger than
+//! \c set_fragsize are sent as several fragments.
 //!
-//! Currently this calls read once or twice per message to get the
-//! exact length before allocating buffer space and reading the
-//! message body (possibly including the next message length).  This
-//! could be fixed to read at least a little bit more data
-//! speculatively and reduce the number of system calls.
+//! By default, the implementation is optimized for having many
+//! sockets each receiving a small number of messages:  It calls read
+//! once or twice per message to get the exact length before
+//! allocating buffer space and reading the message body (possibly
+//! including the next message length), so that idle sockets hold no
+//! buffer.  For sockets that receive many messages back to back, \c
+//! set_rbufsize switches to reading speculatively into a per-socket
+//! buffer, from which as many complete messages as it holds are
+//! copied out after a single \c readv.
 class msg_sock {
 public:
   static constexpr std::size_t default_maxmsglen = 0x100000;
   using rcb_t = std::function<void(msg_ptr)>;
+  using wflow_cb_t = std::function<void(bool)>;
 
   template<typename T> msg_sock(pollset &ps, sock_t s, T &&rcb,
 				size_t maxmsglen = default_maxmsglen)
@@ -43,9 +54,95 @@ public:
     initcb();
   }
 
+  //! Read into a buffer of \c n bytes, which must be at least 8 (or,
+  //! if \c n is 0, go back to reading each message separately).
+  //! Messages too large for the buffer are read directly into their
+  //! own \c message_t.  Call this before any input is processed,
+  //! typically right after construction.
+  void set_rbufsize(size_t n);
+
+  //! Send messages of more than \c n bytes (which must be between 1
+  //! and \c max_fragment_len) as a series of fragments of at most \c
+  //! n bytes.  By default, only messages too large for one fragment
+  //! are split.  Affects messages queued after the call.
+  void set_fragsize(size_t n) {
+    assert(n > 0 && n <= max_fragment_len);
+    fragsize_ = n;
+  }
+
+  //! When corked, a message queued on an idle socket is not written
+  //! immediately.  Instead, everything queued until the end of the
+  //! current PollSet::poll iteration (see \c pollset::defer_cb) is
+  //! written together, with as few calls to \c writev as possible.
+  void set_cork(bool corked) { corked_ = corked; }
+
+  //! Once more than \c high bytes are queued for output, call \c
+  //! cb(true); once the queue then drains to \c low bytes or fewer
+  //! (or is discarded because of an error), call \c cb(false).  A
+  //! typical callback pauses whatever produces the messages, e.g.,
+  //! with \c pause_input and \c resume_input.
+  template<typename T> void set_watermarks(size_t low, size_t high, T &&cb) {
+    assert(low <= high);
+    wlow_ = low;
+    whigh_ = high;
+    wflow_cb_ = std::forward<T>(cb);
+  }
+  //! Drop the connection if more than \c n bytes are ever queued for
+  //! output (0 means no limit).  Queued output is discarded, and the
+  //! read callback sees end of file.
+  void set_wmax(size_t n) { wmax_ = n; }
+
+  //! Stop passing received messages to the read callback (and
+  //! reading from the socket) until \c resume_input is called.
+  void pause_input();
+  void resume_input();
+
+  //! Counters for verifying how well writes are batched.
+  struct wstats {
+    size_t writes {0};		//!< Successful calls to \c writev
+    size_t msgs {0};		//!< Messages completely written
+    size_t bytes {0};		//!< Bytes written (including lengths)
+    size_t zc_writes {0};	//!< Writes using \c MSG_ZEROCOPY
+    size_t zc_copied {0};	//!< Of those, how many the kernel copied
+  };
+  const wstats &get_wstats() const { return wstats_; }
+
+  //! Write messages of at least \c threshold bytes (0 to disable)
+  //! with \c MSG_ZEROCOPY, so that the kernel transmits them straight
+  //! from the message buffer.  Each such buffer is held until the
+  //! kernel reports it is done with it, which is noticed when the
+  //! socket is next read or written.  Returns \c false if the socket
+  //! does not support zero-copy transmission (e.g., it is not a TCP
+  //! socket, or the system is not Linux).
+  bool set_zerocopy(size_t threshold);
+
+  //! Do all I/O on the socket through \c r (see \c io_ring), rather
+  //! than waiting for readiness and calling \c readv and \c writev.
+  //! Call this before any input or output, typically right after
+  //! construction.  Input is always buffered (see \c set_rbufsize),
+  //! but complete messages are copied straight out of the ring's
+  //! buffers.  Zero-copy writes are not used.  Returns \c false (and
+  //! does nothing) if \c r is null, e.g., because \c io_ring::create
+  //! found no kernel support.
+  bool set_uring(io_ring *r);
+
+  //! Send and receive messages through \c l (see \c shm_link)
+  //! instead of the socket, which must be the Unix-domain socket over
+  //! which \c l was set up.  The socket is only watched for the peer
+  //! closing it, which, once the data already in the ring has been
+  //! read, is reported as end of file.  Call this before any input or
+  //! output, typically right after construction.  There is little
+  //! point in buffered input (see \c set_rbufsize), as reading from
+  //! the ring makes no system call.  Returns \c false (and does
+  //! nothing) if \c l is null.
+  bool set_shm(std::unique_ptr<shm_link> l);
+
   size_t wsize() const { return wsize_; }
   void putmsg(msg_ptr &b);
   void putmsg(msg_ptr &&b) { putmsg(b); }
+  //! Queue a chained message (see \c xdr::xdr_to_chain), which is
+  //! written with \c writev without first being made contiguous.
+  void putmsg(msg_chain &&c);
   //! Returns pointer to a \c bool that becomes \c true once the
   //! msg_sock has been deleted.
   std::shared_ptr<const bool> destroyed_ptr() const { return destroyed_; }
@@ -61,14 +158,92 @@ private:
   std::shared_ptr<bool> destroyed_{std::make_shared<bool>(false)};
 
   rcb_t rcb_;
+  bool rpaused_ {false};
   uint32_t nextlen_;
   msg_ptr rdmsg_;
   size_t rdpos_ {0};
+  bool rdlast_ {true};		// rdmsg_ is the last fragment
+
+  // Earlier fragments of the record being received.
+  std::vector<msg_ptr> frags_;
+  size_t fragbytes_ {0};
+
+  // Buffered receive mode.  Unconsumed input occupies [rbeg_, rend_).
+  std::unique_ptr<char[]> rbuf_;
+  size_t rbufsize_ {0};
+  size_t rbeg_ {0};
+  size_t rend_ {0};
 
-  std::deque<msg_ptr> wqueue_;
+  // Entry in the write queue, holding either a contiguous message or
+  // a chain of chunks.  If frag_ is non-zero, the data is sent as
+  // fragments of frag_ bytes (the last possibly shorter), whose
+  // lengths are hdrs_[0] and hdrs_[1] respectively.  The lengths are
+  // on the heap so a zero-copy send can keep pointing at them after
+  // the wbuf moves.  If zc_ is set, the buffer was last passed to the
+  // zero-copy write numbered zcseq_.
+  struct wbuf {
+    msg_ptr msg_;
+    msg_chain chain_;
+    std::size_t frag_ {0};
+    std::unique_ptr<std::uint32_t[]> hdrs_;
+    bool zc_ {false};
+    std::uint32_t zcseq_;
+    wbuf(msg_ptr &&m, std::size_t fragsize) : msg_(std::move(m)) {
+      setfrag(fragsize);
+    }
+    wbuf(msg_chain &&c, std::size_t fragsize) : chain_(std::move(c)) {
+      setfrag(fragsize);
+    }
+    void setfrag(std::size_t fragsize);
+    std::size_t size() const { return msg_ ? msg_->size() : chain_.size(); }
+    std::size_t nfrags() const {
+      return frag_ ? (size() + frag_ - 1) / frag_ : 1;
+    }
+    std::size_t raw_size() const { return size() + 4 * nfrags(); }
+    std::size_t iov(iovec *v, std::size_t max, std::size_t skip) const;
+    std::size_t data_iov(iovec *v, std::size_t max,
+			 std::size_t pos, std::size_t end) const;
+  };
+  size_t fragsize_ {max_fragment_len};
+
+  std::deque<wbuf> wqueue_;
   size_t wsize_ {0};
   size_t wstart_ {0};
   bool wfail_ {false};
+  bool corked_ {false};
+  bool flush_pending_ {false};
+  wstats wstats_;
+
+  // Zero-copy writes.  Writes zcbase_ through zcbase_ +
+  // zcdone_.size() - 1 may not have completed; zcdone_ records which
+  // have.  Buffers written from the queue wait in zcwait_.
+  size_t zcthresh_ {0};
+  std::uint32_t zcbase_ {0};
+  std::deque<bool> zcdone_;
+  std::deque<wbuf> zcwait_;
+
+  // io_uring mode.  Input received while paused waits in rstash_,
+  // and an end of input (see uring_input_error) in rerr_.
+  io_ring *ring_ {nullptr};
+  io_ring::op *rop_ {nullptr};
+  io_ring::op *wop_ {nullptr};
+  bool rfail_ {false};
+  std::string rstash_;
+  int rerr_ {1};
+  struct uwrite;
+  std::shared_ptr<uwrite> uw_;
+
+  // Shared-memory mode.  rfail_ also applies here.  shm_wwait_ means
+  // output is waiting for the peer to free space in the ring.
+  std::unique_ptr<shm_link> shm_;
+  bool shm_wwait_ {false};
+
+  // Flow control
+  size_t wlow_ {0};
+  size_t whigh_ {0};
+  size_t wmax_ {0};
+  bool wblocked_ {false};
+  wflow_cb_t wflow_cb_;
 
   static constexpr bool eagain(int err) {
     return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
@@ -79,8 +254,38 @@ private:
   void init();
   void initcb();
   void input();
+  void input_buffered();
+  void input_error(ssize_t n, bool partial);
+  bool input_records(const std::shared_ptr<bool> &destroyed);
+  bool take_records(const char *&p, const char *e,
+		    const std::shared_ptr<bool> &destroyed);
+  bool check_fraglen(size_t len);
+  void deliver(msg_ptr m, bool last);
   void pop_wbytes(size_t n);
+  void check_wsize();
+  void start_output();
   void output(bool cbset);
+  void wdrop();
+  void wunblock();
+  bool zc_pending(const wbuf &b) const {
+    return b.zc_ && std::uint32_t(b.zcseq_ - zcbase_) < zcdone_.size();
+  }
+  void zc_release(wbuf &&b);
+  ssize_t zc_write(iovec *v, size_t iovcnt, std::deque<wbuf>::iterator end);
+  void zc_reap();
+  void stop_input();
+  void uring_recv();
+  void uring_input(const char *p, size_t n);
+  void uring_input_error(int res);
+  void uring_resume();
+  void uring_output();
+  std::shared_ptr<void> uring_keep();
+  ssize_t rawreadv(const iovec *iov, int iovcnt);
+  void shm_initcb();
+  void shm_ready();
+  void shm_input();
+  void shm_hangup();
+  void shm_output();
 };
 
 //! A wrapper around xdr::msg_sock that separates calls from replies.
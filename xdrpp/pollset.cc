@@ -10,6 +10,10 @@
 #include <signal.h>
 #include <unistd.h>
 #include <xdrpp/pollset.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 namespace xdr {
 
@@ -20,10 +24,9 @@ volatile std::sig_atomic_t pollset_plus::signal_flags[num_sig];
 pollset::Timeout
 pollset::timeout_null()
 {
-  static decltype(pollset::time_cbs_) dummy_time_cbs_;
-  return Timeout{dummy_time_cbs_.end()};
+  return Timeout{};
 }
-const pollset::Timeout pollset::Timeout::null_(pollset::timeout_null());
+const pollset::Timeout pollset::Timeout::null_;
 
 void
 pollset_plus::signal_handler(int sig)
@@ -43,18 +46,67 @@ pollset_plus::signal_handler(int sig)
   signal_flags[sig] = 2;
 }
 
-pollset_plus::pollset_plus()
+pollset::pollset(backend_t b)
+  : tick_(now_ms())
 {
+#ifdef __linux__
+  if (b == Epoll) {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ == -1)
+      throw std::system_error(errno, std::system_category(), "epoll_create1");
+  }
+#endif
+}
+
+pollset::~pollset()
+{
+  if (epfd_ >= 0)
+    close(epfd_);
+
+  auto free_list = [](tlink &head) {
+    while (head.next_ != &head) {
+      tlink *l = head.next_;
+      head.next_ = l->next_;
+      delete static_cast<timer *>(l);
+    }
+  };
+  for (tlink &head : wheel_)
+    free_list(head);
+  free_list(expired_);
+  while (tlink *l = free_timers_) {
+    free_timers_ = l->next_;
+    delete static_cast<timer *>(l);
+  }
+}
+
+pollset_plus::pollset_plus(backend_t b)
+  : pollset(b)
+{
+#ifdef __linux__
+  int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (fd == -1)
+    throw std::system_error(errno, std::system_category(), "eventfd");
+  selfpipe_[0] = selfpipe_[1] = fd;
+#else // !__linux__
   create_selfpipe(selfpipe_);
   set_close_on_exec(selfpipe_[0]);
   set_close_on_exec(selfpipe_[1]);
   set_nonblock(selfpipe_[0]);
   set_nonblock(selfpipe_[1]);
+#endif // !__linux__
   this->fd_cb(selfpipe_[0], Read, [this](){ this->run_pending_asyncs(); });
 }
 
 pollset_plus::~pollset_plus()
 {
+  // Wait for our tasks, which inject callbacks into us, even if the
+  // pool is shared and will outlive us.
+  {
+    std::unique_lock<std::mutex> lk {tasks_lock_};
+    tasks_done_.wait(lk, [this]() { return !ntasks_; });
+  }
+  pool_.reset();
+
   {
     std::lock_guard<std::mutex> lk {signal_owners_lock};
     while (signal_cbs_.begin() != signal_cbs_.end())
@@ -63,7 +115,15 @@ pollset_plus::~pollset_plus()
 
   fd_cb(selfpipe_[0], Read);
   close(selfpipe_[0]);
-  close(selfpipe_[1]);
+  if (selfpipe_[1] != selfpipe_[0])
+    close(selfpipe_[1]);
+
+  for (async_cb *c : {async_head_.exchange(nullptr), async_backlog_})
+    while (c) {
+      async_cb *next = c->next_;
+      delete c;
+      c = next;
+    }
 }
 
 pollset::fd_state::~fd_state()
@@ -72,122 +132,191 @@ pollset::fd_state::~fd_state()
   assert (!rcb && !wcb);
 }
 
+void
+pollset_plus::task_submitted()
+{
+  std::lock_guard<std::mutex> lk {tasks_lock_};
+  ++ntasks_;
+}
+
+void
+pollset_plus::task_done()
+{
+  // Notify with the lock held, so the destructor cannot proceed until
+  // we are done with the condition variable.
+  std::lock_guard<std::mutex> lk {tasks_lock_};
+  if (!--ntasks_)
+    tasks_done_.notify_all();
+}
+
+thread_pool &
+pollset_plus::get_thread_pool()
+{
+  if (!pool_)
+    pool_ = std::make_shared<thread_pool>();
+  return *pool_;
+}
+
 void
 pollset_plus::wake(wake_type wt)
 {
-  static_assert(sizeof wt == 1, "uint8_t enum has wrong size");
+  if (wt == wake_type::Signal)
+    signal_wake_ = true;
+#ifdef __linux__
+  std::uint64_t one = 1;
+  write(selfpipe_[1], &one, sizeof one);
+#else // !__linux__
   write(selfpipe_[1], &wt, 1);
+#endif // !__linux__
+}
+
+void
+pollset_plus::push_async(async_cb *c)
+{
+  c->next_ = async_head_.load(std::memory_order_relaxed);
+  while (!async_head_.compare_exchange_weak(c->next_, c,
+					    std::memory_order_release,
+					    std::memory_order_relaxed))
+    ;
+  if (!c->next_)
+    wake();
 }
 
 void
 pollset_plus::run_pending_asyncs()
 {
-  std::vector<cb_t> cbs;
-  std::vector<cb_t>::iterator i;
+  {
+#ifdef __linux__
+    std::uint64_t n;
+    read(selfpipe_[0], &n, sizeof n);
+#else // !__linux__
+    char buf[128];
+    while (read(selfpipe_[0], buf, sizeof buf) > 0)
+      ;
+#endif // !__linux__
+    if (signal_wake_.exchange(false))
+      signal_pending_ = true;
+  }
+
+  // Take the stack and append it, oldest first, to the callbacks left
+  // over from a callback that threw.
+  async_cb *fresh = nullptr;
+  for (async_cb *c = async_head_.exchange(nullptr, std::memory_order_acquire),
+	 *next; c; c = next) {
+    next = c->next_;
+    c->next_ = fresh;
+    fresh = c;
+  }
+  async_cb **tail = &async_backlog_;
+  while (*tail)
+    tail = &(*tail)->next_;
+  *tail = fresh;
 
   // Catching and re-throwing exceptions ruins the stack trace from
   // uncaught exceptions, which hurts debugability, particularly in a
   // core routine that calls a bunch of callbacks.  Hence, we abuse
   // RAII where catch would be more approriate.
   struct cleanup {
-    bool active;
-    cb_t action;
-    ~cleanup() { if (active) action(); }
-  } c { false, [&](){inject_cb_vec(i+1, cbs.end());} };
-
-  {
-    wake_type buf[128];
-    int n;
-    while ((n = read(selfpipe_[0], buf, sizeof buf)) > 0)
-      for (int i = 0; i < n && !signal_pending_; i++)
-	if (buf[i] == wake_type::Signal)
-	  signal_pending_ = true;
-  }
-  {
-    std::lock_guard<std::mutex> lk {async_cbs_lock_};
-    async_pending_ = false;
-    swap(cbs, async_cbs_);
-  }
-
-  for (i = cbs.begin(), c.active = true; i != cbs.end(); i++)
-    (*i)();
-  c.active = false;
-}
-
-void
-pollset_plus::inject_cb_vec(std::vector<cb_t>::iterator b,
-			    std::vector<cb_t>::iterator e)
-{
-  if (b != e) {
-    std::lock_guard<std::mutex> lk {async_cbs_lock_};
-    std::move(b, e, async_cbs_.end());
-    if (!async_pending_) {
-      async_pending_ = true;
-      wake();
-    }
+    pollset_plus *ps;
+    ~cleanup() { if (ps->async_backlog_) ps->wake(); }
+  } c { this };
+
+  while (async_cb *a = async_backlog_) {
+    async_backlog_ = a->next_;
+    cb_t cb {std::move(a->cb_)};
+    delete a;
+    cb();
   }
 }
 
 pollset::cb_t &
 pollset::fd_cb_helper(sock_t s, op_t op)
 {
-  fd_state &fs = state_[s];
-  pollfd *pfdp;
-  if (fs.idx < 0) {
-    fs.idx = pollfds_.size();
-    pollfds_.resize(fs.idx + 1);
-    pfdp = &pollfds_.back();
-    pfdp->fd = s.fd_;		// XXX
-  }
-  else {
-    pfdp = &pollfds_.at(fs.idx);
-    assert (pfdp->fd == s.fd_);	// XXX
-  }
   if (op & kReadFlag) {
     if (op & kWriteFlag) {
       std::cerr << "Illegal call to pollset::fd_cb with ReadWrite"
 		<< std::endl;
       std::terminate();
     }
-    fs.roneshot = op & kOnceFlag;
-    pfdp->events |= POLLIN;
-    return fs.rcb;
-  }
-  else if (op & kWriteFlag) {
-    fs.woneshot = op & kOnceFlag;
-    pfdp->events |= POLLOUT;
-    return fs.wcb;
   }
-  else {
+  else if (!(op & kWriteFlag)) {
     std::cerr << "Illegal call to pollset::fd_cb with"
                  " neither Read nor Write"
 	      << std::endl;
     std::terminate();
   }
+
+  if (std::size_t(s.fd_) >= state_.size())
+    state_.resize(s.fd_ + 1);
+  fd_state &fs = state_[s.fd_];
+
+  if (epfd_ >= 0) {
+    if (!fs.active) {
+      fs.active = true;
+      ++nfds_;
+    }
+    if (!fs.dirty) {
+      fs.dirty = true;
+      dirty_.push_back(s.fd_);
+    }
+  }
+  else {
+    pollfd *pfdp;
+    if (fs.idx < 0) {
+      fs.idx = pollfds_.size();
+      pollfds_.resize(fs.idx + 1);
+      pfdp = &pollfds_.back();
+      pfdp->fd = s.fd_;		// XXX
+    }
+    else {
+      pfdp = &pollfds_.at(fs.idx);
+      assert (pfdp->fd == s.fd_);	// XXX
+    }
+    pfdp->events |= op & kReadFlag ? POLLIN : POLLOUT;
+  }
+
+  if (op & kReadFlag) {
+    fs.roneshot = op & kOnceFlag;
+    return fs.rcb;
+  }
+  fs.woneshot = op & kOnceFlag;
+  return fs.wcb;
 }
 
 void
 pollset::fd_cb(sock_t s, op_t op, std::nullptr_t)
 {
-  auto fi = state_.find(s);
-  if (fi == state_.end())
+  if (std::size_t(s.fd_) >= state_.size())
+    return;
+  fd_state &fs = state_[s.fd_];
+
+  if (epfd_ >= 0) {
+    if (op & kReadFlag)
+      fs.rcb = nullptr;
+    if (op & kWriteFlag)
+      fs.wcb = nullptr;
+    epoll_remove(s.fd_, fs);
+    return;
+  }
+
+  if (fs.idx < 0)
     return;
-  pollfd &pfd = pollfds_.at(fi->second.idx);
-  
+  pollfd &pfd = pollfds_.at(fs.idx);
   if (op & kReadFlag) {
     pfd.events &= ~POLLIN;
-    fi->second.rcb = nullptr;
+    fs.rcb = nullptr;
   }
   if (op & kWriteFlag) {
     pfd.events &= ~POLLOUT;
-    fi->second.wcb = nullptr;
+    fs.wcb = nullptr;
   }
 }
 
 std::size_t
 pollset::num_cbs() const
 {
-  return pollfds_.size() + time_cbs_.size();
+  return (epfd_ >= 0 ? nfds_ : pollfds_.size())
+    + ntimers_ + deferred_cbs_.size();
 }
 
 bool
@@ -199,13 +328,15 @@ pollset_plus::pending() const
 int
 pollset::next_timeout(int ms)
 {
-  auto next = time_cbs_.begin();
-  if (next == time_cbs_.end())
+  if (!deferred_cbs_.empty() || expired_.next_ != &expired_)
+    return 0;
+  if (!nwheel_)
     return ms;
-  int64_t now = now_ms();
-  if (now >= next->first)
+  // May be early if the next non-empty slot is not at level 0, in
+  // which case poll wakes up, cascades the slot, and sleeps again.
+  int64_t wait = wheel_next() * tres_ - now_ms();
+  if (wait <= 0)
     return 0;
-  int64_t wait = next->first - now;
   if (wait > std::numeric_limits<int>::max())
     wait = std::numeric_limits<int>::max();
   if (ms >= 0 && ms <= wait)
@@ -214,66 +345,366 @@ pollset::next_timeout(int ms)
 }
 
 void
-pollset::poll(int timeout)
+pollset::fd_ready(int fd, op_t op)
 {
-  int r = ::poll(pollfds_.data(), pollfds_.size(), next_timeout(timeout));
-  if (r < 0) {
-    if (errno == EINTR)
-      return;
-    std::cerr << "poll: " << sock_errmsg() << std::endl;
-    std::terminate();
+  fd_state &fi = state_[fd];
+  cb_t &cbr = op == Read ? fi.rcb : fi.wcb;
+  if (!cbr)
+    return;
+  if (op == Read ? fi.roneshot : fi.woneshot) {
+    cb_t cb {std::move(cbr)};
+    fd_cb(sock_t(fd), op);
+    cb();
   }
-  size_t maxpoll = pollfds_.size();
-  for (size_t i = 0; r > 0 && i < maxpoll; i++) {
-    pollfd *pfp = &pollfds_.at(i);
-    fd_state &fi = state_.at(sock_t(pfp->fd)); // XXX
-    assert (!(pfp->revents & POLLNVAL));
-    if (pfp->revents)
-      --r;
-    if (pfp->revents & (POLLIN|POLLHUP|POLLERR) && fi.rcb) {
-      if (fi.roneshot) {
-	cb_t cb {std::move(fi.rcb)};
-	fi.rcb = nullptr;
-	pfp->events &= ~POLLIN;
-	cb();
-      }
-      else
-	fi.rcb();
+  else
+    cbr();
+}
+
+void
+pollset::poll(int timeout)
+{
+  if (epfd_ >= 0)
+    epoll_poll(next_timeout(timeout));
+  else {
+    int r = ::poll(pollfds_.data(), pollfds_.size(), next_timeout(timeout));
+    if (r < 0) {
+      if (errno == EINTR)
+	return;
+      std::cerr << "poll: " << sock_errmsg() << std::endl;
+      std::terminate();
     }
-    pfp = &pollfds_.at(i); // callback might have resized vector
-    if (pfp->revents & (POLLOUT|POLLHUP|POLLERR) && fi.wcb) {
-      if (fi.woneshot) {
-	cb_t cb {std::move(fi.wcb)};
-	fi.wcb = nullptr;
-	pfp->events &= ~POLLOUT;
-	cb();
-      }
-      else
-	fi.wcb();
+    size_t maxpoll = pollfds_.size();
+    for (size_t i = 0; r > 0 && i < maxpoll; i++) {
+      // Callbacks might resize pollfds_, so copy what we need.
+      const pollfd pfd = pollfds_.at(i);
+      assert (!(pfd.revents & POLLNVAL));
+      if (!pfd.revents)
+	continue;
+      --r;
+      if (pfd.revents & (POLLIN|POLLHUP|POLLERR))
+	fd_ready(pfd.fd, Read);
+      if (pfd.revents & (POLLOUT|POLLHUP|POLLERR))
+	fd_ready(pfd.fd, Write);
     }
   }
 
   run_timeouts();
   run_subtype_handlers();
+  run_deferred();
   consolidate();
 }
 
+#ifdef __linux__
+
+void
+pollset::epoll_remove(int fd, fd_state &fs)
+{
+  if (fs.rcb || fs.wcb) {
+    if (!fs.dirty) {
+      fs.dirty = true;
+      dirty_.push_back(fd);
+    }
+    return;
+  }
+  if (!fs.active)
+    return;
+  fs.active = false;
+  --nfds_;
+  // Deregister now, since the caller may be about to close fd.
+  if (fs.kevents) {
+    fs.kevents = 0;
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+void
+pollset::epoll_sync()
+{
+  for (int fd : dirty_) {
+    fd_state &fs = state_[fd];
+    fs.dirty = false;
+    std::uint32_t want = (fs.rcb ? std::uint32_t(EPOLLIN) : 0)
+      | (fs.wcb ? std::uint32_t(EPOLLOUT) : 0);
+    if (want == fs.kevents)
+      continue;
+    epoll_event ev {};
+    ev.events = want;
+    ev.data.fd = fd;
+    int op = !want ? EPOLL_CTL_DEL
+      : fs.kevents ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int r = epoll_ctl(epfd_, op, fd, &ev);
+    // The kernel drops closed file descriptors on its own, so fd may
+    // be a new file that reused the number.
+    if (r == -1 && errno == ENOENT && op == EPOLL_CTL_MOD)
+      r = epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev);
+    if (r == -1 && !(errno == ENOENT && op == EPOLL_CTL_DEL)) {
+      std::cerr << "epoll_ctl: fd " << fd << ": " << sock_errmsg()
+		<< std::endl;
+      std::terminate();
+    }
+    fs.kevents = want;
+  }
+  dirty_.clear();
+}
+
+void
+pollset::epoll_poll(int ms)
+{
+  epoll_sync();
+
+  // Level-triggered, so anything not returned in this batch is
+  // returned by the next call.
+  constexpr int maxevents = 256;
+  epoll_event evs[maxevents];
+  int r = epoll_wait(epfd_, evs, maxevents, ms);
+  if (r < 0) {
+    if (errno == EINTR)
+      return;
+    std::cerr << "epoll_wait: " << sock_errmsg() << std::endl;
+    std::terminate();
+  }
+  for (int i = 0; i < r; i++) {
+    if (evs[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+      fd_ready(evs[i].data.fd, Read);
+    if (evs[i].events & (EPOLLOUT|EPOLLHUP|EPOLLERR))
+      fd_ready(evs[i].data.fd, Write);
+  }
+}
+
+#else // !__linux__
+
+void
+pollset::epoll_remove(int, fd_state &)
+{
+  std::terminate();
+}
+
+void
+pollset::epoll_sync()
+{
+}
+
+void
+pollset::epoll_poll(int)
+{
+  std::terminate();
+}
+
+#endif // !__linux__
+
+void
+pollset::run_deferred()
+{
+  // Callbacks may defer more callbacks, which also run now.
+  while (!deferred_cbs_.empty()) {
+    std::vector<cb_t> cbs;
+    cbs.swap(deferred_cbs_);
+    for (cb_t &cb : cbs)
+      cb();
+  }
+}
+
 void
 pollset::run_timeouts()
 {
-  auto i = time_cbs_.begin();
-  if (i != time_cbs_.end()) {
-    int64_t now = now_ms();
-    while (i != time_cbs_.end() && now >= i->first) {
-      struct cleanup {
-	cb_t cb_;
-	~cleanup() { cb_(); }
-      } c {[&]() { time_cbs_.erase(i++); }};
-      i->second();
+  if (!ntimers_)
+    return;
+  wheel_advance(now_ms() / tres_);
+  while (expired_.next_ != &expired_) {
+    timer *t = static_cast<timer *>(expired_.next_);
+    cb_t cb {std::move(t->cb_)};
+    timer_free(t);
+    cb();
+  }
+}
+
+namespace {
+
+// Move all of \c from to the end of \c to.
+template<typename Link> inline void
+splice(Link &to, Link &from)
+{
+  if (from.next_ == &from)
+    return;
+  from.next_->prev_ = to.prev_;
+  to.prev_->next_ = from.next_;
+  from.prev_->next_ = &to;
+  to.prev_ = from.prev_;
+  from.next_ = from.prev_ = &from;
+}
+
+// Distance from bit \c from to the next set bit of non-zero \c map,
+// wrapping around.
+inline int
+next_bit(std::uint64_t map, int from)
+{
+  if (from)
+    map = map >> from | map << (64 - from);
+  return __builtin_ctzll(map);
+}
+
+}
+
+pollset::timer *
+pollset::timer_add(std::int64_t ms, cb_t &&cb)
+{
+  timer *t;
+  if (free_timers_) {
+    t = static_cast<timer *>(free_timers_);
+    free_timers_ = t->next_;
+  }
+  else
+    t = new timer;
+  t->when_ = ms;
+  t->cb_ = std::move(cb);
+  ++ntimers_;
+  wheel_skip();
+  timer_insert(t);
+  return t;
+}
+
+// Unlinks t and keeps it for reuse.
+void
+pollset::timer_free(timer *t)
+{
+  timer_unlink(t);
+  t->cb_ = nullptr;
+  t->next_ = free_timers_;
+  free_timers_ = t;
+  --ntimers_;
+}
+
+void
+pollset::timer_insert(timer *t)
+{
+  static_assert(wheel_slots == 64, "wheel_map_ must have a bit per slot");
+  t->tick_ = t->when_ > 0 ? (t->when_ - 1) / tres_ + 1 : 0;
+
+  tlink *head;
+  if (t->tick_ < tick_) {
+    t->slot_ = -1;
+    head = &expired_;
+  }
+  else {
+    // Timeouts beyond the outermost level go in its furthest slot
+    // and are re-inserted when it cascades.
+    constexpr std::uint64_t horizon =
+      std::uint64_t(1) << (wheel_bits * wheel_levels);
+    std::uint64_t delta = t->tick_ - tick_;
+    std::int64_t tick = delta < horizon ? t->tick_ : tick_ + horizon - 1;
+    int level = 0;
+    while (level < wheel_levels - 1
+	   && delta >> (wheel_bits * (level + 1)))
+      ++level;
+    int slot = tick >> (wheel_bits * level) & (wheel_slots - 1);
+    wheel_map_[level] |= std::uint64_t(1) << slot;
+    t->slot_ = level * wheel_slots + slot;
+    head = &wheel_[t->slot_];
+    ++nwheel_;
+  }
+  t->prev_ = head->prev_;
+  t->next_ = head;
+  head->prev_->next_ = t;
+  head->prev_ = t;
+}
+
+void
+pollset::timer_unlink(timer *t)
+{
+  t->prev_->next_ = t->next_;
+  t->next_->prev_ = t->prev_;
+  if (t->slot_ >= 0) {
+    --nwheel_;
+    tlink &head = wheel_[t->slot_];
+    if (head.next_ == &head)
+      wheel_map_[t->slot_ / wheel_slots] &=
+	~(std::uint64_t(1) << t->slot_ % wheel_slots);
+  }
+}
+
+// When the wheel is empty, there is nothing to move to expired_, so
+// skip over the ticks that went by idle.
+void
+pollset::wheel_skip()
+{
+  if (!nwheel_)
+    tick_ = std::max(tick_, now_ms() / tres_);
+}
+
+// Returns a lower bound on the tick of the earliest timeout in the
+// wheel, which must not be empty.  Exact if that timeout is at level
+// 0.  A slot at level l holds timeouts whose tick, shifted right by
+// wheel_bits * l, is at most wheel_slots more than tick_'s; it is
+// equal only if the slot has not cascaded yet.
+std::int64_t
+pollset::wheel_next() const
+{
+  std::int64_t next = std::numeric_limits<std::int64_t>::max();
+  for (int level = 0; level < wheel_levels; level++) {
+    std::uint64_t map = wheel_map_[level];
+    if (!map)
+      continue;
+    int shift = wheel_bits * level;
+    std::int64_t base = tick_ >> shift;
+    int slot = base & (wheel_slots - 1);
+    bool pending = !(tick_ & ((std::int64_t(1) << shift) - 1));
+    std::int64_t d = pending ? next_bit(map, slot)
+      : next_bit(map, (slot + 1) % wheel_slots) + 1;
+    next = std::min(next, (base + d) << shift);
+  }
+  return next;
+}
+
+// Redistribute the slots whose span starts at tick_ into lower
+// levels, outermost first.
+void
+pollset::wheel_cascade()
+{
+  for (int level = wheel_levels - 1; level > 0; level--) {
+    int shift = wheel_bits * level;
+    if (tick_ & ((std::int64_t(1) << shift) - 1))
+      continue;
+    int slot = tick_ >> shift & (wheel_slots - 1);
+    if (!(wheel_map_[level] & std::uint64_t(1) << slot))
+      continue;
+    tlink list;
+    splice(list, wheel_[level * wheel_slots + slot]);
+    wheel_map_[level] &= ~(std::uint64_t(1) << slot);
+    while (list.next_ != &list) {
+      timer *t = static_cast<timer *>(list.next_);
+      list.next_ = t->next_;
+      t->next_->prev_ = &list;
+      --nwheel_;
+      timer_insert(t);
     }
   }
 }
 
+// Move every timeout due at or before \c tick to expired_.  Jumps
+// straight between non-empty slots.
+void
+pollset::wheel_advance(std::int64_t tick)
+{
+  while (nwheel_ && tick_ <= tick) {
+    wheel_cascade();
+    int slot = tick_ & (wheel_slots - 1);
+    tlink &head = wheel_[slot];
+    if (head.next_ != &head) {
+      for (tlink *l = head.next_; l != &head; l = l->next_) {
+	static_cast<timer *>(l)->slot_ = -1;
+	--nwheel_;
+      }
+      splice(expired_, head);
+      wheel_map_[0] &= ~(std::uint64_t(1) << slot);
+    }
+    ++tick_;
+    if (nwheel_)
+      tick_ = std::min(wheel_next(), tick + 1);
+  }
+  if (tick_ <= tick)
+    tick_ = tick + 1;
+}
+
 void
 pollset_plus::run_subtype_handlers()
 {
@@ -312,9 +743,7 @@ void
 pollset::consolidate()
 {
   while (!pollfds_.empty() && !pollfds_.back().events) {
-    auto fi = state_.find(sock_t(pollfds_.back().fd)); // XXX
-    if (fi != state_.end())
-      state_.erase(fi);
+    state_[pollfds_.back().fd].idx = -1; // XXX
     pollfds_.pop_back();
   }
 
@@ -326,12 +755,10 @@ pollset::consolidate()
       pollfd &pfd1 = pollfds_.at(i);
       if (pfd1.events)
 	continue;
-      auto fi = state_.find(sock_t(pfd1.fd)); // XXX
-      if (fi != state_.end())
-	state_.erase(fi);
+      state_[pfd1.fd].idx = -1;	// XXX
     }
     const pollfd &pfd = pollfds_[i] = pollfds_.back();
-    state_.at(sock_t(pfd.fd)).idx = i; // XXX
+    state_[pfd.fd].idx = i;	// XXX
     pollfds_.pop_back();
   }
 }
@@ -417,8 +844,7 @@ void
 pollset::timeout_cancel(Timeout &t)
 {
   if (t) {
-    assert(time_cbs_.find(t.i_->first) != time_cbs_.end());
-    time_cbs_.erase(t.i_);
+    timer_free(t.t_);
     t = timeout_null();
   }
 }
@@ -426,9 +852,30 @@ pollset::timeout_cancel(Timeout &t)
 void
 pollset::timeout_reschedule_at(Timeout &t, std::int64_t ms)
 {
-  auto i = t.i_;
-  t.i_ = time_cbs_.emplace(ms, std::move(i->second));
-  time_cbs_.erase(i);
+  timer_unlink(t.t_);
+  t.t_->when_ = ms;
+  wheel_skip();
+  timer_insert(t.t_);
+}
+
+void
+pollset::set_timeout_resolution(std::int64_t ms)
+{
+  assert(ms > 0);
+  tlink list;
+  for (tlink &head : wheel_)
+    splice(list, head);
+  for (std::uint64_t &map : wheel_map_)
+    map = 0;
+  nwheel_ = 0;
+  tres_ = ms;
+  tick_ = now_ms() / tres_;
+  while (list.next_ != &list) {
+    timer *t = static_cast<timer *>(list.next_);
+    list.next_ = t->next_;
+    t->next_->prev_ = &list;
+    timer_insert(t);
+  }
 }
 
 }
@@ -5,7 +5,10 @@
 
 /** \file pollset.h Asynchronous I/O and event harness. */
 
+#include <atomic>
+#include <condition_variable>
 #include <csignal>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
@@ -16,6 +19,7 @@
 #include <vector>
 #include <poll.h>
 #include <xdrpp/socket.h>
+#include <xdrpp/threadpool.h>
 
 namespace xdr {
 
@@ -42,6 +46,19 @@ public:
     WriteOnce = kWriteFlag | kOnceFlag
   };
 
+  //! Mechanism used to wait for file descriptors, chosen when the
+  //! pollset is constructed.
+  enum backend_t {
+    //! \c poll(2), which scans every registered file descriptor on
+    //! each call, so its cost grows with the number of idle ones.
+    Poll,
+    //! Level-triggered \c epoll(7), whose cost grows only with the
+    //! number of ready file descriptors.  Linux only; elsewhere the
+    //! pollset uses \c Poll instead.  Note that \c epoll cannot wait
+    //! on regular files.
+    Epoll
+  };
+
   using cb_t = std::function<void()>;
 
 private:
@@ -49,30 +66,86 @@ private:
   struct fd_state {
     cb_t rcb;
     cb_t wcb;
-    int idx {-1};		// Index in pollfds_
-    bool roneshot;
-    bool woneshot;
+    int idx {-1};		// Index in pollfds_ (Poll)
+    std::uint32_t kevents {0};	// Events registered with epoll
+    bool dirty {false};		// In dirty_, kevents may be stale (Epoll)
+    bool active {false};	// Counted in nfds_ (Epoll)
+    bool roneshot {false};
+    bool woneshot {false};
     ~fd_state();		// Sanity check no active callbacks
   };
 
-  // File descriptor callback state
+  // File descriptor callback state, indexed by file descriptor.  A
+  // deque, because callbacks hold references to their own entry
+  // while registering new file descriptors.
+  std::deque<fd_state> state_;
   std::vector<pollfd> pollfds_;
-  std::unordered_map<sock_t, fd_state> state_;
 
-  // Timeout callback state
-  std::multimap<std::int64_t, cb_t> time_cbs_;
+  // Epoll state.  Changes other than removal are batched until the
+  // next poll.
+  int epfd_ {-1};
+  std::vector<int> dirty_;
+  std::size_t nfds_ {0};
+
+  // Timeout callback state: a hierarchical timing wheel, so arming,
+  // cancelling, and rescheduling are O(1).  Time advances in ticks of
+  // tres_ milliseconds.  Level l has wheel_slots slots, each spanning
+  // wheel_slots^l ticks; wheel_map_ has a bit set for each non-empty
+  // slot.  Timeouts move to expired_ when due, and run from there.
+  struct tlink {
+    tlink *next_ {this};
+    tlink *prev_ {this};
+  };
+  struct timer : tlink {
+    std::int64_t when_;		// Requested time in milliseconds
+    std::int64_t tick_;		// when_ in ticks, rounded up
+    int slot_;			// Index in wheel_, or -1 in expired_
+    cb_t cb_;
+  };
+  static constexpr int wheel_bits = 6;
+  static constexpr int wheel_slots = 1 << wheel_bits;
+  static constexpr int wheel_levels = 6;
+  tlink wheel_[wheel_levels * wheel_slots];
+  std::uint64_t wheel_map_[wheel_levels] {};
+  tlink expired_;
+  tlink *free_timers_ {nullptr};
+  std::int64_t tres_ {1};
+  std::int64_t tick_;		// First tick not yet moved to expired_
+  std::size_t ntimers_ {0};	// Including expired_
+  std::size_t nwheel_ {0};	// Excluding expired_
+
+  // Callbacks to run at the end of the current poll
+  std::vector<cb_t> deferred_cbs_;
 
   cb_t &fd_cb_helper(sock_t s, op_t op);
+  void fd_ready(int fd, op_t op);
+  void epoll_poll(int ms);
+  void epoll_sync();
+  void epoll_remove(int fd, fd_state &fs);
   void consolidate();
   int next_timeout(int ms);
   void run_timeouts();
+  timer *timer_add(std::int64_t ms, cb_t &&cb);
+  void timer_insert(timer *t);
+  void timer_unlink(timer *t);
+  void timer_free(timer *t);
+  void wheel_skip();
+  std::int64_t wheel_next() const;
+  void wheel_cascade();
+  void wheel_advance(std::int64_t tick);
+  void run_deferred();
 
   // Hook for subtypes
   virtual void run_subtype_handlers() {}
 
 public:
-  pollset() = default;
+  explicit pollset(backend_t b = Poll);
   pollset(const pollset &) = delete;
+  virtual ~pollset();
+
+  //! The mechanism actually in use, which may be \c Poll even if \c
+  //! Epoll was requested.
+  backend_t backend() const { return epfd_ >= 0 ? Epoll : Poll; }
 
   //! Go through one round of checking all file descriptors.  \arg \c
   //! timeout is a timeout in milliseconds (or -1 to wait forever).
@@ -115,6 +188,15 @@ public:
   //! descriptor.
   void fd_cb(sock_t s, op_t op, std::nullptr_t = nullptr);
 
+  //! Run a callback once, at the end of the current call to
+  //! PollSet::poll (after all file descriptor callbacks, timeouts,
+  //! and signal handlers), or, if not called from within \c poll, at
+  //! the end of the next one (which then does not sleep).  Useful for
+  //! batching work generated by several callbacks.
+  template<typename CB> void defer_cb(CB &&cb) {
+    deferred_cbs_.emplace_back(std::forward<CB>(cb));
+  }
+
   //! Number of milliseconds since an arbitrary but fixed time, used
   //! as the basis of all timeouts.  Time zero is
   //! std::chrono::steady_clock's epoch, which in some implementations
@@ -123,35 +205,31 @@ public:
 
   //! Abstract class used to represent a pending timeout.
   class Timeout {
-    using iterator = decltype(time_cbs_)::iterator;
-    iterator i_;
-    explicit Timeout(iterator i) : i_(i) {}
-    Timeout &operator=(iterator i) { i_ = i; return *this; }
+    timer *t_;
+    explicit Timeout(timer *t) : t_(t) {}
     friend class pollset;
   public:
-    //! A null timeout.  Relies on static initalization.
+    //! A null timeout.
     static const Timeout null_;
-    //! After static initialization, Timeouts are null by default.
-    //! However, since \c null_ relies on static initialization,
-    //! static/global Timeouts are not guaranteed to be null and
-    //! should be explicitly initialized from \c
-    //! pollset::timeout_null().
-    Timeout() : i_(null_.i_) {}
-    explicit operator bool() const { return i_ != null_.i_; }
+    //! Timeouts are null by default.
+    Timeout() : t_(nullptr) {}
+    explicit operator bool() const { return t_; }
   };
 
   //! Set a callback to run a certain number of milliseconds from now.
   //! \arg \c ms is the delay in milliseconds before running the
   //! callback.  \arg \c cb must be convertible to PollSet::cb_t.
   //! \returns an object on which you can call the method
-  //! PollSet::timeout_cancel to cancel the timeout.
+  //! PollSet::timeout_cancel to cancel the timeout.  Once the timeout
+  //! fires, the object and all its copies are invalid, even within
+  //! \c cb itself, and must not be cancelled or rescheduled.
   template<typename CB> Timeout timeout(std::int64_t ms, CB &&cb) {
     return timeout_at(now_ms() + ms, std::forward<CB>(cb));
   }
   //! Set a callback to run at a specific time (as returned by
   //! PollSet::now_ms()).
   template<typename CB> Timeout timeout_at(std::int64_t ms, CB &&cb) {
-    return Timeout(time_cbs_.emplace(ms, std::forward<CB>(cb)));
+    return Timeout(timer_add(ms, std::forward<CB>(cb)));
   }
 
   //! An invalid timeout, useful for initializing PollSet::Timeout
@@ -165,15 +243,22 @@ public:
 
   //! Returns the absolute time (in milliseconds) at which a timeout
   //! will run.
-  std::int64_t timeout_time(Timeout t) const { return t.i_->first; }
+  std::int64_t timeout_time(Timeout t) const { return t.t_->when_; }
 
-  //! Reschedule a timeout to run at a specific time.  Updates the
-  //! argument \c t, but invalidates any other copies of \c t.
+  //! Reschedule a timeout to run at a specific time.  The timeout
+  //! keeps its identity, so copies of \c t remain valid.
   void timeout_reschedule_at(Timeout &t, std::int64_t ms);
   //! Reschedule a timeout some number of milliseconds in the future.
   void timeout_reschedule(Timeout &t, std::int64_t ms) {
     timeout_reschedule_at(t, now_ms() + ms);
   }
+
+  //! Set the granularity of timeouts in milliseconds (default 1).
+  //! Timeouts never run early, but may run up to \c ms - 1
+  //! milliseconds late.  Timeouts due in the same tick are handled
+  //! together, so coarser ticks make busy timer loads cheaper.
+  void set_timeout_resolution(std::int64_t ms);
+  std::int64_t timeout_resolution() const { return tres_; }
 };
 
 //! Adds support for signal handlers, asynchonous events, and
@@ -191,25 +276,31 @@ class pollset_plus : public pollset {
     std::function<R()> work_;
     std::function<void(R)> cb_;
     std::unique_ptr<R> rp_;
-
-    void start() {
-      rp_.reset(new R { work_() });
-      ps_->inject_cb(std::bind(&async_task::done, this));
-    }
-    void done() {
-      std::unique_ptr<async_task> self {this};
-      ps_->nasync_--;
-      cb_(std::move(*rp_));
-    }
   };
 
-  // Self-pipe used to wake up poll from signal handlers and other threads
-  sock_t selfpipe_[2];
+  // Workers for async, created on first use unless set
+  std::shared_ptr<thread_pool> pool_;
+
+  // Tasks submitted to pool_ that have yet to inject their callback.
+  // The destructor waits for them, as the pool may outlive us.
+  std::mutex tasks_lock_;
+  std::condition_variable tasks_done_;
+  size_t ntasks_{0};
 
-  // Asynchronous events enqueued from other threads
-  std::mutex async_cbs_lock_;
-  std::vector<cb_t> async_cbs_;
-  bool async_pending_{false};
+  // Self-pipe used to wake up poll from signal handlers and other
+  // threads.  On Linux, both ends are the same eventfd.
+  sock_t selfpipe_[2];
+  std::atomic<bool> signal_wake_{false};
+
+  // Asynchronous events enqueued from other threads, on a lock-free
+  // stack (newest first).  Only a push onto an empty stack wakes the
+  // poll, which then takes the whole stack.
+  struct async_cb {
+    async_cb *next_;
+    cb_t cb_;
+  };
+  std::atomic<async_cb *> async_head_{nullptr};
+  async_cb *async_backlog_{nullptr}; // Taken, not yet run (oldest first)
   size_t nasync_{0};
 
   // Signal callback state
@@ -222,14 +313,15 @@ class pollset_plus : public pollset {
 
   void wake(wake_type wt);
   void run_pending_asyncs();
-  void inject_cb_vec(std::vector<cb_t>::iterator b,
-		     std::vector<cb_t>::iterator e);
+  void push_async(async_cb *c);
+  void task_submitted();
+  void task_done();
   void run_subtype_handlers() override;
   static void signal_handler(int);
   static void erase_signal_cb(int);
 
 public:
-  pollset_plus();
+  explicit pollset_plus(backend_t b = Poll);
   ~pollset_plus();
 
   bool pending() const override;
@@ -242,16 +334,12 @@ public:
   //! Inject a callback to run immediately.  Unlike most methods, it
   //! is safe to call this function from another thread.  Being
   //! thread-safe adds extra overhead, so it does not make sense to
-  //! call this function from the same thread as PollSet::poll.  Note
-  //! that \c inject_cb acquires a lock and definitely must <i>not</i>
-  //! be called from a signal handler (or deadlock could ensue).
+  //! call this function from the same thread as PollSet::poll.
+  //! Callbacks run in the order injected.  \c inject_cb takes no
+  //! lock, but allocates memory, so must <i>not</i> be called from a
+  //! signal handler.
   template<typename CB> void inject_cb(CB &&cb) {
-    std::lock_guard<std::mutex> lk(async_cbs_lock_);
-    async_cbs_.emplace_back(std::forward<CB>(cb));
-    if (!async_pending_) {
-      async_pending_ = true;
-      wake();
-    }
+    push_async(new async_cb{nullptr, std::forward<CB>(cb)});
   }
 
   //! Execute a task asynchonously in another thread, then run
@@ -260,15 +348,44 @@ public:
   //! be convertible to std::function<R()> for some type \c R.  \arg
   //! \c cb is the callback that processes the result in the main
   //! thread, and must be convertible to std::function<void(R)> for
-  //! the same type \c R.
-  template<typename Work, typename CB> void async(Work &&work, CB &&cb) {
+  //! the same type \c R.  \arg \c priority orders the task among
+  //! others waiting for a worker (see \c thread_pool).  Returns \c
+  //! false, and never calls \c cb, if the pool rejects the task.
+  template<typename Work, typename CB>
+  bool async(Work &&work, CB &&cb, int priority = 0) {
     using R = decltype(work());
-    async_task<R> *a = new async_task<R> {
-      this, std::forward<Work>(work), std::forward<CB>(cb), nullptr
-    };
+    std::shared_ptr<async_task<R>> a {new async_task<R> {
+	this, std::forward<Work>(work), std::forward<CB>(cb), nullptr
+      }};
+    thread_pool &pool = get_thread_pool();
     ++nasync_;
-    std::thread(&async_task<R>::start, a).detach();
+    task_submitted();
+    bool ok = pool.submit([a]() {
+	a->rp_.reset(new R { a->work_() });
+	a->ps_->inject_cb([a]() {
+	    a->ps_->nasync_--;
+	    a->cb_(std::move(*a->rp_));
+	  });
+	a->ps_->task_done();
+      }, priority);
+    if (!ok) {
+      --nasync_;
+      task_done();
+    }
+    return ok;
+  }
+
+  //! Run \c async tasks on \c pool, which may be shared with other
+  //! pollsets.  Otherwise, the first \c async creates a private pool
+  //! with a thread per CPU and an unbounded queue.  Since tasks wait
+  //! for a free worker, a task must not wait for a later one.  The
+  //! destructor waits for this pollset's tasks to finish (but does
+  //! not run their callbacks), so it must not be called from a task
+  //! on the same pool.
+  void set_thread_pool(std::shared_ptr<thread_pool> pool) {
+    pool_ = std::move(pool);
   }
+  thread_pool &get_thread_pool();
 
   //! Add a callback for a particular signal.  Note that only one
   //! callback can be added for a particular signal across all
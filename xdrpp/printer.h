@@ -45,18 +45,26 @@ struct Printer {
 
   void operator()(const char *field, xdr_void) { bol(field) << "void"; }
 
-  template<std::uint32_t N> void
-  operator()(const char *field, const xstring<N> &s) {
-    p(field, escape_string(s));
+  template<std::uint32_t N, typename A> void
+  operator()(const char *field, const xstring<N,A> &s) {
+    p(field, escape_string(std::string(s.data(), s.size())));
   }
   template<std::uint32_t N> void
   operator()(const char *field, const opaque_array<N> &v) {
     p(field, hexdump(v.data(), v.size()));
   }
+  template<std::uint32_t N, typename A>
+  void operator()(const char *field, const xvector<std::uint8_t,N,A> &v) {
+    p(field, hexdump(v.data(), v.size()));
+  }
   template<std::uint32_t N>
-  void operator()(const char *field, const opaque_vec<N> &v) {
+  void operator()(const char *field, const opaque_view<N> &v) {
     p(field, hexdump(v.data(), v.size()));
   }
+  template<std::uint32_t N>
+  void operator()(const char *field, const xstring_view<N> &s) {
+    p(field, escape_string(s.str()));
+  }
 
   template<typename T> ENABLE_IF(xdr_traits<T>::is_enum)
   operator()(const char *field, T t) {
@@ -75,7 +83,8 @@ struct Printer {
     archive(*this, std::get<0>(t), field);
   }
 
-  template<typename T> void operator()(const char *field, const pointer<T> &t) {
+  template<typename T, typename A>
+  void operator()(const char *field, const pointer<T,A> &t) {
     if (t)
       archive(*this, *t, field);
     else
@@ -1,6 +1,13 @@
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <xdrpp/arena.h>
 #include <xdrpp/server.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif // __linux__
 
 namespace xdr {
 
@@ -76,15 +83,21 @@ rpc_server_base::register_service_base(service_base *s)
 }
 
 void
-rpc_server_base::dispatch(void *session, msg_ptr m, service_base::cb_t reply)
+rpc_server_base::dispatch(void *session, msg_ptr m, service_base::cb_t reply,
+			  arena *a)
 {
+  if (m->size() & 3) {
+    std::cerr << "rpc_server_base::dispatch: ignoring message of bad size"
+	      << std::endl;
+    return;
+  }
   xdr_get g(m);
   rpc_msg hdr;
 
-  try { archive(g, hdr); }
-  catch (const xdr_runtime_error &e) {
+  xdr_status st = xdr_try_get(g, hdr);
+  if (!st) {
     std::cerr << "rpc_server_base::dispatch: ignoring malformed header: "
-	      << e.what() << std::endl;
+	      << st.what() << std::endl;
     return;
   }
   if (hdr.body.mtype() != CALL) {
@@ -107,7 +120,8 @@ rpc_server_base::dispatch(void *session, msg_ptr m, service_base::cb_t reply)
   }
 
   try {
-    vers->second->process(session, hdr, g, reply);
+    arena_scope scope(a);
+    vers->second->process(session, hdr, g, m, reply);
     return;
   }
   catch (const xdr_runtime_error &e) {
@@ -116,6 +130,59 @@ rpc_server_base::dispatch(void *session, msg_ptr m, service_base::cb_t reply)
   reply(rpc_accepted_error_msg(hdr.xid, GARBAGE_ARGS));
 }
 
+rpc_loopback::~rpc_loopback()
+{
+  *destroyed_ = true;
+  decltype(calls_) calls(std::move(calls_));
+  calls_.clear();
+  for (auto &call : calls)
+    try { call.second(nullptr); }
+    catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+}
+
+void
+rpc_loopback::send_call(msg_ptr &b, rcb_t cb)
+{
+  calls_.emplace(b->word(0), std::move(cb));
+  if (pending_.empty())
+    ps_.defer_cb([this,destroyed=destroyed_]() {
+	if (!*destroyed)
+	  flush();
+      });
+  pending_.push_back(std::move(b));
+}
+
+void
+rpc_loopback::flush()
+{
+  std::vector<msg_ptr> pending;
+  pending.swap(pending_);
+  std::shared_ptr<bool> destroyed{destroyed_};
+  for (msg_ptr &m : pending) {
+    srv_.dispatch(session_, std::move(m), [this,destroyed](msg_ptr r) {
+	if (!*destroyed && r)
+	  recv_reply(std::move(r));
+      });
+    if (*destroyed)
+      return;
+  }
+}
+
+void
+rpc_loopback::recv_reply(msg_ptr b)
+{
+  auto calli = b->size() >= 8 ? calls_.find(b->word(0)) : calls_.end();
+  if (calli == calls_.end()) {
+    std::cerr << "rpc_loopback: ignoring reply to unknown call" << std::endl;
+    return;
+  }
+  auto cb (std::move(calli->second));
+  calls_.erase(calli);
+  cb(std::move(b));
+}
+
 
 rpc_tcp_listener_common::rpc_tcp_listener_common(pollset &ps, unique_sock &&s,
 						 bool reg)
@@ -129,6 +196,12 @@ rpc_tcp_listener_common::rpc_tcp_listener_common(pollset &ps, unique_sock &&s,
 
 rpc_tcp_listener_common::~rpc_tcp_listener_common()
 {
+  if (aop_)
+    ring_->release(aop_);
+  for (sock_t s : shm_pending_) {
+    ps_.fd_cb(s, pollset::Read);
+    close(s);
+  }
   ps_.fd_cb(listen_sock_.get(), pollset::Read);
   // XXX should clean up if use_rpcbind_.
 }
@@ -143,11 +216,91 @@ rpc_tcp_listener_common::accept_cb()
     return;
   }
   set_close_on_exec(s);
+  accepted(s);
+}
+
+void
+rpc_tcp_listener_common::accepted(sock_t s)
+{
+  if (shm_) {
+    shm_pending_.push_back(s);
+    ps_.fd_cb(s, pollset::Read, [this,s](){ shm_handshake(s); });
+  }
+  else
+    serve(s, nullptr);
+}
+
+void
+rpc_tcp_listener_common::shm_handshake(sock_t s)
+{
+  std::unique_ptr<shm_link> l;
+  try {
+    l = shm_link::accept(s);
+    if (!l)
+      return;
+  }
+  catch (const std::system_error &e) {
+    std::cerr << "rpc_tcp_listener_common: " << e.what() << std::endl;
+  }
+  ps_.fd_cb(s, pollset::Read);
+  shm_pending_.erase(std::find(shm_pending_.begin(), shm_pending_.end(), s));
+  if (l)
+    serve(s, std::move(l));
+  else
+    close(s);
+}
+
+void
+rpc_tcp_listener_common::serve(sock_t s, std::unique_ptr<shm_link> l)
+{
   rpc_sock *ms = new rpc_sock(ps_, s);
+  if (l)
+    ms->ms_->set_shm(std::move(l));
+  else
+    ms->ms_->set_uring(ring_);
+  // Replies to pipelined calls go out together.
+  ms->ms_->set_cork(true);
+  ms->ms_->set_watermarks(wlow_, whigh_, [ms](bool blocked) {
+      if (blocked)
+	ms->ms_->pause_input();
+      else
+	ms->ms_->resume_input();
+    });
+  ms->ms_->set_wmax(wmax_);
   ms->set_servcb(std::bind(&rpc_tcp_listener_common::receive_cb, this, ms,
 			   session_alloc(ms), std::placeholders::_1));
 }
 
+bool
+rpc_tcp_listener_common::set_uring(io_ring *r)
+{
+  if (!r)
+    return false;
+  assert(!ring_);
+  ring_ = r;
+  ps_.fd_cb(listen_sock_.get(), pollset::Read);
+  uring_accept();
+  return true;
+}
+
+void
+rpc_tcp_listener_common::uring_accept()
+{
+  // Accepted sockets have close-on-exec set already.
+  aop_ = ring_->accept_multishot(listen_sock_.get(),
+				 [this](int res, unsigned flags, const char *) {
+      if (!io_ring::more(flags))
+	aop_ = nullptr;
+      if (res >= 0)
+	accepted(sock_t(res));
+      else if (res != -ECANCELED)
+	std::cerr << "rpc_tcp_listener_common: accept: "
+		  << std::strerror(-res) << std::endl;
+      if (!aop_)
+	uring_accept();
+    });
+}
+
 void
 rpc_tcp_listener_common::receive_cb(rpc_sock *ms, void *session, msg_ptr mp)
 {
@@ -166,4 +319,109 @@ rpc_tcp_listener_common::receive_cb(rpc_sock *ms, void *session, msg_ptr mp)
   }
 }
 
+
+rpc_tcp_multi_listener_common::rpc_tcp_multi_listener_common(
+    std::size_t nloops, const char *service, int family,
+    pollset::backend_t backend)
+{
+  if (!nloops)
+    nloops = std::max(1u, std::thread::hardware_concurrency());
+
+  // Bind the first socket, then the rest to whatever port it got.
+  socks_.push_back(tcp_listen(service, family, SOMAXCONN, true));
+  sockaddr_storage ss;
+  socklen_t sslen = sizeof ss;
+  if (getsockname(socks_[0].get().fd_, reinterpret_cast<sockaddr *>(&ss),
+		  &sslen) == -1)
+    throw_sockerr("getsockname");
+  get_numinfo(reinterpret_cast<sockaddr *>(&ss), sslen, nullptr, &port_);
+  while (socks_.size() < nloops)
+    socks_.push_back(tcp_listen(port_.c_str(), ss.ss_family, SOMAXCONN,
+				true));
+
+  for (std::size_t i = 0; i < nloops; i++)
+    ps_.emplace_back(new pollset_plus(backend));
+}
+
+rpc_tcp_multi_listener_common::~rpc_tcp_multi_listener_common()
+{
+  stop();
+}
+
+void
+rpc_tcp_multi_listener_common::start(bool pin)
+{
+  assert(threads_.empty());
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  if (pin && sched_getaffinity(0, sizeof set, &set) == 0)
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &set))
+	cpus.push_back(cpu);
+#endif // __linux__
+  stop_ = false;
+  for (std::size_t i = 0; i < size(); i++)
+    threads_.emplace_back(&rpc_tcp_multi_listener_common::run, this, i,
+			  cpus.empty() ? -1 : cpus[i % cpus.size()]);
+}
+
+void
+rpc_tcp_multi_listener_common::stop()
+{
+  stop_ = true;
+  for (auto &ps : ps_)
+    ps->wake();
+  for (std::thread &t : threads_)
+    t.join();
+  threads_.clear();
+}
+
+void
+rpc_tcp_multi_listener_common::run(std::size_t i, int cpu)
+{
+#ifdef __linux__
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (int err = pthread_setaffinity_np(pthread_self(), sizeof set, &set))
+      std::cerr << "rpc_tcp_multi_listener: pthread_setaffinity_np: "
+		<< std::strerror(err) << std::endl;
+  }
+#endif // __linux__
+  pollset_plus &ps = *ps_[i];
+  while (!stop_)
+    ps.poll();
+}
+
+rpc_udp_listener_common::rpc_udp_listener_common(pollset &ps, unique_sock &&s,
+						 bool reg)
+  : use_rpcbind_(reg),
+    ds_(ps, s ? s.release() : udp_listen().release(),
+	std::bind(&rpc_udp_listener_common::receive_cb, this,
+		  std::placeholders::_1)),
+    ps_(ps)
+{
+  set_close_on_exec(ds_.get_sock());
+}
+
+void
+rpc_udp_listener_common::receive_cb(msg_ptr mp)
+{
+  std::shared_ptr<const sockaddr> peer (mp->unique_peer());
+  dgram_sock *ds = &ds_;
+  try {
+    dispatch(nullptr, std::move(mp),
+	     [ds,destroyed=ds_.destroyed_ptr(),peer](msg_ptr r) {
+	       // Asynchronous services may reply after the listener is gone.
+	       if (r && !*destroyed)
+		 ds->putmsg(std::move(r), peer.get());
+	     });
+  }
+  catch (const xdr_runtime_error &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
 }
@@ -11,12 +11,15 @@
 #ifndef _XDRPP_SERVER_H_HEADER_INCLUDED_
 #define _XDRPP_SERVER_H_HEADER_INCLUDED_ 1
 
+#include <atomic>
 #include <iostream>
 #include <xdrpp/marshal.h>
 #include <xdrpp/printer.h>
 #include <xdrpp/msgsock.h>
+#include <xdrpp/dgram.h>
 #include <xdrpp/rpcbind.h>
 #include <xdrpp/rpc_msg.hh>
+#include <xdrpp/skip.h>
 #include <map>
 
 namespace xdr {
@@ -104,6 +107,8 @@ archive(Archive &ar, const transparent_ptr<T> &t, const char *name = nullptr)
 }
 
 namespace detail {
+template<typename T> struct skip_as<transparent_ptr<T>> { using type = T; };
+
 template<typename T> struct wrap_transparent_ptr_helper;
 
 template<typename...T>
@@ -193,7 +198,11 @@ struct service_base {
 
   service_base(uint32_t prog, uint32_t vers) : prog_(prog), vers_(vers) {}
   virtual ~service_base() {}
-  virtual void process(void *session, rpc_msg &hdr, xdr_get &g, cb_t reply) = 0;
+  //! Decode and run a call whose header \c hdr has been read from \c
+  //! m through \c g.  The service may take ownership of \c m if the
+  //! decoded arguments refer to it.
+  virtual void process(void *session, rpc_msg &hdr, xdr_get &g, msg_ptr &m,
+		       cb_t reply) = 0;
 
   bool check_call(const rpc_msg &hdr) {
     return hdr.body.mtype() == CALL
@@ -202,25 +211,65 @@ struct service_base {
       && hdr.body.cbody().vers == vers_;
   }
 
-  template<typename T> static bool decode_arg(xdr_get &g, T &arg) {
-    try {
-      archive(g, arg);
-      g.done();
-      return true;
-    }
-    catch (const xdr_runtime_error &) {
-      return false;
-    }
+  //! Decode the call arguments, which must extend to the end of the
+  //! message.  Garbage arguments are reported without throwing, as a
+  //! misbehaving client can send them at a high rate.
+  template<typename T> static xdr_status decode_arg(xdr_get &g, T &arg) {
+    return detail::try_get<true>(g, arg);
   }
 };
 
+class arena;
+
 class rpc_server_base {
   std::map<uint32_t,
 	   std::map<uint32_t, std::unique_ptr<service_base>>> servers_;
 protected:
   void register_service_base(service_base *s);
 public:
-  void dispatch(void *session, msg_ptr m, service_base::cb_t reply);
+  //! Decode a call and invoke the appropriate service.  If \c a is
+  //! not null, the arguments are decoded within an \c xdr::arena_scope
+  //! for \c a (see \c xdrpp/arena.h), and the caller may reset \c a
+  //! once the reply has been sent.  The handler itself runs with no
+  //! current arena, so anything it creates or copies is on the heap.
+  void dispatch(void *session, msg_ptr m, service_base::cb_t reply,
+		arena *a = nullptr);
+};
+
+//! Makes calls on a server in the same process (such as an \c
+//! arpc_server) in the manner of \c rpc_sock, but without a socket.
+//! Call messages queued during a PollSet::poll iteration are handed
+//! to \c rpc_server_base::dispatch together at the end of it, and
+//! each reply message goes straight to its callback.  Any calls still
+//! outstanding when the \c rpc_loopback is destroyed get \c nullptr.
+class rpc_loopback {
+public:
+  using rcb_t = msg_sock::rcb_t;
+
+  rpc_loopback(pollset &ps, rpc_server_base &srv, void *session = nullptr)
+    : ps_(ps), srv_(srv), session_(session) {}
+  ~rpc_loopback();
+
+  uint32_t get_xid() {
+    while (calls_.find(++xid_) != calls_.end() && xid_ != 0)
+      ;
+    return xid_;
+  }
+
+  void send_call(msg_ptr &b, rcb_t cb);
+  void send_call(msg_ptr &&b, rcb_t cb) { send_call(b, cb); }
+
+private:
+  pollset &ps_;
+  rpc_server_base &srv_;
+  void *const session_;
+  uint32_t xid_ {0};
+  std::unordered_map<uint32_t, rcb_t> calls_;
+  std::vector<msg_ptr> pending_;
+  std::shared_ptr<bool> destroyed_{std::make_shared<bool>(false)};
+
+  void flush();
+  void recv_reply(msg_ptr b);
 };
 
 
@@ -229,6 +278,10 @@ public:
 //! program/version interfaces to accepted connections.
 class rpc_tcp_listener_common : public rpc_server_base {
   void accept_cb();
+  void accepted(sock_t s);
+  void serve(sock_t s, std::unique_ptr<shm_link> l);
+  void shm_handshake(sock_t s);
+  void uring_accept();
   void receive_cb(rpc_sock *ms, void *session, msg_ptr mp);
 
 protected:
@@ -242,8 +295,40 @@ protected:
   virtual void *session_alloc(rpc_sock *) = 0;
   virtual void session_free(void *session) = 0;
 
+  size_t wlow_ {0x40000};
+  size_t whigh_ {0x400000};
+  size_t wmax_ {0};
+
+  io_ring *ring_ {nullptr};
+  io_ring::op *aop_ {nullptr};
+
+  bool shm_ {false};
+  std::vector<sock_t> shm_pending_; // Connections awaiting handshake
+
 public:
   pollset &ps_;
+
+  //! Accept connections with a multishot accept on \c r, and do all
+  //! I/O on them through \c r (see \c msg_sock::set_uring).  Returns
+  //! \c false (and keeps polling) if \c r is null.
+  bool set_uring(io_ring *r);
+
+  //! Expect each connection accepted from now on to begin with the
+  //! handshake of \c shm_link::connect, and then exchange messages
+  //! over the shared-memory link (see \c msg_sock::set_shm).  For use
+  //! on a Unix-domain listening socket (see \c unix_listen).
+  void set_shm(bool on) { shm_ = on; }
+
+  //! Limit the replies queued on each connection accepted from now
+  //! on.  The server stops reading calls from a connection with more
+  //! than \c high bytes of unsent replies, and resumes once they
+  //! drain to \c low bytes.  If \c max is non-zero, a connection
+  //! with more than \c max bytes of unsent replies is dropped.
+  void set_wlimits(size_t low, size_t high, size_t max = 0) {
+    wlow_ = low;
+    whigh_ = high;
+    wmax_ = max;
+  }
 };
 
 template<template<typename, typename, typename> class ServiceType,
@@ -275,6 +360,125 @@ public:
 };
 
 
+//! Runs a TCP server on several threads, each polling its own \c
+//! pollset_plus.  Each thread has its own listening socket, bound to
+//! the same port with \c SO_REUSEPORT, so the kernel spreads new
+//! connections across the threads, and each connection is served
+//! entirely by the thread that accepted it.  Since the same service
+//! objects are registered with every thread, their methods may be
+//! called concurrently and must be thread-safe.
+class rpc_tcp_multi_listener_common {
+  std::atomic<bool> stop_ {false};
+  std::vector<std::thread> threads_;
+  std::string port_;
+  void run(std::size_t i, int cpu);
+
+protected:
+  std::vector<std::unique_ptr<pollset_plus>> ps_;
+  std::vector<unique_sock> socks_; // Until handed to the listeners
+  rpc_tcp_multi_listener_common(std::size_t nloops, const char *service,
+				int family, pollset::backend_t backend);
+  virtual ~rpc_tcp_multi_listener_common();
+
+public:
+  //! Number of threads.
+  std::size_t size() const { return ps_.size(); }
+  //! The pollset of thread \c i, e.g., to \c inject_cb into it.
+  pollset_plus &get_pollset(std::size_t i) { return *ps_.at(i); }
+  //! The port all the listening sockets are bound to.
+  const std::string &port() const { return port_; }
+
+  //! Start a thread polling each pollset.  With \c pin, thread \c i
+  //! only runs on the <tt>i</tt>th CPU the process may use (modulo
+  //! the number of such CPUs).  Pinning is only supported on Linux.
+  void start(bool pin = false);
+  //! Make every thread return from its current poll, and wait for
+  //! them to exit.  Connections stay open, and \c start polls them
+  //! again.
+  void stop();
+};
+
+template<template<typename, typename, typename> class ServiceType,
+	 typename Session, typename SessionAllocator>
+class generic_rpc_tcp_multi_listener : public rpc_tcp_multi_listener_common {
+public:
+  using listener_type =
+    generic_rpc_tcp_listener<ServiceType, Session, SessionAllocator>;
+
+private:
+  std::vector<std::unique_ptr<listener_type>> listeners_;
+
+public:
+  //! Listen on \c service with \c nloops threads, or one per CPU if
+  //! \c nloops is 0.  A null \c service picks an unused port (see
+  //! \c port).  Each thread gets its own copy of \c sa.
+  explicit generic_rpc_tcp_multi_listener(
+      std::size_t nloops = 0, const char *service = nullptr,
+      int family = AF_UNSPEC, pollset::backend_t backend = pollset::Poll,
+      SessionAllocator sa = SessionAllocator{})
+    : rpc_tcp_multi_listener_common(nloops, service, family, backend) {
+    for (std::size_t i = 0; i < size(); i++)
+      listeners_.emplace_back(new listener_type(*ps_[i], std::move(socks_[i]),
+						false, sa));
+    socks_.clear();
+  }
+  ~generic_rpc_tcp_multi_listener() { stop(); }
+
+  //! The listener of thread \c i, e.g., to configure it before \c
+  //! start.
+  listener_type &listener(std::size_t i) { return *listeners_.at(i); }
+
+  //! Add objects implementing RPC program interfaces to the server of
+  //! every thread.  Must be called before \c start.
+  template<typename T, typename Interface = typename T::rpc_interface_type>
+  void register_service(T &t) {
+    for (auto &l : listeners_)
+      l->template register_service<T, Interface>(t);
+  }
+};
+
+//! Serves one or more program/version interfaces to calls arriving
+//! as datagrams on a UDP socket (optionally registered with \c
+//! rpcbind).  There are no connections, and hence no sessions.
+//! Replies are sent to the address each call came from, batched with
+//! the other replies sent during the same PollSet::poll iteration.
+class rpc_udp_listener_common : public rpc_server_base {
+  void receive_cb(msg_ptr mp);
+
+protected:
+  const bool use_rpcbind_;
+  dgram_sock ds_;
+  rpc_udp_listener_common(pollset &ps, unique_sock &&s,
+			  bool use_rpcbind = false);
+  rpc_udp_listener_common(pollset &ps)
+    : rpc_udp_listener_common(ps, unique_sock(invalid_sock), true) {}
+  virtual ~rpc_udp_listener_common() {}
+
+public:
+  pollset &ps_;
+  sock_t get_sock() const { return ds_.get_sock(); }
+};
+
+template<template<typename, typename, typename> class ServiceType>
+class generic_rpc_udp_listener : public rpc_udp_listener_common {
+public:
+  generic_rpc_udp_listener(pollset &ps)
+    : rpc_udp_listener_common(ps) {}
+  generic_rpc_udp_listener(pollset &ps, unique_sock &&s,
+			   bool use_rpcbind = false)
+    : rpc_udp_listener_common(ps, std::move(s), use_rpcbind) {}
+
+  //! Add objects implementing RPC program interfaces to the server.
+  template<typename T, typename Interface = typename T::rpc_interface_type>
+  void register_service(T &t) {
+    register_service_base(new ServiceType<T,void,Interface>(t));
+    if(use_rpcbind_)
+      rpcbind_register(ds_.get_sock(), Interface::program,
+		       Interface::version);
+  }
+};
+
+
 } // namespace xdr
 
 #endif // !_XDRPP_SERVER_H_HEADER_INCLUDED_
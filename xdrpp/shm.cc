@@ -0,0 +1,380 @@
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <xdrpp/shm.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // __linux__
+
+namespace xdr {
+
+#ifdef __linux__
+
+// Positions are byte counts that never wrap, so a ring is empty when
+// head == tail and full when tail - head == size.  Each position is
+// written only by one side, but the segment is shared with a peer
+// that may not follow the rules, so both sides check what they read.
+struct shm_link::ring {
+  alignas(64) std::uint64_t head;	// Bytes consumed
+  alignas(64) std::uint64_t tail;	// Bytes produced
+  alignas(64) std::uint32_t rwait;	// Consumer wants the doorbell
+  std::uint32_t wwait;			// Producer wants the doorbell
+};
+
+namespace {
+
+// Sent, along with the segment and doorbells, by shm_link::connect.
+struct hello {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t ringsize;
+};
+constexpr std::uint32_t hello_magic = 0x7873686d; // "xshm"
+constexpr std::uint32_t hello_version = 1;
+
+// Both ring headers fit in the first page; the rings follow.
+constexpr std::size_t hdrlen = 0x1000;
+
+inline std::size_t
+seglen(std::size_t ringsize)
+{
+  return hdrlen + 2 * ringsize;
+}
+
+inline bool
+valid_ringsize(std::uint64_t n)
+{
+  return n >= shm_link::min_ringsize && n <= shm_link::max_ringsize
+    && !(n & (n - 1));
+}
+
+inline std::uint64_t
+load(const std::uint64_t *p)
+{
+  return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+inline void
+store(std::uint64_t *p, std::uint64_t v)
+{
+  __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+// Clear a flag the other side set to ask for the doorbell, returning
+// whether it was set.  Mostly the flag is clear, and checking it
+// first avoids writing to the cache line the other side is reading.
+inline bool
+take_flag(std::uint32_t *p)
+{
+  return __atomic_load_n(p, __ATOMIC_SEQ_CST)
+    && __atomic_exchange_n(p, 0, __ATOMIC_SEQ_CST);
+}
+
+} // namespace
+
+std::unique_ptr<shm_link>
+shm_link::connect(sock_t s, std::size_t ringsize)
+{
+  if (!valid_ringsize(ringsize))
+    throw std::system_error(EINVAL, std::system_category(),
+			    "shm_link::connect: invalid ring size");
+
+  // Seal the size so the peer cannot shrink the segment, which would
+  // make us crash when we touched the missing pages.
+  unique_sock mfd(sock_t(memfd_create("xdrpp-shm",
+				      MFD_CLOEXEC|MFD_ALLOW_SEALING)));
+  if (!mfd)
+    throw_sockerr("memfd_create");
+  if (ftruncate(mfd.fd(), seglen(ringsize)) == -1)
+    throw_sockerr("ftruncate");
+  if (fcntl(mfd.fd(), F_ADD_SEALS,
+	    F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) == -1)
+    throw_sockerr("F_ADD_SEALS");
+
+  std::unique_ptr<shm_link> l(new shm_link);
+  if (!l->map(mfd.fd(), ringsize, true))
+    throw_sockerr("mmap");
+  l->bell_ = sock_t(eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK));
+  if (!l->bell_)
+    throw_sockerr("eventfd");
+  l->peer_bell_ = sock_t(eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK));
+  if (!l->peer_bell_)
+    throw_sockerr("eventfd");
+
+  hello h { hello_magic, hello_version, ringsize };
+  iovec iov { &h, sizeof h };
+  int fds[3] = { mfd.fd(), l->peer_bell_.fd_, l->bell_.fd_ };
+  union {
+    cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof fds)];
+  } cbuf;
+  std::memset(&cbuf, 0, sizeof cbuf);
+  msghdr mh;
+  std::memset(&mh, 0, sizeof mh);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = cbuf.buf;
+  mh.msg_controllen = sizeof cbuf.buf;
+  cmsghdr *cmh = CMSG_FIRSTHDR(&mh);
+  cmh->cmsg_level = SOL_SOCKET;
+  cmh->cmsg_type = SCM_RIGHTS;
+  cmh->cmsg_len = CMSG_LEN(sizeof fds);
+  std::memcpy(CMSG_DATA(cmh), fds, sizeof fds);
+
+  ssize_t n;
+  while ((n = sendmsg(s.fd_, &mh, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    ;
+  if (n == -1)
+    throw_sockerr("shm_link::connect: sendmsg");
+  if (n != sizeof h)
+    throw std::system_error(EPROTO, std::system_category(),
+			    "shm_link::connect: short write");
+  return l;
+}
+
+std::unique_ptr<shm_link>
+shm_link::accept(sock_t s)
+{
+  hello h;
+  iovec iov { &h, sizeof h };
+  union {
+    cmsghdr hdr;
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+  } cbuf;
+  msghdr mh;
+  std::memset(&mh, 0, sizeof mh);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = cbuf.buf;
+  mh.msg_controllen = sizeof cbuf.buf;
+
+  ssize_t n;
+  while ((n = recvmsg(s.fd_, &mh, MSG_DONTWAIT|MSG_CMSG_CLOEXEC)) == -1
+	 && errno == EINTR)
+    ;
+  if (n == -1) {
+    if (sock_eagain())
+      return nullptr;
+    throw_sockerr("shm_link::accept: recvmsg");
+  }
+
+  // Take ownership of whatever descriptors arrived before checking
+  // anything else.
+  unique_sock fds[3];
+  std::size_t nfds = 0;
+  for (cmsghdr *cmh = CMSG_FIRSTHDR(&mh); cmh; cmh = CMSG_NXTHDR(&mh, cmh))
+    if (cmh->cmsg_level == SOL_SOCKET && cmh->cmsg_type == SCM_RIGHTS) {
+      std::size_t k = (cmh->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (std::size_t i = 0; i < k; i++) {
+	int fd;
+	std::memcpy(&fd, CMSG_DATA(cmh) + i * sizeof(int), sizeof fd);
+	if (nfds < 3)
+	  fds[nfds++].reset(sock_t(fd));
+	else
+	  ::close(fd);
+      }
+    }
+
+  if (n == 0)
+    throw std::system_error(ECONNRESET, std::system_category(),
+			    "shm_link::accept");
+  struct stat sb;
+  int seals;
+  if (n != sizeof h || nfds != 3 || (mh.msg_flags & (MSG_TRUNC|MSG_CTRUNC))
+      || h.magic != hello_magic || h.version != hello_version
+      || !valid_ringsize(h.ringsize)
+      || fstat(fds[0].fd(), &sb) == -1
+      || std::uint64_t(sb.st_size) != seglen(h.ringsize)
+      || (seals = fcntl(fds[0].fd(), F_GET_SEALS)) == -1
+      || !(seals & F_SEAL_SHRINK))
+    throw std::system_error(EPROTO, std::system_category(),
+			    "shm_link::accept: bad handshake");
+
+  std::unique_ptr<shm_link> l(new shm_link);
+  if (!l->map(fds[0].fd(), h.ringsize, false))
+    throw_sockerr("mmap");
+  l->bell_ = fds[1].release();
+  l->peer_bell_ = fds[2].release();
+  set_nonblock(l->bell_);
+  set_nonblock(l->peer_bell_);
+  return l;
+}
+
+shm_link::~shm_link()
+{
+  if (seg_)
+    munmap(seg_, seglen_);
+  if (bell_)
+    close(bell_);
+  if (peer_bell_)
+    close(peer_bell_);
+}
+
+bool
+shm_link::map(int fd, std::size_t ringsize, bool initiator)
+{
+  static_assert(2 * sizeof(ring) <= hdrlen, "ring headers too big");
+  seglen_ = seglen(ringsize);
+  void *seg = mmap(nullptr, seglen_, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (seg == MAP_FAILED)
+    return false;
+  seg_ = seg;
+  size_ = ringsize;
+  char *base = static_cast<char *>(seg);
+  ring *a = reinterpret_cast<ring *>(base);
+  ring *b = reinterpret_cast<ring *>(base + sizeof(ring));
+  char *adata = base + hdrlen;
+  char *bdata = adata + ringsize;
+  // The side that calls connect produces into ring a.
+  if (initiator) {
+    tx_ = a; txdata_ = adata;
+    rx_ = b; rxdata_ = bdata;
+  }
+  else {
+    tx_ = b; txdata_ = bdata;
+    rx_ = a; rxdata_ = adata;
+  }
+  return true;
+}
+
+ssize_t
+shm_link::readv(const iovec *iov, int iovcnt)
+{
+  std::uint64_t avail = load(&rx_->tail) - rhead_;
+  if (!avail) {
+    if (eof_)
+      return 0;
+    errno = EAGAIN;
+    return -1;
+  }
+  if (avail > size_) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  std::size_t n = 0;
+  for (int i = 0; i < iovcnt && n < avail; i++) {
+    std::size_t len = std::min<std::uint64_t>(iov[i].iov_len, avail - n);
+    std::size_t off = (rhead_ + n) & (size_ - 1);
+    std::size_t k = std::min(len, size_ - off);
+    char *dst = static_cast<char *>(iov[i].iov_base);
+    std::memcpy(dst, rxdata_ + off, k);
+    std::memcpy(dst + k, rxdata_, len - k);
+    n += len;
+  }
+  rhead_ += n;
+  store(&rx_->head, rhead_);
+  if (take_flag(&rx_->wwait))
+    ring_peer();
+  return n;
+}
+
+ssize_t
+shm_link::writev(const iovec *iov, int iovcnt)
+{
+  if (eof_) {
+    errno = EPIPE;
+    return -1;
+  }
+  std::uint64_t used = wtail_ - load(&tx_->head);
+  if (used == size_) {
+    // Full, so ask for the doorbell, then check again in case the
+    // peer made room before seeing the request.
+    __atomic_store_n(&tx_->wwait, 1, __ATOMIC_SEQ_CST);
+    used = wtail_ - load(&tx_->head);
+    if (used == size_) {
+      errno = EAGAIN;
+      return -1;
+    }
+    __atomic_store_n(&tx_->wwait, 0, __ATOMIC_RELAXED);
+  }
+  if (used > size_) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  std::size_t room = size_ - used;
+  std::size_t n = 0;
+  for (int i = 0; i < iovcnt && n < room; i++) {
+    std::size_t len = std::min(iov[i].iov_len, room - n);
+    std::size_t off = (wtail_ + n) & (size_ - 1);
+    std::size_t k = std::min(len, size_ - off);
+    const char *src = static_cast<const char *>(iov[i].iov_base);
+    std::memcpy(txdata_ + off, src, k);
+    std::memcpy(txdata_, src + k, len - k);
+    n += len;
+  }
+  wtail_ += n;
+  store(&tx_->tail, wtail_);
+  if (take_flag(&tx_->rwait))
+    ring_peer();
+  return n;
+}
+
+bool
+shm_link::read_wait()
+{
+  __atomic_store_n(&rx_->rwait, 1, __ATOMIC_SEQ_CST);
+  if (load(&rx_->tail) == rhead_ && !eof_)
+    return true;
+  __atomic_store_n(&rx_->rwait, 0, __ATOMIC_RELAXED);
+  return false;
+}
+
+void
+shm_link::clear_doorbell()
+{
+  std::uint64_t v;
+  while (::read(bell_.fd_, &v, sizeof v) == -1 && errno == EINTR)
+    ;
+}
+
+void
+shm_link::wake_self()
+{
+  std::uint64_t v = 1;
+  while (::write(bell_.fd_, &v, sizeof v) == -1 && errno == EINTR)
+    ;
+}
+
+void
+shm_link::ring_peer()
+{
+  std::uint64_t v = 1;
+  while (::write(peer_bell_.fd_, &v, sizeof v) == -1 && errno == EINTR)
+    ;
+}
+
+#else // !__linux__
+
+struct shm_link::ring {};
+
+std::unique_ptr<shm_link>
+shm_link::connect(sock_t, std::size_t)
+{
+  throw std::system_error(ENOSYS, std::system_category(), "shm_link");
+}
+
+std::unique_ptr<shm_link>
+shm_link::accept(sock_t)
+{
+  throw std::system_error(ENOSYS, std::system_category(), "shm_link");
+}
+
+// No shm_link can exist, so the rest is unreachable.
+shm_link::~shm_link() {}
+ssize_t shm_link::readv(const iovec *, int) { return -1; }
+ssize_t shm_link::writev(const iovec *, int) { return -1; }
+bool shm_link::read_wait() { return false; }
+void shm_link::clear_doorbell() {}
+void shm_link::wake_self() {}
+void shm_link::ring_peer() {}
+
+#endif // !__linux__
+
+} // namespace xdr
@@ -0,0 +1,104 @@
+// -*- C++ -*-
+
+//! \file shm.h Carry a stream of RFC5531 records through shared
+//! memory between processes on the same host.
+
+#ifndef _XDRPP_SHM_H_INCLUDED_
+#define _XDRPP_SHM_H_INCLUDED_ 1
+
+#include <cstdint>
+#include <memory>
+#include <xdrpp/socket.h>
+
+namespace xdr {
+
+//! A pair of single-producer, single-consumer byte rings in a memory
+//! segment shared by two processes, one ring for each direction.
+//! Each side also has a \e doorbell (an eventfd), which the other
+//! side signals after producing data or freeing space, but only if
+//! this side is waiting for it.  So two busy peers exchange messages
+//! without making any system calls.
+//!
+//! The segment and doorbells are set up by passing their descriptors
+//! over a Unix-domain stream socket: one side calls \c connect, the
+//! other \c accept.  The socket stays open for as long as the link is
+//! in use, so that either side notices when the other goes away.  Use
+//! \c msg_sock::set_shm (or \c rpc_tcp_listener_common::set_shm on a
+//! server) to send messages over the link rather than the socket.
+//!
+//! Only Linux is supported.  Elsewhere, \c connect and \c accept throw
+//! with \c ENOSYS.
+class shm_link {
+public:
+  static constexpr std::size_t default_ringsize = 0x100000;
+  static constexpr std::size_t min_ringsize = 0x1000;
+  static constexpr std::size_t max_ringsize = 0x40000000;
+
+  //! Create a segment with two rings of \c ringsize bytes (a power of
+  //! 2) and send it to the peer over \c s, a connected Unix-domain
+  //! stream socket.  Throws \c std::system_error on failure.
+  static std::unique_ptr<shm_link> connect(sock_t s,
+					   std::size_t ringsize
+					   = default_ringsize);
+  //! Receive the segment that the peer created with \c connect.
+  //! Returns \c nullptr if \c s is non-blocking and the peer has not
+  //! sent it yet.  Throws \c std::system_error on failure, with \c
+  //! EPROTO if what the peer sent makes no sense.
+  static std::unique_ptr<shm_link> accept(sock_t s);
+  ~shm_link();
+  shm_link(const shm_link &) = delete;
+  shm_link &operator=(const shm_link &) = delete;
+
+  //! Like \c readv on a non-blocking socket.  Fails with \c EAGAIN
+  //! if there is nothing to read, or returns 0 at end of file (see \c
+  //! set_eof).  Fails with \c EPROTO if the peer corrupts the ring.
+  ssize_t readv(const iovec *iov, int iovcnt);
+  //! Like \c writev on a non-blocking socket.  Fails with \c EAGAIN
+  //! if the ring is full, or with \c EPIPE after \c set_eof.
+  ssize_t writev(const iovec *iov, int iovcnt);
+
+  //! Readable when the peer has rung this side's doorbell.
+  sock_t doorbell() const { return bell_; }
+  //! Reset the doorbell after it becomes readable.
+  void clear_doorbell();
+  //! Ring this side's own doorbell, e.g., to finish reading in a
+  //! later poll iteration.
+  void wake_self();
+  //! Ask the peer to ring the doorbell once there is data to read.
+  //! Returns \c false if there is some already (or the peer has gone
+  //! away), in which case the caller should keep reading.
+  bool read_wait();
+
+  //! Record that the peer has gone away (e.g., because the socket
+  //! reached end of file).  Reading returns what remains in the ring,
+  //! then 0.
+  void set_eof() { eof_ = true; }
+
+  std::size_t ringsize() const { return size_; }
+
+private:
+  struct ring;
+
+  void *seg_ {nullptr};
+  std::size_t seglen_ {0};
+  std::size_t size_ {0};
+  ring *rx_ {nullptr};
+  ring *tx_ {nullptr};
+  char *rxdata_ {nullptr};
+  char *txdata_ {nullptr};
+  // Our own positions, kept privately since the peer can write to
+  // the copies in the segment.
+  std::uint64_t rhead_ {0};
+  std::uint64_t wtail_ {0};
+  sock_t bell_ {invalid_sock};
+  sock_t peer_bell_ {invalid_sock};
+  bool eof_ {false};
+
+  shm_link() = default;
+  bool map(int fd, std::size_t ringsize, bool initiator);
+  void ring_peer();
+};
+
+} // namespace xdr
+
+#endif // !_XDRPP_SHM_H_INCLUDED_
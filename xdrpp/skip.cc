@@ -0,0 +1,50 @@
+
+#include <xdrpp/skip.h>
+
+namespace xdr {
+
+const char *
+xdr_errc_string(xdr_errc c)
+{
+  switch (c) {
+  case xdr_errc::ok:
+    return "success";
+  case xdr_errc::overflow:
+    return "insufficient buffer space or length exceeds bound";
+  case xdr_errc::should_be_zero:
+    return "non-zero padding bytes encountered";
+  case xdr_errc::bad_discriminant:
+    return "bad value of union discriminant";
+  case xdr_errc::bad_message_size:
+    return "message size not multiple of 4 or not fully consumed";
+  case xdr_errc::stack_overflow:
+    return "exceeded marshaling stack limit";
+  case xdr_errc::invariant_failed:
+    return "data failed xdr::validate check";
+  }
+  return "unknown xdr_errc";
+}
+
+void
+xdr_status::raise() const
+{
+  switch (code) {
+  case xdr_errc::ok:
+    return;
+  case xdr_errc::overflow:
+    throw xdr_overflow(what());
+  case xdr_errc::should_be_zero:
+    throw xdr_should_be_zero(what());
+  case xdr_errc::bad_discriminant:
+    throw xdr_bad_discriminant(what());
+  case xdr_errc::bad_message_size:
+    throw xdr_bad_message_size(what());
+  case xdr_errc::stack_overflow:
+    throw xdr_stack_overflow(what());
+  case xdr_errc::invariant_failed:
+    throw xdr_invariant_failed(what());
+  }
+  throw xdr_runtime_error(what());
+}
+
+} // namespace xdr
@@ -0,0 +1,488 @@
+// -*- C++ -*-
+
+/** \file skip.h Walk XDR-encoded data according to a type's \c
+ * xdr_traits, without constructing any objects.  This makes it
+ * possible to validate untrusted input before an expensive decode,
+ * to step over large fields that are of no interest, and to find the
+ * byte offset of a particular field or element inside a message.
+ */
+
+#ifndef _XDRPP_SKIP_H_HEADER_INCLUDED_
+#define _XDRPP_SKIP_H_HEADER_INCLUDED_ 1
+
+#include <xdrpp/marshal.h>
+
+namespace xdr {
+
+//! Kinds of malformed input, each corresponding to the exception
+//! that \c xdr::xdr_get would throw on the same data.
+enum class xdr_errc : std::uint8_t {
+  ok = 0,
+  overflow,			//!< \c xdr_overflow
+  should_be_zero,		//!< \c xdr_should_be_zero
+  bad_discriminant,		//!< \c xdr_bad_discriminant
+  bad_message_size,		//!< \c xdr_bad_message_size
+  stack_overflow,		//!< \c xdr_stack_overflow
+  invariant_failed,		//!< \c xdr_invariant_failed
+};
+
+//! Human-readable description of an \c xdr_errc.
+const char *xdr_errc_string(xdr_errc c);
+
+//! Outcome of walking or decoding untrusted data without exceptions.
+struct xdr_status {
+  xdr_errc code {xdr_errc::ok};
+  //! Byte offset in the input at which the problem was detected.
+  std::size_t offset {0};
+
+  explicit operator bool() const { return code == xdr_errc::ok; }
+  const char *what() const { return xdr_errc_string(code); }
+  //! Throw the exception \c xdr::xdr_get would have thrown.  Does
+  //! nothing if \c code is \c ok.
+  void raise() const;
+};
+
+//! Half-open byte range <tt>[offset, offset+size)</tt> of an encoded
+//! value, relative to the start of the buffer being walked.
+struct xdr_extent {
+  std::size_t offset {0};
+  std::size_t size {0};
+};
+
+namespace detail {
+//! Largest element count a variable-length container or byte string
+//! may hold.
+template<typename T> struct max_nelem {
+  static Constexpr std::uint32_t value() { return T::max_size(); }
+};
+template<typename T, typename A> struct max_nelem<pointer<T,A>> {
+  static Constexpr std::uint32_t value() { return 1; }
+};
+
+template<typename S, typename = void> struct struct_fields;
+
+//! The type whose encoding \c xdr_skip should expect in place of \c
+//! T.  Specialize this for wrapper types that marshal as the type
+//! they wrap.
+template<typename T> struct skip_as { using type = T; };
+
+template<typename T> struct is_list_pointer : std::false_type {};
+template<typename T, typename A> struct is_list_pointer<pointer<T,A>>
+  : pointer<T,A>::is_list {};
+} // namespace detail
+
+//! Cursor that steps over XDR-encoded values of a given static type,
+//! checking lengths, padding, and union discriminants exactly as \c
+//! xdr::xdr_get would, but without allocating or constructing
+//! anything.  Errors are reported through \c status() rather than by
+//! throwing.  After an error, the cursor stays where the problem was
+//! found and all further operations fail.
+class xdr_skip {
+  template<typename S, typename> friend struct detail::struct_fields;
+
+  const char *const start_;
+  const char *p_;
+  const char *const end_;
+  xdr_status status_;
+  std::uint32_t stack_limit_ = marshaling_stack_limit;
+  bool in_fixed_ = false;
+
+  bool fail(xdr_errc c) {
+    if (status_)
+      status_ = xdr_status{c, offset()};
+    return false;
+  }
+  bool check(std::size_t n) {
+    return n <= remaining() || fail(xdr_errc::overflow);
+  }
+  bool get32(std::uint32_t &v) {
+    if (!check(4))
+      return false;
+    v = swap32le(*reinterpret_cast<const std::uint32_t *>(p_));
+    p_ += 4;
+    return true;
+  }
+  // Run w, charging stack depth for a value of type T the way
+  // xdr_get does: once for each class or container, except numeric
+  // runs (decoded in bulk) and anything within a fixed-size value
+  // (decoded in a single unchecked pass).
+  template<typename T, typename W> bool charge(W &&w) {
+    if (!((xdr_traits<T>::is_class || xdr_traits<T>::is_container)
+	  && !detail::is_numeric_run<T>::value) || in_fixed_)
+      return w();
+    if (!stack_limit_)
+      return fail(xdr_errc::stack_overflow);
+    --stack_limit_;
+    in_fixed_ = xdr_traits<T>::has_fixed_size;
+    bool ok = w();
+    in_fixed_ = false;
+    ++stack_limit_;
+    return ok;
+  }
+
+  // Skip n bytes followed by zero padding to a multiple of 4.
+  bool skip_bytes(std::size_t n) {
+    if (!check(n))
+      return false;
+    p_ += n;
+    for (; n & 3; ++n)
+      if (*p_++ != '\0') {
+	--p_;
+	return fail(xdr_errc::should_be_zero);
+      }
+    return true;
+  }
+
+  template<typename T> bool get_nelem(std::uint32_t &n, std::true_type) {
+    if (!get32(n))
+      return false;
+    if (n > detail::max_nelem<T>::value()) {
+      p_ -= 4;
+      return fail(xdr_errc::overflow);
+    }
+    return true;
+  }
+  template<typename T> bool get_nelem(std::uint32_t &n, std::false_type) {
+    n = T::container_fixed_nelem;
+    return true;
+  }
+
+  template<typename V> bool skip_elems(std::uint32_t n, std::true_type) {
+    // Divide rather than multiply, as n comes from untrusted input.
+    return n <= remaining() / xdr_traits<V>::fixed_size
+      ? (p_ += n * xdr_traits<V>::fixed_size, true)
+      : fail(xdr_errc::overflow);
+  }
+  template<typename V> bool skip_elems(std::uint32_t n, std::false_type) {
+    for (std::uint32_t i = 0; i < n; ++i)
+      if (!skip<V>())
+	return false;
+    return true;
+  }
+
+  template<typename T> typename std::enable_if<
+    xdr_traits<T>::is_numeric || xdr_traits<T>::is_enum, bool>::type
+  walk(T *) {
+    return check(xdr_traits<T>::fixed_size)
+      && (p_ += xdr_traits<T>::fixed_size, true);
+  }
+
+  template<typename T> typename std::enable_if<
+    xdr_traits<T>::is_bytes && xdr_traits<T>::variable_nelem, bool>::type
+  walk(T *) {
+    std::uint32_t n;
+    return get_nelem<T>(n, std::true_type{}) && skip_bytes(n);
+  }
+  template<typename T> typename std::enable_if<
+    xdr_traits<T>::is_bytes && !xdr_traits<T>::variable_nelem, bool>::type
+  walk(T *) {
+    return skip_bytes(T::size());
+  }
+
+  template<typename T> typename std::enable_if<
+    xdr_traits<T>::is_container && !detail::is_list_pointer<T>::value,
+    bool>::type
+  walk(T *) {
+    using V = typename T::value_type;
+    std::uint32_t n;
+    return get_nelem<T>(n, std::integral_constant<
+			  bool, xdr_traits<T>::variable_nelem>{})
+      && skip_elems<V>(n, std::integral_constant<
+			 bool, (xdr_traits<V>::is_numeric
+				|| xdr_traits<V>::is_enum)>{});
+  }
+
+  // Linked lists are walked iteratively, as they are unmarshaled.
+  template<typename F, typename C> bool skip_field(F C::*) {
+    return skip<F>();
+  }
+  template<typename T> typename std::enable_if<
+    detail::is_list_pointer<T>::value, bool>::type
+  walk(T *) {
+    using V = typename T::value_type;
+    std::uint32_t n;
+    bool ok = true;
+    while (ok && (ok = get_nelem<T>(n, std::true_type{})) && n)
+      detail::list_node_fields<xdr_traits<V>>::apply(
+	[this, &ok](auto field) { ok = ok && skip_field(field); });
+    return ok;
+  }
+
+  template<typename T> typename std::enable_if<
+    xdr_traits<T>::is_struct, bool>::type
+  walk(T *) {
+    return detail::struct_fields<xdr_traits<T>>::walk(*this, nullptr);
+  }
+  template<typename...T> bool walk(std::tuple<T...> *) {
+    bool ok = true;
+    // Braced initializers are evaluated in order.
+    bool seq[] = { true, (ok = ok && skip<T>())... };
+    (void) seq;
+    return ok;
+  }
+
+  struct union_arm {
+    xdr_skip &s;
+    bool ok;
+    template<typename F, typename U> void operator()(F U::*) {
+      ok = s.skip<F>();
+    }
+  };
+  template<typename T> typename std::enable_if<
+    xdr_traits<T>::is_union, bool>::type
+  walk(T *) {
+    using disc_t = typename std::decay<
+      typename xdr_traits<T>::discriminant_type>::type;
+    std::uint32_t u;
+    if (!get32(u))
+      return false;
+    typename xdr_traits<T>::case_type which =
+      xdr_traits<disc_t>::from_uint(u);
+    if (T::_xdr_field_number(which) < 0) {
+      p_ -= 4;
+      return fail(xdr_errc::bad_discriminant);
+    }
+    union_arm arm{*this, true};
+    T::_xdr_with_mem_ptr(arm, which);
+    return arm.ok;
+  }
+
+public:
+  //! Walk the bytes in <tt>[start, end)</tt>, which must be 4-byte
+  //! aligned.
+  xdr_skip(const void *start, const void *end)
+    : start_(static_cast<const char *>(start)), p_(start_),
+      end_(static_cast<const char *>(end)) {
+    if ((end_ - start_) & 3)
+      fail(xdr_errc::bad_message_size);
+  }
+  explicit xdr_skip(const msg_ptr &m) : xdr_skip(m->data(), m->end()) {}
+  xdr_skip(const xdr_skip &) = delete;
+  xdr_skip &operator=(const xdr_skip &) = delete;
+
+  //! The first error encountered, if any.
+  const xdr_status &status() const { return status_; }
+  //! Bytes consumed so far.
+  std::size_t offset() const { return p_ - start_; }
+  //! Bytes not yet consumed.
+  std::size_t remaining() const { return end_ - p_; }
+
+  //! Step over one encoded value of type \c T.  Returns \c false if
+  //! the data is malformed (or a previous step failed).
+  template<typename T> bool skip() {
+    using U = typename detail::skip_as<T>::type;
+    return status_
+      && charge<U>([this]() { return walk(static_cast<U *>(nullptr)); });
+  }
+  //! Step over one encoded value of type \c T, and record the bytes it
+  //! occupied in \c e.
+  template<typename T> bool skip(xdr_extent &e) {
+    std::size_t start = offset();
+    if (!skip<T>())
+      return false;
+    e = xdr_extent{start, offset() - start};
+    return true;
+  }
+
+  //! Step over a struct \c T, calling <tt>f(i, extent)</tt> with the
+  //! zero-based index and extent of each field in turn.
+  template<typename T, typename F> bool each_field(F &&f) {
+    static_assert(xdr_traits<T>::is_struct,
+		  "xdr_skip::each_field requires a struct type");
+    return status_ && charge<T>([this, &f]() {
+	return detail::struct_fields<xdr_traits<T>>::walk(*this, &f);
+      });
+  }
+
+  //! Step over a container \c T (\c xvector, \c xarray, or \c
+  //! pointer), calling <tt>f(i, extent)</tt> for each element.
+  template<typename T, typename F> bool each_element(F &&f) {
+    static_assert(xdr_traits<T>::is_container,
+		  "xdr_skip::each_element requires a container type");
+    std::uint32_t n;
+    if (!status_ || !get_nelem<T>(n, std::integral_constant<
+				    bool, xdr_traits<T>::variable_nelem>{}))
+      return false;
+    xdr_extent e;
+    for (std::uint32_t i = 0; i < n; ++i) {
+      if (!skip<typename T::value_type>(e))
+	return false;
+      f(std::size_t(i), e);
+    }
+    return true;
+  }
+
+  //! Check that the whole buffer has been consumed.
+  bool done() {
+    return status_ && (p_ == end_ || fail(xdr_errc::bad_message_size));
+  }
+};
+
+namespace detail {
+// S is the xdr_traits of a struct, which derives from
+// xdr_struct_base<Fields...>; walk the field_info/next_field chain.
+// The optional visitor receives (field index, extent).
+template<typename S, typename> struct struct_fields {
+  static bool walk(xdr_skip &, std::nullptr_t) { return true; }
+  template<typename F> static bool walk(xdr_skip &, F *, std::size_t = 0) {
+    return true;
+  }
+};
+template<typename S> struct struct_fields<
+  S, typename std::enable_if<
+       !std::is_same<typename S::field_info, void>::value>::type> {
+  using field_type = typename S::field_info::field_type;
+  using next = struct_fields<typename S::next_field>;
+
+  static bool walk(xdr_skip &s, std::nullptr_t) {
+    return s.skip<field_type>() && next::walk(s, nullptr);
+  }
+  template<typename F> static bool walk(xdr_skip &s, F *f, std::size_t i = 0) {
+    xdr_extent e;
+    if (!s.skip<field_type>(e))
+      return false;
+    (*f)(i, e);
+    return next::walk(s, f, i + 1);
+  }
+};
+} // namespace detail
+
+//! Check that \c m holds exactly one well-formed \c T, without
+//! decoding it.
+template<typename T> xdr_status
+xdr_check_msg(const msg_ptr &m)
+{
+  xdr_skip s(m);
+  s.skip<T>() && s.done();
+  return s.status();
+}
+
+namespace detail {
+//! Total encoded size of \c Args if all of them have a fixed size,
+//! otherwise 0.
+template<typename...Args> struct args_fixed_size
+  : std::integral_constant<std::size_t, 0> {};
+template<typename T, bool = xdr_traits<T>::has_fixed_size>
+struct arg_fixed_size : std::integral_constant<std::size_t, 0> {};
+template<typename T> struct arg_fixed_size<T, true>
+  : std::integral_constant<std::size_t, xdr_traits<T>::fixed_size> {};
+template<typename T> struct args_fixed_size<T> : arg_fixed_size<T> {};
+template<typename T, typename U, typename...Rest>
+struct args_fixed_size<T, U, Rest...>
+  : std::integral_constant<std::size_t,
+			   args_fixed_size<T>::value
+			   && args_fixed_size<U, Rest...>::value
+			   ? args_fixed_size<T>::value
+			     + args_fixed_size<U, Rest...>::value
+			   : 0> {};
+
+template<bool Whole, typename...Args> xdr_status
+check_args(const xdr_get &g)
+{
+  xdr_skip s(g.p_, g.e_);
+  // Skip each argument on its own, as xdr_argpack_archive does not
+  // charge the stack for the argument list.
+  bool ok = true;
+  bool seq[] = { true, (ok = ok && s.skip<Args>())... };
+  (void) seq;
+  if (ok && Whole)
+    s.done();
+  return s.status();
+}
+
+template<bool Whole, typename...Args> xdr_status
+try_get(xdr_get &g, Args &...args)
+{
+  constexpr std::size_t fixed = args_fixed_size<Args...>::value;
+  const std::uint32_t *const start = g.p_;
+  const std::uint32_t limit = g.stack_limit;
+  if (!fixed) {
+    // Walk the input first, so that decoding cannot fail on it.
+    xdr_status st = check_args<Whole, Args...>(g);
+    if (!st)
+      return st;
+  }
+  // Fixed-size arguments need only a single length check up front,
+  // as for xdr_get itself.  Anything else wrong with them (padding
+  // within opaque arrays, or the stack limit) is rare enough to find
+  // with an exception, after which the walk locates the problem.
+  else if (Whole ? g.remaining() != fixed : g.remaining() < fixed)
+    return check_args<Whole, Args...>(g);
+
+  try {
+    get_args<Whole>(g, args...);
+  }
+  catch (const xdr_invariant_failed &) {
+    g.stack_limit = limit;
+    return xdr_status{xdr_errc::invariant_failed,
+		      std::size_t(reinterpret_cast<const char *>(g.p_)
+				  - reinterpret_cast<const char *>(start))};
+  }
+  catch (const xdr_runtime_error &) {
+    if (!fixed)
+      throw;
+    g.p_ = start;
+    g.stack_limit = limit;
+    return check_args<Whole, Args...>(g);
+  }
+  return xdr_status{};
+}
+} // namespace detail
+
+//! Unmarshal \c args from the current position of \c g, reporting
+//! malformed input through the return value instead of throwing.
+//! Unless all \c args have a fixed size, the input is checked with \c
+//! xdr::xdr_skip before anything is decoded, so on failure \c args
+//! are untouched (unless an \c xdr::validate function rejects them)
+//! and \c g has not advanced.  Fixed-size \c args are decoded in a
+//! single pass, and may be partly overwritten if non-zero padding is
+//! found in an \c xdr::opaque_array.  Offsets in the
+//! result are relative to the starting position of \c g.  Unlike \c
+//! xdr::xdr_from_msg, this does not require the rest of the buffer to
+//! be consumed.
+template<typename...Args> inline xdr_status
+xdr_try_get(xdr_get &g, Args &...args)
+{
+  return detail::try_get<false>(g, args...);
+}
+
+//! Non-throwing counterpart of \c xdr::xdr_from_msg.  Both use the
+//! same decoder, but this one first walks the input with \c
+//! xdr::xdr_skip unless all of \c args have a fixed size, so \c
+//! xdr::xdr_from_msg remains the faster choice for trusted input.
+template<typename...Args> xdr_status
+xdr_try_from_msg(const msg_ptr &m, Args &...args)
+{
+  if (m->size() & 3)
+    return xdr_status{xdr_errc::bad_message_size, 0};
+  xdr_get g(m);
+  return detail::try_get<true>(g, args...);
+}
+
+//! Return the extent within \c m of field number \c n (counting from
+//! 0) of struct \c T.  \throws the same exceptions as \c xdr::xdr_get
+//! if the message is malformed up to and including that field, and
+//! \c std::out_of_range if \c T has no such field.
+template<typename T> xdr_extent
+xdr_field_extent(const msg_ptr &m, std::size_t n)
+{
+  xdr_skip s(m);
+  xdr_extent r;
+  bool found = false;
+  s.each_field<T>([&](std::size_t i, const xdr_extent &e) {
+      if (i == n) {
+	r = e;
+	found = true;
+      }
+    });
+  // Errors after the requested field are irrelevant.
+  if (!found) {
+    s.status().raise();
+    throw std::out_of_range("xdr_field_extent: no such field");
+  }
+  return r;
+}
+
+} // namespace xdr
+
+#endif // !_XDRPP_SKIP_H_HEADER_INCLUDED_
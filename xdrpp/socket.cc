@@ -157,13 +157,24 @@ bindable_address(const char *service, int family, int socktype)
 }
 
 unique_sock
-tcp_listen(const char *service, int family, int backlog)
+tcp_listen(const char *service, int family, int backlog, bool reuseport)
 {
   unique_addrinfo ai = bindable_address(service, family, SOCK_STREAM);
   unique_sock s(sock_t(socket(ai->ai_family, ai->ai_socktype,
 			      ai->ai_protocol)));
   if (!s)
     throw_sockerr("socket");
+  if (reuseport) {
+#ifdef SO_REUSEPORT
+    int one = 1;
+    if (setsockopt(s.get().fd_, SOL_SOCKET, SO_REUSEPORT,
+		   reinterpret_cast<const char *>(&one), sizeof one) == -1)
+      throw_sockerr("SO_REUSEPORT");
+#else // !SO_REUSEPORT
+    throw std::system_error(std::make_error_code(std::errc::not_supported),
+			    "SO_REUSEPORT");
+#endif // !SO_REUSEPORT
+  }
   if (bind(s.get().fd_, ai->ai_addr, ai->ai_addrlen) == -1)
     throw_sockerr("bind");
   if (listen(s.get().fd_, backlog) == -1)
@@ -184,6 +195,21 @@ udp_listen(const char *service, int family)
   return s;
 }
 
+unique_sock
+udp_connect(const char *host, const char *service, int family)
+{
+  unique_addrinfo ai = get_addrinfo(host, SOCK_DGRAM, service, family);
+  errno = EADDRNOTAVAIL;
+  for (const addrinfo *a = ai.get(); a; a = a->ai_next) {
+    unique_sock s(socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+    if (!s)
+      throw_sockerr("socket");
+    if (connect(s.get().fd_, a->ai_addr, a->ai_addrlen) == 0)
+      return s;
+  }
+  throw_sockerr("connect");
+}
+
 int
 socket_type(int fd)
 {
@@ -177,15 +177,29 @@ tcp_connect(const unique_addrinfo &ai)
 unique_sock tcp_connect(const char *host, const char *service,
 			int family = AF_UNSPEC);
 
-//! Create bind a listening TCP socket.
+//! Create bind a listening TCP socket.  With \c reuseport, set \c
+//! SO_REUSEPORT first, so that several sockets can listen on the
+//! same port and have the kernel spread connections among them.
 unique_sock tcp_listen(const char *service = nullptr,
 		       int family = AF_UNSPEC,
-		       int backlog = 5);
+		       int backlog = 5, bool reuseport = false);
 
 //! Create and bind a UDP socket.
 unique_sock udp_listen(const char *service = nullptr,
 		       int family = AF_UNSPEC);
 
+//! Create a UDP socket connected to (i.e., sending by default to and
+//! receiving only from) a particular host and service.
+unique_sock udp_connect(const char *host, const char *service,
+			int family = AF_UNSPEC);
+
+//! Create a Unix-domain stream socket listening at \c path, which
+//! must not already exist.  (Not available on Windows.)
+unique_sock unix_listen(const char *path, int backlog = 5);
+
+//! Connect to the Unix-domain stream socket at \c path.
+unique_sock unix_connect(const char *path);
+
 //! Returns SOCK_STREAM or SOCK_DGRAM.
 int socket_type(int fd);
 }
@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <xdrpp/socket.h>
 #include <xdrpp/srpc.h>
 #include <xdrpp/rpcb_prot.hh>
@@ -85,6 +86,46 @@ set_close_on_exec(sock_t s)
 }
 
 
+namespace {
+sockaddr_un
+unix_addr(const char *path)
+{
+  sockaddr_un sun;
+  std::memset(&sun, 0, sizeof sun);
+  sun.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof sun.sun_path)
+    throw std::system_error(ENAMETOOLONG, std::system_category(), path);
+  std::strcpy(sun.sun_path, path);
+  return sun;
+}
+}
+
+unique_sock
+unix_listen(const char *path, int backlog)
+{
+  sockaddr_un sun = unix_addr(path);
+  unique_sock s(sock_t(socket(AF_UNIX, SOCK_STREAM, 0)));
+  if (!s)
+    throw_sockerr("socket");
+  if (bind(s.fd(), reinterpret_cast<sockaddr *>(&sun), sizeof sun) == -1)
+    throw_sockerr("bind");
+  if (listen(s.fd(), backlog) == -1)
+    throw_sockerr("listen");
+  return s;
+}
+
+unique_sock
+unix_connect(const char *path)
+{
+  sockaddr_un sun = unix_addr(path);
+  unique_sock s(sock_t(socket(AF_UNIX, SOCK_STREAM, 0)));
+  if (!s)
+    throw_sockerr("socket");
+  if (connect(s.fd(), reinterpret_cast<sockaddr *>(&sun), sizeof sun) == -1)
+    throw_sockerr("connect");
+  return s;
+}
+
 void
 create_selfpipe(sock_t ss[2])
 {
@@ -1,8 +1,10 @@
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <iostream>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <xdrpp/exception.h>
 #include <xdrpp/srpc.h>
 
@@ -27,43 +29,75 @@ fullread(sock_t s, void *buf, size_t n)
 }
 
 msg_ptr
-read_message(sock_t s)
+read_message(sock_t s, std::size_t maxmsglen)
 {
-  std::uint32_t len;
-  ssize_t n = fullread(s, &len, 4);
-  if (n == -1)
-    throw xdr_system_error("xdr::read_message");
-  if (n < 4)
-    throw xdr_bad_message_size("read_message: premature EOF");
-  if (len & 3)
-    throw xdr_bad_message_size("read_message: received size not multiple of 4");
+  std::vector<msg_ptr> frags;
+  std::size_t total = 0;
+  bool last;
+  do {
+    std::uint32_t len;
+    ssize_t n = fullread(s, &len, 4);
+    if (n == -1)
+      throw xdr_system_error("xdr::read_message");
+    if (n < 4)
+      throw xdr_bad_message_size("read_message: premature EOF");
 
-  len = swap32le(len);
-  if (len & 0x80000000)
+    len = swap32le(len);
+    last = len & 0x80000000;
     len &= 0x7fffffff;
-  else
-    throw xdr_bad_message_size("read_message: message fragments unimplemented");
+    if (len > maxmsglen - total)
+      throw xdr_bad_message_size("read_message: message too long");
+    if (frags.size() >= max_record_fragments)
+      throw xdr_bad_message_size("read_message: too many fragments");
+    total += len;
 
-  msg_ptr m = message_t::alloc(len);
-  n = fullread(s, m->data(), len);
-  if (n == -1)
-    throw xdr_system_error("xdr::read_message");
-  if (n != len)
-    throw xdr_bad_message_size("read_message: premature EOF");
+    msg_ptr m = message_t::alloc(len);
+    n = fullread(s, m->data(), len);
+    if (n == -1)
+      throw xdr_system_error("xdr::read_message");
+    if (n != len)
+      throw xdr_bad_message_size("read_message: premature EOF");
+    frags.push_back(std::move(m));
+  } while (!last);
 
+  msg_ptr m = frags.size() == 1 ? std::move(frags.front())
+    : message_t::concat(frags);
+  if (m->size() & 3)
+    throw xdr_bad_message_size("read_message: received size not multiple of 4");
   return m;
 }
 
 void
 write_message(sock_t s, const msg_ptr &m)
 {
-  ssize_t n = write(s, m->raw_data(), m->raw_size());
-  if (n == -1)
-    throw xdr_system_error("xdr::write_message");
-  // If this assertion fails, the file descriptor may have had
-  // O_NONBLOCK set, which is not allowed for the synchronous
-  // interface.
-  assert(std::size_t(n) == m->raw_size());
+  ssize_t n;
+  if (m->size() <= max_fragment_len) {
+    n = write(s, m->raw_data(), m->raw_size());
+    if (n == -1)
+      throw xdr_system_error("xdr::write_message");
+    // If this assertion fails, the file descriptor may have had
+    // O_NONBLOCK set, which is not allowed for the synchronous
+    // interface.
+    assert(std::size_t(n) == m->raw_size());
+    return;
+  }
+
+  // Too big for one fragment
+  for (std::size_t pos = 0; pos < m->size();) {
+    std::size_t len = std::min(m->size() - pos, max_fragment_len);
+    std::uint32_t hdr = swap32le(std::uint32_t(len)
+				 | (pos + len == m->size() ? 0x80000000 : 0));
+    iovec v[2];
+    v[0].iov_base = &hdr;
+    v[0].iov_len = sizeof hdr;
+    v[1].iov_base = const_cast<char *>(m->data()) + pos;
+    v[1].iov_len = len;
+    n = writev(s, v, 2);
+    if (n == -1)
+      throw xdr_system_error("xdr::write_message");
+    assert(std::size_t(n) == len + sizeof hdr);
+    pos += len;
+  }
 }
 
 uint32_t xid_counter;
@@ -82,9 +116,11 @@ prepare_call(uint32_t prog, uint32_t vers, uint32_t proc, rpc_msg &hdr)
 void
 srpc_server::run()
 {
-  for (;;)
+  for (;;) {
     dispatch(nullptr, read_message(s_),
-	     std::bind(write_message, s_, std::placeholders::_1));
+	     std::bind(write_message, s_, std::placeholders::_1), &arena_);
+    arena_.reset();
+  }
 }
 
 }
@@ -5,6 +5,7 @@
 
 //! \file srpc.h Simple synchronous RPC functions.
 
+#include <xdrpp/arena.h>
 #include <xdrpp/exception.h>
 #include <xdrpp/server.h>
 
@@ -12,7 +13,10 @@ namespace xdr {
 
 extern bool xdr_trace_client;
 
-msg_ptr read_message(sock_t s);
+//! Read one record, joining its fragments.  Throws \c
+//! xdr_bad_message_size if the record would exceed \c maxmsglen bytes
+//! or \c max_record_fragments fragments.
+msg_ptr read_message(sock_t s, std::size_t maxmsglen = max_fragment_len);
 void write_message(sock_t s, const msg_ptr &m);
 
 void prepare_call(uint32_t prog, uint32_t vers, uint32_t proc, rpc_msg &hdr);
@@ -118,20 +122,25 @@ public:
   srpc_service(T &server)
     : service_base(Interface::program, Interface::version), server_(server) {}
 
-  void process(void *session, rpc_msg &hdr, xdr_get &g, cb_t reply) override {
+  void process(void *session, rpc_msg &hdr, xdr_get &g, msg_ptr &m,
+	       cb_t reply) override {
     if (!check_call(hdr))
       reply(nullptr);
     if (!Interface::call_dispatch(*this, hdr.body.cbody().proc,
 				  static_cast<Session *>(session),
-				  hdr, g, std::move(reply)))
+				  hdr, g, m, std::move(reply)))
       reply(rpc_accepted_error_msg(hdr.xid, PROC_UNAVAIL));
   }
 
   template<typename P>
-  void dispatch(Session *session, rpc_msg &hdr, xdr_get &g, cb_t reply) {
+  void dispatch(Session *session, rpc_msg &hdr, xdr_get &g, msg_ptr &m,
+		cb_t reply) {
     wrap_transparent_ptr<typename P::arg_tuple_type> arg;
     if (!decode_arg(g, arg))
       return reply(rpc_accepted_error_msg(hdr.xid, GARBAGE_ARGS));
+    // Only the arguments come from the request's arena, if any; what
+    // the handler creates or copies must outlive the request.
+    arena_scope heap(nullptr);
     
     if (xdr_trace_server) {
       std::string s = "CALL ";
@@ -159,6 +168,7 @@ public:
 class srpc_server : public rpc_server_base {
   const sock_t s_;
   bool close_on_destruction_;
+  arena arena_;
 
 public:
   srpc_server(sock_t s, bool close_on_destruction = true)
@@ -171,7 +181,12 @@ public:
     register_service_base(new srpc_service<T, void, Interface>(t));
   }
 
-  //! Start serving requests.  (Loops until an exception.)
+  //! Start serving requests.  (Loops until an exception.)  Arguments
+  //! of types generated with <tt>xdrc -arena</tt> are decoded into an
+  //! arena that is reset after each reply is sent, so handlers must
+  //! not keep references to them.  Move-assigning an argument into
+  //! an existing container is safe (it copies), but move-constructing
+  //! a new object from one keeps the arena memory and is not.
   void run();
 };
 
@@ -180,6 +195,13 @@ template<typename Session = void,
 using srpc_tcp_listener =
   generic_rpc_tcp_listener<srpc_service, Session, SessionAllocator>;
 
+template<typename Session = void,
+	 typename SessionAllocator = session_allocator<Session>>
+using srpc_tcp_multi_listener =
+  generic_rpc_tcp_multi_listener<srpc_service, Session, SessionAllocator>;
+
+using srpc_udp_listener = generic_rpc_udp_listener<srpc_service>;
+
 }
 
 #endif // !_XDRPP_SRPC_H_HEADER_INCLUDED_
@@ -0,0 +1,78 @@
+
+#include <algorithm>
+#include <xdrpp/threadpool.h>
+
+namespace xdr {
+
+thread_pool::thread_pool(std::size_t nthreads, std::size_t max_queue,
+			 overflow_t overflow)
+  : max_queue_(max_queue), overflow_(overflow)
+{
+  if (!nthreads)
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t i = 0; i < nthreads; i++)
+    threads_.emplace_back(&thread_pool::work, this);
+}
+
+thread_pool::~thread_pool()
+{
+  {
+    std::lock_guard<std::mutex> lk(lock_);
+    stopping_ = true;
+  }
+  nonempty_.notify_all();
+  nonfull_.notify_all();
+  for (std::thread &t : threads_)
+    t.join();
+}
+
+bool
+thread_pool::submit(task_t task, int priority)
+{
+  std::unique_lock<std::mutex> lk(lock_);
+  if (max_queue_ && overflow_ == Block)
+    nonfull_.wait(lk, [this]() {
+	return stopping_ || queue_.size() < max_queue_;
+      });
+  if (stopping_ || (max_queue_ && queue_.size() >= max_queue_)) {
+    ++stats_.rejected;
+    return false;
+  }
+  queue_.push(entry{priority, seq_++, std::move(task)});
+  stats_.queued = queue_.size();
+  stats_.max_queued = std::max(stats_.max_queued, stats_.queued);
+  lk.unlock();
+  nonempty_.notify_one();
+  return true;
+}
+
+thread_pool::stats
+thread_pool::get_stats() const
+{
+  std::lock_guard<std::mutex> lk(lock_);
+  return stats_;
+}
+
+void
+thread_pool::work()
+{
+  std::unique_lock<std::mutex> lk(lock_);
+  for (;;) {
+    nonempty_.wait(lk, [this]() { return stopping_ || !queue_.empty(); });
+    if (queue_.empty())
+      return;			// Only once stopping_
+    task_t task {std::move(queue_.top().task)};
+    queue_.pop();
+    stats_.queued = queue_.size();
+    ++stats_.running;
+    lk.unlock();
+    nonfull_.notify_one();
+    task();
+    task = nullptr;
+    lk.lock();
+    --stats_.running;
+    ++stats_.completed;
+  }
+}
+
+} // namespace xdr
@@ -0,0 +1,92 @@
+// -*- C++ -*-
+
+//! \file threadpool.h A fixed set of worker threads running queued
+//! tasks, used by \c pollset_plus::async.
+
+#ifndef _XDRPP_THREADPOOL_H_INCLUDED_
+#define _XDRPP_THREADPOOL_H_INCLUDED_ 1
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace xdr {
+
+//! Runs tasks on a fixed number of threads.  Queued tasks run highest
+//! priority first, and in the order submitted within a priority.
+//! The queue may be bounded, in which case submitting to a full
+//! queue either waits for room or fails, depending on the pool's \c
+//! overflow_t.
+class thread_pool {
+public:
+  using task_t = std::function<void()>;
+
+  //! What \c submit does when the queue is full.
+  enum overflow_t {
+    //! Wait until a worker takes a task off the queue.
+    Block,
+    //! Return \c false without queueing the task.
+    Reject
+  };
+
+  //! Counters, for monitoring.
+  struct stats {
+    std::size_t queued;		//!< Tasks waiting for a worker
+    std::size_t running;	//!< Tasks being run by a worker
+    std::size_t max_queued;	//!< Most tasks ever waiting at once
+    std::uint64_t completed;	//!< Tasks that have finished
+    std::uint64_t rejected;	//!< Tasks refused by \c submit
+  };
+
+  //! Start \c nthreads workers (one per CPU if 0).  A \c max_queue
+  //! of 0 leaves the queue unbounded.
+  explicit thread_pool(std::size_t nthreads = 0, std::size_t max_queue = 0,
+		       overflow_t overflow = Block);
+  //! Runs the tasks still queued, then stops the workers.  Producers
+  //! waiting in \c submit get \c false.
+  ~thread_pool();
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  //! Queue \c task to run on a worker.  Returns \c false if the task
+  //! was rejected because the queue is full (or the pool is being
+  //! destroyed).  Tasks must not throw.
+  bool submit(task_t task, int priority = 0);
+
+  std::size_t size() const { return threads_.size(); }
+  std::size_t max_queue() const { return max_queue_; }
+  stats get_stats() const;
+
+private:
+  struct entry {
+    int priority;
+    std::uint64_t seq;
+    // Mutable so it can be moved out of the top of the queue.
+    mutable task_t task;
+    bool operator<(const entry &e) const {
+      return priority < e.priority
+	|| (priority == e.priority && seq > e.seq);
+    }
+  };
+
+  const std::size_t max_queue_;
+  const overflow_t overflow_;
+  mutable std::mutex lock_;
+  std::condition_variable nonempty_;
+  std::condition_variable nonfull_;
+  std::priority_queue<entry> queue_;
+  std::uint64_t seq_ {0};
+  bool stopping_ {false};
+  stats stats_ {};
+  std::vector<std::thread> threads_;
+
+  void work();
+};
+
+} // namespace xdr
+
+#endif // !_XDRPP_THREADPOOL_H_INCLUDED_
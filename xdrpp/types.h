@@ -5,6 +5,7 @@
 #ifndef _XDRC_TYPES_H_HEADER_INCLUDED_
 #define _XDRC_TYPES_H_HEADER_INCLUDED_ 1
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstdint>
@@ -128,6 +129,8 @@ validate(const T &t)
 //! invoke \c archive_adapter::apply directly.  Instead, call \c
 //! xdr::archive, as the latter may be specialized for certain types.
 template<typename Archive> struct archive_adapter {
+  //! Absent from specializations that make use of field names.
+  using ignores_names = std::true_type;
   template<typename T> static void apply(Archive &ar, T &&t, const char *) {
     ar(std::forward<T>(t));
   }
@@ -308,6 +311,102 @@ template<> struct xdr_traits<bool>
 static Constexpr const uint32_t XDR_MAX_LEN = 0xfffffffc;
 
 namespace detail {
+//! Placeholder type to avoid clearing array
+struct no_clear_t {
+  Constexpr no_clear_t() {}
+};
+Constexpr const no_clear_t no_clear;
+
+//! A lower bound on the marshaled size of any value of type \c T (0
+//! if nothing useful is known).
+template<typename T, typename = void> struct min_size
+  : std::integral_constant<std::size_t, 0> {};
+template<typename T> struct min_size<
+  T, typename std::enable_if<xdr_traits<T>::has_fixed_size>::type>
+  : std::integral_constant<std::size_t, xdr_traits<T>::fixed_size> {};
+// Anything variable-length starts with a 4-byte count, and a union
+// with its discriminant.  Don't look at the element type, which might
+// be the type being defined.
+template<typename T> struct min_size<
+  T, typename std::enable_if<!xdr_traits<T>::has_fixed_size
+			     && xdr_traits<T>::variable_nelem>::type>
+  : std::integral_constant<std::size_t, 4> {};
+template<typename T> struct min_size<
+  T, typename std::enable_if<!xdr_traits<T>::has_fixed_size
+			     && xdr_traits<T>::is_union>::type>
+  : std::integral_constant<std::size_t, 4> {};
+template<typename T> struct min_size<
+  T, typename std::enable_if<!xdr_traits<T>::has_fixed_size
+			     && xdr_traits<T>::is_container
+			     && !xdr_traits<T>::variable_nelem>::type>
+  : std::integral_constant<std::size_t,
+			   T::container_fixed_nelem
+			   * min_size<typename T::value_type>::value> {};
+
+// S is the xdr_traits of a struct; sum over the field_info chain.
+template<typename S, typename = void> struct struct_min_size
+  : std::integral_constant<std::size_t, 0> {};
+template<typename S> struct struct_min_size<
+  S, typename std::enable_if<
+       !std::is_same<typename S::field_info, void>::value>::type>
+  : std::integral_constant<std::size_t,
+			   min_size<typename S::field_info::field_type>::value
+			   + struct_min_size<typename S::next_field>::value> {};
+template<typename T> struct min_size<
+  T, typename std::enable_if<!xdr_traits<T>::has_fixed_size
+			     && xdr_traits<T>::is_struct>::type>
+  : struct_min_size<xdr_traits<T>> {};
+
+template<typename T> inline auto
+reserve_nelem(T &t, std::uint32_t n, int) -> decltype(t.reserve(n))
+{
+  t.reserve(n);
+}
+template<typename T> inline void
+reserve_nelem(T &, std::uint32_t, ...)
+{
+}
+
+// Called before loading n elements into container t from an archive
+// that knows how much input remains (see xdr_generic_get::remaining).
+// Rejects n outright if the elements cannot all fit, rather than
+// allocating for a count taken from hostile input, and otherwise
+// makes room for all of them at once.  Returns true if the input is
+// known to hold all n elements in full.
+template<typename Archive, typename T> inline auto
+prepare_load(Archive &a, T &t, std::uint32_t n, int)
+  -> decltype(a.remaining(), bool())
+{
+  using V = typename T::value_type;
+  Constexpr const std::size_t sz = min_size<V>::value;
+  if (!sz)
+    return false;
+  if (n > a.remaining() / sz)
+    throw xdr_overflow("element count exceeds remaining input");
+  reserve_nelem(t, n, 0);
+  return has_fixed_size_t<V>::value;
+}
+template<typename Archive, typename T> inline bool
+prepare_load(Archive &, T &, std::uint32_t, ...)
+{
+  return false;
+}
+
+// Element i of t, appended if necessary without clearing it first
+// (for containers that support this).  Only for elements that are
+// certain to be overwritten completely.
+template<typename T> inline auto
+extend_no_clear(T &t, std::uint32_t i, int)
+  -> decltype(t.extend_at(i, no_clear))
+{
+  return t.extend_at(i, no_clear);
+}
+template<typename T> inline typename T::value_type &
+extend_no_clear(T &t, std::uint32_t i, ...)
+{
+  return t.extend_at(i);
+}
+
 //! Convenience supertype for traits of the three container types
 //! (xarray, xvectors, and pointer).
 template<typename T, bool variable,
@@ -330,14 +429,30 @@ struct xdr_container_base : xdr_traits_base {
     if (variable) {
       archive(a, n);
       t.check_size(n);
+      bool whole = detail::prepare_load(a, t, n, 0);
       if (t.size() > n)
 	t.resize(n);
+      if (whole)
+	return load_elems(a, t, n, std::integral_constant<bool, VFixed>{});
     }
     else
       n = size32(t.size());
+    load_elems(a, t, n, std::false_type{});
+  }
+  template<typename Archive> static void
+  load_elems(Archive &a, T &t, uint32_t n, std::false_type) {
     for (uint32_t i = 0; i < n; ++i)
       archive(a, t.extend_at(i));
   }
+  // The input holds all n elements, so each one appended is bound to
+  // be overwritten and there is no point in clearing it first (see
+  // opaque_array).
+  template<typename Archive> static void
+  load_elems(Archive &a, T &t, uint32_t n, std::true_type) {
+    for (uint32_t i = 0; i < n; ++i)
+      archive(a, detail::extend_no_clear(t, i, 0));
+  }
+
   static std::size_t serial_size(const T &t) {
     std::size_t s = variable ? 4 : 0;
     for (const value_type &v : t)
@@ -360,12 +475,6 @@ template<typename T> struct xdr_container_base<T, false, true>
     T::container_fixed_nelem * xdr_traits<typename T::value_type>::fixed_size;
   static std::size_t serial_size(const T &) { return fixed_size; }
 };
-
-//! Placeholder type to avoid clearing array
-struct no_clear_t {
-  Constexpr no_clear_t() {}
-};
-Constexpr const no_clear_t no_clear;
 } // namespace detail
 
 //! XDR arrays are implemented using std::array as a supertype.
@@ -375,7 +484,9 @@ template<typename T, uint32_t N> struct xarray
   xarray() { array::fill(T{}); }
   xarray(detail::no_clear_t) {}
   xarray(const xarray &) = default;
+  xarray(xarray &&) = default;
   xarray &operator=(const xarray &) = default;
+  xarray &operator=(xarray &&) = default;
 
   static Constexpr const std::size_t container_fixed_nelem = N;
   static Constexpr std::size_t size() { return N; }
@@ -420,10 +531,12 @@ template<uint32_t N> struct xdr_traits<opaque_array<N>> : xdr_traits_base {
 
 //! A vector with a maximum size (returned by xvector::max_size()).
 //! Note that you can exceed the size, but an error will happen when
-//! marshaling or unmarshaling the data structure.
-template<typename T, uint32_t N = XDR_MAX_LEN>
-struct xvector : std::vector<T> {
-  using vector = std::vector<T>;
+//! marshaling or unmarshaling the data structure.  \c A is the
+//! allocator (see \c xdr::arena_allocator).
+template<typename T, uint32_t N = XDR_MAX_LEN,
+	 typename A = std::allocator<T>>
+struct xvector : std::vector<T, A> {
+  using vector = std::vector<T, A>;
   using vector::vector;
 
   //! Return the maximum size allowed by the type.
@@ -446,26 +559,40 @@ struct xvector : std::vector<T> {
       this->emplace_back();
     return (*this)[i];
   }
+  //! Like \c extend_at, but if \c T can be constructed from \c
+  //! detail::no_clear, a new element is left uninitialized.
+  T &extend_at(uint32_t i, detail::no_clear_t) {
+    if (i >= N)
+      throw xdr_overflow("attempt to access invalid position in xdr::xvector");
+    if (i == this->size())
+      emplace_no_clear(std::is_constructible<T, detail::no_clear_t>{});
+    return (*this)[i];
+  }
   void resize(uint32_t n) {
     check_size(n);
     vector::resize(n);
   }
+
+private:
+  void emplace_no_clear(std::true_type) { this->emplace_back(detail::no_clear); }
+  void emplace_no_clear(std::false_type) { this->emplace_back(); }
 };
 
 namespace detail {
-template<typename T> struct has_fixed_size_t<xvector<T>> : std::false_type {};
+template<typename T, uint32_t N, typename A>
+struct has_fixed_size_t<xvector<T,N,A>> : std::false_type {};
 }
 
-template<typename T, uint32_t N> struct xdr_traits<xvector<T,N>>
-  : detail::xdr_container_base<xvector<T,N>, true> {};
+template<typename T, uint32_t N, typename A> struct xdr_traits<xvector<T,N,A>>
+  : detail::xdr_container_base<xvector<T,N,A>, true> {};
 
 //! Variable-length opaque data is just a vector of std::uint8_t.
 template<uint32_t N = XDR_MAX_LEN> using opaque_vec = xvector<std::uint8_t, N>;
-template<uint32_t N>
-struct xdr_traits<xvector<std::uint8_t, N>> : xdr_traits_base {
+template<uint32_t N, typename A>
+struct xdr_traits<xvector<std::uint8_t, N, A>> : xdr_traits_base {
   static Constexpr const bool is_bytes = true;
   static Constexpr const bool has_fixed_size = false;;
-  static Constexpr std::size_t serial_size(const opaque_vec<N> &a) {
+  static Constexpr std::size_t serial_size(const xvector<std::uint8_t, N, A> &a) {
     return (std::size_t(a.size()) + std::size_t(7)) & ~std::size_t(3);
   }
   static Constexpr const bool variable_nelem = true;
@@ -474,9 +601,12 @@ struct xdr_traits<xvector<std::uint8_t, N>> : xdr_traits_base {
 
 //! A string with a maximum length (returned by xstring::max_size()).
 //! Note that you can exceed the size, but an error will happen when
-//! marshaling or unmarshaling the data structure.
-template<uint32_t N = XDR_MAX_LEN> struct xstring : std::string {
-  using string = std::string;
+//! marshaling or unmarshaling the data structure.  \c A is the
+//! allocator (see \c xdr::arena_allocator).
+template<uint32_t N = XDR_MAX_LEN, typename A = std::allocator<char>>
+struct xstring : std::basic_string<char, std::char_traits<char>, A> {
+  using string = std::basic_string<char, std::char_traits<char>, A>;
+  using typename string::size_type;
 
   //! Return the maximum size allowed by the type.
   static Constexpr uint32_t max_size() { return N; }
@@ -490,7 +620,7 @@ template<uint32_t N = XDR_MAX_LEN> struct xstring : std::string {
   //! Check that the string length is not greater than the maximum
   //! size.  \throws std::out_of_range and clears the contents of the
   //! string if it is too long.
-  void validate() const { check_size(size()); }
+  void validate() const { check_size(this->size()); }
 
   xstring() = default;
   xstring(const xstring &) = default;
@@ -525,36 +655,223 @@ template<uint32_t N = XDR_MAX_LEN> struct xstring : std::string {
   void resize(size_type n, char ch) { check_size(n); string::resize(n, ch); }
 };
 
-template<uint32_t N> struct xdr_traits<xstring<N>> : xdr_traits_base {
+template<uint32_t N, typename A>
+struct xdr_traits<xstring<N, A>> : xdr_traits_base {
   static Constexpr const bool is_bytes = true;
   static Constexpr const bool has_fixed_size = false;;
-  static Constexpr std::size_t serial_size(const xstring<N> &a) {
+  static Constexpr std::size_t serial_size(const xstring<N, A> &a) {
     return (std::size_t(a.size()) + std::size_t(7)) & ~std::size_t(3);
   }
   static Constexpr const bool variable_nelem = true;
 };
 
 
+namespace detail {
+//! Common implementation of \c xdr::opaque_view and \c
+//! xdr::xstring_view.
+template<typename T, uint32_t N> class bytes_view {
+  const T *data_ {nullptr};
+  uint32_t size_ {0};
+
+public:
+  using value_type = T;
+  using const_iterator = const T *;
+
+  bytes_view() = default;
+  bytes_view(const T *data, std::size_t size) : data_(data) {
+    check_size(size);
+    size_ = uint32_t(size);
+  }
+
+  //! Return the maximum size allowed by the type.
+  static Constexpr uint32_t max_size() { return N; }
+
+  //! Check whether a size is in bounds
+  static void check_size(std::size_t n) {
+    if (n > max_size())
+      throw xdr_overflow("xdr bytes view overflow");
+  }
+
+  const T *data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+  const T *begin() const { return data_; }
+  const T *end() const { return data_ + size_; }
+  const T &operator[](std::size_t i) const { return data_[i]; }
+
+  //! A view cannot grow, but it can be truncated (e.g., by \c
+  //! xdr::xdr_clear).
+  void resize(std::size_t n) {
+    if (n > size_)
+      throw xdr_overflow("cannot grow xdr bytes view");
+    size_ = uint32_t(n);
+  }
+
+  friend bool operator==(const bytes_view &a, const bytes_view &b) {
+    return a.size_ == b.size_ && std::equal(a.begin(), a.end(), b.begin());
+  }
+  friend bool operator!=(const bytes_view &a, const bytes_view &b) {
+    return !(a == b);
+  }
+  friend bool operator<(const bytes_view &a, const bytes_view &b) {
+    return std::lexicographical_compare(a.begin(), a.end(),
+					b.begin(), b.end());
+  }
+};
+
+//! True for the borrowed byte types \c xdr::opaque_view and \c
+//! xdr::xstring_view, which unmarshal without copying.
+template<typename T> struct is_bytes_view : std::false_type {};
+} // namespace detail
+
+//! A borrowed, read-only reference to variable-length opaque data.
+//! It marshals exactly like \c xdr::opaque_vec<N>.  When
+//! unmarshaled, however, it points directly into the buffer being
+//! decoded (usually an \c xdr::message_t) instead of copying the
+//! bytes.  Hence the view is valid only as long as that buffer is.
+//! In the arguments of an RPC handler, that means until the handler
+//! returns (\c srpc_server) or sends its reply (\c arpc_server).
+//! To use views in generated types, declare a typedef in a literal
+//! line of the \c .x file, e.g.:
+//! \code
+//!   %typedef xdr::opaque_view<> blob_view;
+//! \endcode
+template<uint32_t N = XDR_MAX_LEN> struct opaque_view
+  : detail::bytes_view<std::uint8_t, N> {
+  using base = detail::bytes_view<std::uint8_t, N>;
+  using base::base;
+  opaque_view() = default;
+  template<uint32_t M> opaque_view(const opaque_vec<M> &v)
+    : base(v.data(), v.size()) {}
+  template<uint32_t M> opaque_view(const opaque_array<M> &v)
+    : base(v.data(), v.size()) {}
+
+  //! Copy the bytes into an owned \c xdr::opaque_vec.
+  opaque_vec<N> vec() const { return opaque_vec<N>(this->begin(), this->end()); }
+};
+
+//! A borrowed, read-only reference to a string, with the same
+//! lifetime caveats as \c xdr::opaque_view.  Marshals like \c
+//! xdr::xstring<N>.
+template<uint32_t N = XDR_MAX_LEN> struct xstring_view
+  : detail::bytes_view<char, N> {
+  using base = detail::bytes_view<char, N>;
+  using base::base;
+  xstring_view() = default;
+  xstring_view(const char *s) : base(s, std::strlen(s)) {}
+  xstring_view(const std::string &s) : base(s.data(), s.size()) {}
+
+  //! Copy the characters into an owned \c std::string.
+  std::string str() const { return std::string(this->begin(), this->end()); }
+};
+
+namespace detail {
+template<uint32_t N> struct is_bytes_view<opaque_view<N>> : std::true_type {};
+template<uint32_t N> struct is_bytes_view<xstring_view<N>> : std::true_type {};
+} // namespace detail
+
+template<uint32_t N> struct xdr_traits<opaque_view<N>> : xdr_traits_base {
+  static Constexpr const bool is_bytes = true;
+  static Constexpr const bool has_fixed_size = false;
+  static Constexpr std::size_t serial_size(const opaque_view<N> &a) {
+    return (std::size_t(a.size()) + std::size_t(7)) & ~std::size_t(3);
+  }
+  static Constexpr const bool variable_nelem = true;
+};
+
+template<uint32_t N> struct xdr_traits<xstring_view<N>> : xdr_traits_base {
+  static Constexpr const bool is_bytes = true;
+  static Constexpr const bool has_fixed_size = false;
+  static Constexpr std::size_t serial_size(const xstring_view<N> &a) {
+    return (std::size_t(a.size()) + std::size_t(7)) & ~std::size_t(3);
+  }
+  static Constexpr const bool variable_nelem = true;
+};
+
+namespace detail {
+//! How \c xdr::pointer allocates and frees its target when using
+//! allocator \c A.  Specialized in \c xdrpp/arena.h.
+template<typename T, typename A> struct pointer_alloc {
+  using deleter = std::default_delete<T>;
+  template<typename...Args> static std::unique_ptr<T, deleter>
+  make(Args &&...args) {
+    return std::unique_ptr<T, deleter>(new T(std::forward<Args>(args)...));
+  }
+};
+
+//! True if \c P is a pointer to struct \c T that is also the last
+//! field of \c T, so that chains of them form a linked list.  \c
+//! xdrc marks such structs with a static \c _xdr_list_next function
+//! returning the member pointer.  Lists are copied, destroyed,
+//! marshaled, and unmarshaled iteratively rather than recursively.
+template<typename T, typename P, typename = void> struct is_list_link
+  : std::false_type {};
+template<typename T, typename P> struct is_list_link<
+  T, P, typename std::enable_if<
+	  std::is_same<decltype(T::_xdr_list_next()), P T::*>::value>::type>
+  : std::true_type {};
+
+//! Calls \c f with the member pointer of every field of a list node
+//! except the link.  \c S is the \c xdr_traits of the node type (or
+//! a suffix of its field chain).
+template<typename S, typename = void> struct list_node_fields {
+  template<typename F> static void apply(F &&) {}
+};
+template<typename S> struct list_node_fields<
+  S, typename std::enable_if<
+       !std::is_same<typename S::next_field::field_info, void>::value>::type> {
+  template<typename F> static void apply(F &&f) {
+    f(S::field_info::value());
+    list_node_fields<typename S::next_field>::apply(f);
+  }
+};
+
+//! True if \c Archive ignores field names, and so can be applied to
+//! the fields of a list node without going through the node's
+//! traits.
+template<typename Archive, typename = void> struct ignores_names
+  : std::false_type {};
+template<typename Archive> struct ignores_names<
+  Archive, typename std::enable_if<
+	     archive_adapter<Archive>::ignores_names::value>::type>
+  : std::true_type {};
+} // namespace detail
+
 //! Optional data (represented with pointer notation in XDR source).
-template<typename T> struct pointer : std::unique_ptr<T> {
+template<typename T, typename A = std::allocator<T>> struct pointer
+  : std::unique_ptr<T, typename detail::pointer_alloc<T, A>::deleter> {
+  using alloc = detail::pointer_alloc<T, A>;
+  using unique_ptr = std::unique_ptr<T, typename alloc::deleter>;
   using value_type = T;
-  using std::unique_ptr<T>::unique_ptr;
-  using std::unique_ptr<T>::get;
+  using is_list = detail::is_list_link<T, pointer>;
+  using unique_ptr::unique_ptr;
+  using unique_ptr::get;
   pointer() = default;
-  pointer(const pointer &p) : std::unique_ptr<T>(p ? new T(*p) : nullptr) {}
+  pointer(const pointer &p) : unique_ptr() { assign(p, is_list{}); }
   pointer(pointer &&p) = default;
+  ~pointer() { clear(is_list{}); }
   pointer &operator=(const pointer &up) {
-    if (const T *tp = up.get()) {
-      if (T *selfp = this->get())
-	*selfp = *tp;
-      else
-	this->reset(new T(*tp));
+    assign(up, is_list{});
+    return *this;
+  }
+  pointer &operator=(pointer &&up) {
+    if (this != &up) {
+      // The old target is destroyed only after up has been moved, in
+      // case up is part of it.
+      pointer old(std::move(*this));
+      unique_ptr::operator=(std::move(up));
     }
-    else
-      this->reset();
     return *this;
   }
-  pointer &operator=(pointer &&) = default;
+  //! Like \c unique_ptr::reset, but frees a list without recursing.
+  void reset(typename unique_ptr::pointer p = nullptr) {
+    clear(is_list{});
+    unique_ptr::reset(p);
+  }
+
+  //! For a list node, the field linking it to the next node.
+  static pointer &next(T &t) { return t.*T::_xdr_list_next(); }
+  static const pointer &next(const T &t) { return t.*T::_xdr_list_next(); }
 
   static void check_size(uint32_t n) {
     if (n > 1)
@@ -569,7 +886,7 @@ template<typename T> struct pointer : std::unique_ptr<T> {
     if (i != 0)
       throw xdr_overflow("attempt to access position > 0 in xdr::pointer");
     if (!size())
-      this->reset(new T);
+      unique_ptr::operator=(alloc::make());
     return **this;
   }
   void resize(uint32_t n) {
@@ -580,7 +897,7 @@ template<typename T> struct pointer : std::unique_ptr<T> {
       this->reset();
       break;
     case 1:
-      this->reset(new T);
+      unique_ptr::operator=(alloc::make());
       break;
     default:
       throw xdr_overflow("xdr::pointer::resize: valid sizes are 0 and 1");
@@ -588,7 +905,7 @@ template<typename T> struct pointer : std::unique_ptr<T> {
   }
   T &activate() {
     if (!*this)
-      this->reset(new T{});
+      unique_ptr::operator=(alloc::make());
     return *this->get();
   }
 
@@ -611,14 +928,111 @@ template<typename T> struct pointer : std::unique_ptr<T> {
   friend bool operator>=(const pointer &a, const pointer &b) {
     return !(a < b);
   }
+
+private:
+  void assign(const pointer &up, std::false_type) {
+    if (const T *tp = up.get()) {
+      if (T *selfp = this->get())
+	*selfp = *tp;
+      else
+	unique_ptr::operator=(alloc::make(*tp));
+    }
+    else
+      this->reset();
+  }
+  // Copy node by node, reusing any nodes already in this list.
+  void assign(const pointer &up, std::true_type) {
+    pointer *dst = this;
+    for (const pointer *src = &up; *src; src = &next(**src)) {
+      T &d = dst->activate();
+      const T &s = **src;
+      detail::list_node_fields<xdr_traits<T>>::apply(
+	[&d, &s](auto field) { d.*field = s.*field; });
+      dst = &next(d);
+    }
+    dst->reset();
+  }
+
+  void clear(std::false_type) {}
+  // Detach each node's successor before deleting it, so that freeing
+  // a long list does not recurse.
+  void clear(std::true_type) {
+    unique_ptr p(std::move(*this));
+    while (p) {
+      unique_ptr n(std::move(next(*p)));
+      p = std::move(n);
+    }
+  }
 };
 
 // Note an explicit third template argument (VFixed = false) is
 // required because pointers are used recursively, so we might not
 // have xdr_traits<T> available at the time we instantiate
 // xdr_traits<pointer<T>>.
-template<typename T> struct xdr_traits<pointer<T>>
-  : detail::xdr_container_base<pointer<T>, true, false> {};
+template<typename T, typename A> struct xdr_traits<pointer<T,A>>
+  : detail::xdr_container_base<pointer<T,A>, true, false> {
+  using base = detail::xdr_container_base<pointer<T,A>, true, false>;
+  template<typename Archive> using iterate = std::integral_constant<
+    bool, pointer<T,A>::is_list::value && detail::ignores_names<Archive>::value>;
+
+  template<typename Archive> static void save(Archive &a, const pointer<T,A> &t) {
+    save(a, t, iterate<Archive>{});
+  }
+  template<typename Archive> static void load(Archive &a, pointer<T,A> &t) {
+    load(a, t, iterate<Archive>{});
+  }
+  static std::size_t serial_size(const pointer<T,A> &t) {
+    return serial_size(t, typename pointer<T,A>::is_list{});
+  }
+
+private:
+  template<typename Archive> static void
+  save(Archive &a, const pointer<T,A> &t, std::false_type) { base::save(a, t); }
+  template<typename Archive> static void
+  load(Archive &a, pointer<T,A> &t, std::false_type) { base::load(a, t); }
+  static std::size_t serial_size(const pointer<T,A> &t, std::false_type) {
+    return base::serial_size(t);
+  }
+
+  // For lists, marshal each node's other fields followed by the next
+  // link in a loop, which yields the same encoding as recursion
+  // without using stack (or marshaling_stack_limit) per node.
+  template<typename Archive> static void
+  save(Archive &a, const pointer<T,A> &t, std::true_type) {
+    for (const pointer<T,A> *p = &t;; p = &pointer<T,A>::next(**p)) {
+      archive(a, p->size());
+      if (!*p)
+	return;
+      const T &node = **p;
+      detail::list_node_fields<xdr_traits<T>>::apply(
+	[&a, &node](auto field) { archive(a, node.*field); });
+    }
+  }
+  template<typename Archive> static void
+  load(Archive &a, pointer<T,A> &t, std::true_type) {
+    for (pointer<T,A> *p = &t;; p = &pointer<T,A>::next(**p)) {
+      uint32_t n;
+      archive(a, n);
+      p->check_size(n);
+      if (!n)
+	return p->reset();
+      T &node = p->activate();
+      detail::list_node_fields<xdr_traits<T>>::apply(
+	[&a, &node](auto field) { archive(a, node.*field); });
+      xdr::validate(node);
+    }
+  }
+  static std::size_t serial_size(const pointer<T,A> &t, std::true_type) {
+    std::size_t s = 4;
+    for (const pointer<T,A> *p = &t; *p; p = &pointer<T,A>::next(**p)) {
+      const T &node = **p;
+      s += 4;
+      detail::list_node_fields<xdr_traits<T>>::apply(
+	[&s, &node](auto field) { s += xdr_size(node.*field); });
+    }
+    return s;
+  }
+};
 
 
 ////////////////////////////////////////////////////////////////
@@ -0,0 +1,355 @@
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <xdrpp/uring.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// Multishot receive is the newest feature needed (Linux 6.0).
+#ifdef IORING_RECV_MULTISHOT
+#define XDRPP_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif // IORING_RECV_MULTISHOT
+#endif // __has_include(<linux/io_uring.h>)
+#endif // __linux__ && __has_include
+
+namespace xdr {
+
+class io_ring::op {
+  friend class io_ring;
+  cb_t cb_;
+  std::shared_ptr<void> keep_;
+  bool detached_ {false};
+  explicit op(cb_t &&cb) : cb_(std::move(cb)) {}
+};
+
+#ifdef XDRPP_URING
+
+namespace {
+
+// Buffers handed to the kernel all belong to this group.
+constexpr std::uint16_t bgid = 0;
+
+template<typename T> inline T
+load_acquire(const T *p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<typename T> inline void
+store_release(T *p, T v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+std::size_t
+page_round(std::size_t n)
+{
+  std::size_t pg = sysconf(_SC_PAGESIZE);
+  return (n + pg - 1) & ~(pg - 1);
+}
+
+} // namespace
+
+std::unique_ptr<io_ring>
+io_ring::create(pollset &ps, unsigned entries, std::size_t bufsize,
+		unsigned nbufs)
+{
+  assert(nbufs > 0 && nbufs <= 0x8000 && !(nbufs & (nbufs - 1)));
+  std::unique_ptr<io_ring> r(new io_ring(ps, bufsize, nbufs));
+  if (!r->init(entries))
+    return nullptr;
+  return r;
+}
+
+bool
+io_ring::init(unsigned entries)
+{
+  io_uring_params p;
+  std::memset(&p, 0, sizeof p);
+  fd_ = syscall(__NR_io_uring_setup, entries, &p);
+  if (fd_ == -1)
+    return false;
+  set_close_on_exec(sock_t(fd_));
+  // Without NODROP, completions could be lost when the ring is full.
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)
+      || !(p.features & IORING_FEAT_NODROP))
+    return false;
+
+  sqmap_size_ = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+			 p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+  sqmap_ = mmap(nullptr, sqmap_size_, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sqmap_ == MAP_FAILED) {
+    sqmap_ = nullptr;
+    return false;
+  }
+  sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, sqes_size_, PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    return false;
+  sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(sqmap_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+  sq_mask_ = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+  sq_entries_ = p.sq_entries;
+  cq_head_ = reinterpret_cast<unsigned *>(sq + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(sq + p.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned *>(sq + p.cq_off.ring_mask);
+  cqes_ = sq + p.cq_off.cqes;
+
+  // The provided-buffer ring is an array of io_uring_buf whose first
+  // entry's resv field is the tail.
+  bufring_size_ = page_round(nbufs_ * sizeof(io_uring_buf));
+  bufring_ = mmap(nullptr, bufring_size_, PROT_READ|PROT_WRITE,
+		  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (bufring_ == MAP_FAILED) {
+    bufring_ = nullptr;
+    return false;
+  }
+  io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof reg);
+  reg.ring_addr = reinterpret_cast<std::uintptr_t>(bufring_);
+  reg.ring_entries = nbufs_;
+  reg.bgid = bgid;
+  if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING,
+	      &reg, 1) == -1)
+    return false;
+  bufs_.reset(new char[nbufs_ * bufsize_]);
+  for (unsigned i = 0; i < nbufs_; i++)
+    recycle(i);
+  return true;
+}
+
+io_ring::~io_ring()
+{
+  *destroyed_ = true;
+  // Cancel whatever is left and wait for the final completions, so
+  // the kernel is done with every op (and its keep_) before they are
+  // freed.  Callbacks are no longer called, as their users are gone.
+  if (nops_) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    while (nops_) {
+      int n = syscall(__NR_io_uring_enter, fd_, unsubmitted_, 1,
+		      IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (n >= 0)
+	unsubmitted_ -= std::min(unsigned(n), unsubmitted_);
+      else if (errno != EINTR)
+	break;			// Leak the ops rather than hang
+      reap();
+    }
+  }
+  if (nops_)
+    ps_.fd_cb(sock_t(fd_), pollset::Read);
+  if (bufring_)
+    munmap(bufring_, bufring_size_);
+  if (sqes_)
+    munmap(sqes_, sqes_size_);
+  if (sqmap_)
+    munmap(sqmap_, sqmap_size_);
+  if (fd_ != -1)
+    ::close(fd_);
+}
+
+bool
+io_ring::more(unsigned flags)
+{
+  return flags & IORING_CQE_F_MORE;
+}
+
+io_uring_sqe *
+io_ring::get_sqe()
+{
+  if (*sq_tail_ - load_acquire(sq_head_) >= sq_entries_)
+    submit();
+  unsigned tail = *sq_tail_;
+  unsigned i = tail & sq_mask_;
+  io_uring_sqe *sqe = &sqes_[i];
+  std::memset(sqe, 0, sizeof *sqe);
+  sq_array_[i] = i;
+  // The kernel only looks at the entry once we call io_uring_enter.
+  store_release(sq_tail_, tail + 1);
+  ++unsubmitted_;
+  schedule_submit();
+  return sqe;
+}
+
+// Submit at the end of the poll iteration, with whatever else has
+// been queued by then.
+void
+io_ring::schedule_submit()
+{
+  if (submit_pending_)
+    return;
+  submit_pending_ = true;
+  ps_.defer_cb([this,destroyed=destroyed_]() {
+      if (*destroyed)
+	return;
+      submit_pending_ = false;
+      submit();
+    });
+}
+
+io_ring::op *
+io_ring::start(io_uring_sqe *sqe, cb_t &&cb)
+{
+  op *o = new op(std::move(cb));
+  sqe->user_data = reinterpret_cast<std::uintptr_t>(o);
+  if (!nops_++)
+    ps_.fd_cb(sock_t(fd_), pollset::Read, [this](){ reap(); });
+  return o;
+}
+
+void
+io_ring::submit()
+{
+  while (unsubmitted_) {
+    int n = syscall(__NR_io_uring_enter, fd_, unsubmitted_, 0, 0, nullptr, 0);
+    ++nenter_;
+    if (n > 0)
+      unsubmitted_ -= n;
+    else if (n == 0)
+      break;
+    else if (errno == EAGAIN || errno == EBUSY) {
+      // The completion queue is backed up.  Drain it and retry, but
+      // not from within reap, whose callbacks could be disrupted.
+      if (reaping_)
+	return schedule_submit();
+      reap();
+    }
+    else if (errno != EINTR)
+      throw std::system_error(errno, std::system_category(),
+			      "io_uring_enter");
+  }
+}
+
+void
+io_ring::reap()
+{
+  reaping_ = true;
+  struct cleanup {
+    bool &reaping_;
+    ~cleanup() { reaping_ = false; }
+  } c {reaping_};
+  for (unsigned head; (head = *cq_head_) != load_acquire(cq_tail_);) {
+    const io_uring_cqe *cqe = reinterpret_cast<const io_uring_cqe *>(cqes_)
+      + (head & cq_mask_);
+    op *o = reinterpret_cast<op *>(cqe->user_data);
+    int res = cqe->res;
+    unsigned flags = cqe->flags;
+    // Free the slot before the callback, which may submit more.
+    store_release(cq_head_, head + 1);
+    ++ncomplete_;
+    if (!o)
+      continue;			// A cancellation request
+
+    const char *buf = nullptr;
+    unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (flags & IORING_CQE_F_BUFFER)
+      buf = bufs_.get() + bid * bufsize_;
+    if (!o->detached_ && !*destroyed_)
+      o->cb_(res, flags, buf);
+    if (buf)
+      recycle(bid);
+    if (!more(flags)) {
+      delete o;
+      if (!--nops_)
+	ps_.fd_cb(sock_t(fd_), pollset::Read);
+    }
+  }
+}
+
+void
+io_ring::recycle(unsigned bid)
+{
+  io_uring_buf *ring = static_cast<io_uring_buf *>(bufring_);
+  io_uring_buf &b = ring[buftail_ & (nbufs_ - 1)];
+  b.addr = reinterpret_cast<std::uintptr_t>(bufs_.get() + bid * bufsize_);
+  b.len = bufsize_;
+  b.bid = bid;
+  store_release(&ring[0].resv, ++buftail_);
+}
+
+io_ring::op *
+io_ring::recv_multishot(sock_t s, cb_t cb)
+{
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = s.fd_;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = bgid;
+  return start(sqe, std::move(cb));
+}
+
+io_ring::op *
+io_ring::accept_multishot(sock_t s, cb_t cb)
+{
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = s.fd_;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  return start(sqe, std::move(cb));
+}
+
+io_ring::op *
+io_ring::sendmsg(sock_t s, const msghdr *mh, cb_t cb)
+{
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = s.fd_;
+  sqe->addr = reinterpret_cast<std::uintptr_t>(mh);
+  sqe->len = 1;
+  return start(sqe, std::move(cb));
+}
+
+void
+io_ring::cancel(op *o)
+{
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = reinterpret_cast<std::uintptr_t>(o);
+  // Submit right away, as o could be freed (and its address reused)
+  // before the end of the poll iteration.
+  submit();
+}
+
+void
+io_ring::release(op *o, std::shared_ptr<void> keep)
+{
+  o->detached_ = true;
+  o->keep_ = std::move(keep);
+  cancel(o);
+}
+
+#else // !XDRPP_URING
+
+std::unique_ptr<io_ring>
+io_ring::create(pollset &, unsigned, std::size_t, unsigned)
+{
+  return nullptr;
+}
+
+// No io_ring can exist, so the rest is unreachable.
+io_ring::~io_ring() {}
+bool io_ring::more(unsigned) { return false; }
+io_ring::op *io_ring::recv_multishot(sock_t, cb_t) { return nullptr; }
+io_ring::op *io_ring::accept_multishot(sock_t, cb_t) { return nullptr; }
+io_ring::op *io_ring::sendmsg(sock_t, const msghdr *, cb_t) { return nullptr; }
+void io_ring::cancel(op *) {}
+void io_ring::release(op *, std::shared_ptr<void>) {}
+
+#endif // !XDRPP_URING
+
+}
@@ -0,0 +1,126 @@
+// -*- C++ -*-
+
+//! \file uring.h Completion-based socket I/O using Linux io_uring.
+
+#ifndef _XDRPP_URING_H_INCLUDED_
+#define _XDRPP_URING_H_INCLUDED_ 1
+
+#include <xdrpp/pollset.h>
+
+struct io_uring_sqe;
+
+namespace xdr {
+
+//! An io_uring instance driven from a pollset.  Operations are
+//! submitted together, once per PollSet::poll iteration, and their
+//! completions are processed when the pollset finds the ring
+//! readable.  Multishot receives take their data from a ring of
+//! buffers shared by all sockets (the \e provided buffers), so an idle
+//! connection holds no receive buffer in the kernel.
+//!
+//! Use \c msg_sock::set_uring and \c
+//! rpc_tcp_listener_common::set_uring to do I/O through a ring rather
+//! than with \c readv and \c writev.  The ring must outlive every
+//! object using it.  There is no io_uring library dependency, but
+//! multishot operations need Linux 6.0 or later.
+class io_ring {
+public:
+  //! Called with the result and flags of each completion.  For
+  //! operations that select a provided buffer, \c buf points to the
+  //! data received, which is only valid during the call.
+  using cb_t = std::function<void(int res, unsigned flags, const char *buf)>;
+  class op;
+
+  static constexpr unsigned default_entries = 256;
+  static constexpr std::size_t default_bufsize = 0x4000;
+  static constexpr unsigned default_nbufs = 256;
+
+  //! Returns \c nullptr if the system does not support the io_uring
+  //! features needed, so that callers can fall back to polling.
+  //! \c nbufs must be a power of 2 no larger than 32768.
+  static std::unique_ptr<io_ring> create(pollset &ps,
+					 unsigned entries = default_entries,
+					 std::size_t bufsize = default_bufsize,
+					 unsigned nbufs = default_nbufs);
+  //! Cancels any operations still outstanding and waits for the
+  //! kernel to finish with them, without calling their callbacks.
+  ~io_ring();
+  io_ring(const io_ring &) = delete;
+  io_ring &operator=(const io_ring &) = delete;
+
+  //! Receive repeatedly into provided buffers until the connection
+  //! closes, fails, or runs out of buffers (in which case the final
+  //! completion has \c res \c -ENOBUFS).
+  op *recv_multishot(sock_t s, cb_t cb);
+  //! Accept connections repeatedly; \c res is each new descriptor.
+  op *accept_multishot(sock_t s, cb_t cb);
+  //! Send the data described by \c mh, which (along with its iovecs
+  //! and data) must remain valid until the completion.
+  op *sendmsg(sock_t s, const msghdr *mh, cb_t cb);
+
+  //! Ask the kernel to stop an operation.  Completions still arrive
+  //! (including a final one, typically with \c -ECANCELED).
+  void cancel(op *o);
+  //! Cancel an operation and never call its callback again.  \c keep
+  //! (e.g., buffers the kernel may still be using) is held until the
+  //! operation actually finishes.
+  void release(op *o, std::shared_ptr<void> keep = nullptr);
+
+  //! True unless this is the final completion of an operation, after
+  //! which its \c op pointer is invalid.
+  static bool more(unsigned flags);
+
+  std::size_t bufsize() const { return bufsize_; }
+  //! Number of io_uring_enter calls and completions, for measuring
+  //! how well operations are batched.
+  std::size_t nenter() const { return nenter_; }
+  std::size_t ncomplete() const { return ncomplete_; }
+
+private:
+  pollset &ps_;
+  int fd_ {-1};
+  std::shared_ptr<bool> destroyed_{std::make_shared<bool>(false)};
+
+  void *sqmap_ {nullptr};
+  std::size_t sqmap_size_ {0};
+  io_uring_sqe *sqes_ {nullptr};
+  std::size_t sqes_size_ {0};
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned cq_mask_;
+  char *cqes_;
+
+  // Provided buffers
+  void *bufring_ {nullptr};
+  std::size_t bufring_size_ {0};
+  std::unique_ptr<char[]> bufs_;
+  std::size_t bufsize_;
+  unsigned nbufs_;
+  std::uint16_t buftail_ {0};
+
+  unsigned unsubmitted_ {0};
+  bool submit_pending_ {false};
+  bool reaping_ {false};
+  std::size_t nops_ {0};
+  std::size_t nenter_ {0};
+  std::size_t ncomplete_ {0};
+
+  io_ring(pollset &ps, std::size_t bufsize, unsigned nbufs)
+    : ps_(ps), bufsize_(bufsize), nbufs_(nbufs) {}
+  bool init(unsigned entries);
+  io_uring_sqe *get_sqe();
+  op *start(io_uring_sqe *sqe, cb_t &&cb);
+  void schedule_submit();
+  void submit();
+  void reap();
+  void recycle(unsigned bid);
+};
+
+} // namespace xdr
+
+#endif // !_XDRPP_URING_H_INCLUDED_